@@ -0,0 +1,15 @@
+# Gather all pd patches under LDSP_PROJECT
+file(GLOB_RECURSE FILES_TO_SEARCH "${LDSP_PROJECT}/*.pd")
+
+set(PD_SENSORS_ADC_FOUND FALSE CACHE BOOL "No sensor adc~ found" FORCE)
+
+# Scan through each file
+foreach(FILE_PATH IN LISTS FILES_TO_SEARCH)
+    file(READ "${FILE_PATH}" FILE_CONTENTS)
+
+    # Search for adc~ followed by 9 to 19, the sensor channels
+    if(FILE_CONTENTS MATCHES "adc~[^;]*[ \t]+(9|1[0-9])([^0-9]|$)")
+        set(PD_SENSORS_ADC_FOUND TRUE CACHE BOOL "Found at least one sensor adc~" FORCE)
+        break()
+    endif()
+endforeach()
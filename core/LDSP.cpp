@@ -61,4 +61,9 @@ void LDSP_defaultSettings(LDSPinitSettings *settings)
     settings->deviceInId = ""; // if not specified at run-time, it is obtained from device num
     settings->cpuIndex = -1; // if not specified, no cpu affinity for audio thread, hence thread can run on any cpu
     settings->preserveMixer = 0; // by default, mixer paths are set to defaults at startup/cleanup, not allowing for more than one alsa device to be routed to/from the codec at once
+    settings->sensorsConfig = ""; // if not specified, sensors are set as in hw config json file, otherwise all enabled at max rate with no batching
+    settings->recordInputsFile = ""; // inputs are not recorded by default
+    settings->replayInputsFile = ""; // inputs are read from the phone by default
+    settings->probeCacheOff = 0; // results of device probing are reused across runs by default
+    settings->renderModule = ""; // in hot reload builds, default module file is used
 }
\ No newline at end of file
@@ -33,11 +33,21 @@
  */
 
 #include "Midi.h"
+#include "LDSP.h" // LDSP_getPeriodTime()
 #include <fcntl.h>
 #include <errno.h>
+#include <algorithm> // std::find
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h> // clock_gettime
+#include <sys/inotify.h>
+#include <dirent.h> // browse dirs
+#include <fstream> // proc files
+#include <cctype> // tolower
 
-#define kMidiInput 0
-#define kMidiOutput 1
+#define MIDI_MAX_EVENTS 16 // ports handled per wake up, the others are picked up by the next epoll_wait()
+#define MIDI_READ_BYTES 256 // read from input ports in chunks
+#define MIDI_QUEUE_BYTES 1024 // size of input and output byte queues of each object
 
 
 midi_byte_t midiMessageStatusBytes[midiMessageStatusBytesLength]=
@@ -54,88 +64,455 @@ midi_byte_t midiMessageStatusBytes[midiMessageStatusBytesLength]=
 
 unsigned int midiMessageNumDataBytes[midiMessageStatusBytesLength]={2, 2, 2, 2, 1, 1, 2, 0};
 
-//AV: Change of this
-//bool Midi::staticConstructed;
-bool Midi::inputThreadRunning;
-bool Midi::outputThreadRunning;
-pthread_t Midi::inputThread;
-pthread_t Midi::outputThread;
-bool Midi::shouldStop = false;
-int Midi::midiObjectNumber = 0;
-//VIC
-int	Midi::prioOrderReadThrd  = LDSPprioOrder_midiRead;
-int	Midi::prioOrderWriteThrd  = LDSPprioOrder_midiWrite;
 int Midi::verbose = 0;
 
 
-//AV: Removed Auxil
-//AuxiliaryTask Midi::midiInputTask;
-//AuxiliaryTask Midi::midiOutputTask;
-std::vector<Midi *> Midi::objAddrs[2];
+//VIC status byte tables, to avoid searching midiMessageStatusBytes for every byte
+// channel messages, indexed by upper nibble - 8
+static const MidiMessageType channelStatusTypes[7] = {
+	kmmNoteOff,
+	kmmNoteOn,
+	kmmPolyphonicKeyPressure,
+	kmmControlChange,
+	kmmProgramChange,
+	kmmChannelPressure,
+	kmmPitchBend
+};
+// system common messages, indexed by lower nibble [0xF0-0xF7]
+// SysEx start/end handled separately, 0xF4 and 0xF5 are undefined
+static const unsigned int systemCommonDataBytes[8] = {0, 2, 2, 1, 0, 0, 0, 0}; // F1 MTC quarter frame, F2 song position, F3 song select, F6 tune request
+
+#define MIDI_SYSEX_START 0xF0
+#define MIDI_SONG_POSITION 0xF2
+#define MIDI_SYSEX_END 0xF7
+#define MIDI_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+
+#define MIDI_CLOCK_MAX_TICK_INTERVAL 250000000.0 // ns, 10 bpm, longer gaps mean the clock was paused
+#define MIDI_CLOCK_SMOOTHING 0.1 // one-pole coefficient applied to tick intervals
+
 
-int MidiParser::parse(midi_byte_t* input, unsigned int length){
-	unsigned int consumedBytes = 0;
+int MidiParser::parse(midi_byte_t* input, unsigned int length, uint64_t timestamp){
 	for(unsigned int n = 0; n < length; n++){
-		consumedBytes++;
-		if(waitingForStatus == true){
-			int statusByte = input[n];
-			MidiMessageType newType = kmmNone;
-			if (statusByte >= 0x80){//it actually is a status byte
-				for(int n = 0; n < midiMessageStatusBytesLength; n++){ //find the statusByte in the array
-					if(midiMessageStatusBytes[n] == (statusByte&0xf0)){
-						newType = (MidiMessageType)n;
-						break;
-					}
-				}
-				elapsedDataBytes = 0;
-				waitingForStatus = false;
-				messages[writePointer].setType(newType);
-				messages[writePointer].setChannel((midi_byte_t)(statusByte&0xf));
-				consumedBytes++;
-			} else { // either something went wrong or it's a system message
+		midi_byte_t byte = input[n];
+
+		// real-time bytes can show up anywhere, even within other messages, and leave the parser state untouched
+		if(byte >= MIDI_CLOCK){
+			parseRealTime(byte, timestamp);
+			continue;
+		}
+
+		if(byte >= 0x80){ // status byte
+			// any status byte terminates a SysEx, but only its end byte completes it
+			if(inSysex){
+				inSysex = false;
+				if(byte == MIDI_SYSEX_END && !sysexOverflow && sysexCallback != NULL)
+					sysexCallback(&sysexBuffer[0], sysexLength, sysexCallbackArg);
+			}
+			if(byte == MIDI_SYSEX_END)
+				continue;
+
+			if(byte == MIDI_SYSEX_START){
+				inSysex = true;
+				sysexOverflow = false;
+				sysexLength = 0;
+				currentStatus = 0;
+				runningStatus = 0;
 				continue;
 			}
-		} else {
-			messages[writePointer].setDataByte(elapsedDataBytes, input[n]);
-			elapsedDataBytes++;
-			if(elapsedDataBytes == messages[writePointer].getNumDataBytes()){
-				// done with the current message
-				// call the callback if available
-				if(isCallbackEnabled() == true){
-					messageReadyCallback(getNextChannelMessage(), callbackArg);
-				}
-				waitingForStatus = true;
-				writePointer++;
-				if(writePointer == messages.size()){
-					writePointer = 0;
-				}
+
+			if(byte > MIDI_SYSEX_START){ // system common, cancels running status
+				currentStatus = byte;
+				runningStatus = 0;
+				expectedDataBytes = systemCommonDataBytes[byte & 0x07];
+				elapsedDataBytes = 0;
+				if(expectedDataBytes == 0)
+					completeSystemMessage();
+				continue;
 			}
+
+			// channel message, its status is also valid for the next messages without status byte
+			runningStatus = byte;
+			startChannelMessage(byte);
+			continue;
+		}
+
+		// data byte
+		if(inSysex){
+			if(sysexLength < sysexBuffer.size())
+				sysexBuffer[sysexLength++] = byte;
+			else
+				sysexOverflow = true;
+			continue;
+		}
+
+		if(currentStatus == 0){
+			if(runningStatus == 0)
+				continue; // no status to refer to, e.g., we started listening mid-message
+			startChannelMessage(runningStatus); // running status
+		}
+
+		if(currentStatus >= MIDI_SYSEX_START){
+			systemData[elapsedDataBytes++] = byte;
+			if(elapsedDataBytes == expectedDataBytes)
+				completeSystemMessage();
+		}
+		else {
+			currentMessage.setDataByte(elapsedDataBytes++, byte);
+			if(elapsedDataBytes == expectedDataBytes)
+				completeChannelMessage(timestamp);
 		}
 	}
 
-	return consumedBytes;
+	return length;
 };
 
+void MidiParser::startChannelMessage(midi_byte_t statusByte){
+	MidiMessageType type = channelStatusTypes[(statusByte >> 4) - 8];
+	currentStatus = statusByte;
+	currentMessage.setType(type);
+	currentMessage.setChannel(statusByte & 0x0F);
+	expectedDataBytes = midiMessageNumDataBytes[type];
+	elapsedDataBytes = 0;
+}
+
+void MidiParser::completeChannelMessage(uint64_t timestamp){
+	currentStatus = 0; // next data byte, if any, will use running status
+	currentMessage.setTimestamp(timestamp); // message happens now
+
+	unsigned int nextWritePointer = writePointer.load(std::memory_order_relaxed) + 1;
+	if(nextWritePointer == messages.size()){
+		nextWritePointer = 0;
+	}
+	if(nextWritePointer == readPointer.load(std::memory_order_acquire)){
+		// full, never overwrite messages that may be being read
+		droppedMessages.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	messages[writePointer] = currentMessage;
+	writePointer.store(nextWritePointer, std::memory_order_release); // message visible to readers from now on
+
+	// call the callback if available
+	if(isCallbackEnabled() == true){
+		messageReadyCallback(getNextChannelMessage(), callbackArg);
+	}
+}
+
+void MidiParser::completeSystemMessage(){
+	if(currentStatus == MIDI_SONG_POSITION)
+		clock.setSongPosition(systemData[0] | (systemData[1] << 7)); // lsb first
+	if(systemCallback != NULL)
+		systemCallback(currentStatus, systemCallbackArg);
+	currentStatus = 0;
+}
+
+void MidiParser::parseRealTime(midi_byte_t statusByte, uint64_t timestamp){
+	switch(statusByte){
+		case MIDI_CLOCK:
+			clock.tick(timestamp);
+			break;
+		case MIDI_START:
+			clock.start();
+			break;
+		case MIDI_CONTINUE:
+			clock.resume();
+			break;
+		case MIDI_STOP:
+			clock.stop();
+			break;
+		default: // active sensing, reset, undefined
+			break;
+	}
+	if(systemCallback != NULL)
+		systemCallback(statusByte, systemCallbackArg);
+}
+
+const std::vector<MidiBlockMessage>& MidiParser::getBlockMessages(unsigned int audioFrames, float sampleRate){
+	blockMessages.clear();
+	uint64_t periodTime = LDSP_getPeriodTime();
+	while(numAvailableMessages() > 0){
+		uint64_t timestamp = messages[readPointer].getTimestamp();
+		if(periodTime > 0 && timestamp > periodTime)
+			break; // received after the current block started, belongs to the next one
+
+		MidiBlockMessage blockMessage;
+		blockMessage.frame = 0;
+		// messages are delayed by exactly one block:
+		// received one block before this one started -> first frame, received right as it started -> last frame
+		if(periodTime > 0 && timestamp > 0){
+			double ageFrames = (double)(periodTime - timestamp) * sampleRate / 1000000000.0;
+			int frame = (int)audioFrames - (int)(ageFrames + 0.5);
+			if(frame < 0)
+				frame = 0; // older than a block, e.g., render() did not check for a while
+			else if(frame > (int)audioFrames - 1)
+				frame = audioFrames - 1;
+			blockMessage.frame = frame;
+		}
+		blockMessage.message = getNextChannelMessage();
+		blockMessages.push_back(blockMessage); // never more than the capacity reserved in the constructor
+	}
+	return blockMessages;
+}
+
+
+MidiClock::MidiClock(){
+	seq = 0;
+	lastTickTime = 0;
+	ticks = 0;
+	tickInterval = 0;
+	running = false;
+	holdNextTick = false;
+}
+
+// sequence lock, odd while the input thread is updating
+void MidiClock::beginUpdate(){
+	seq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void MidiClock::endUpdate(){
+	seq.fetch_add(1, std::memory_order_release);
+}
+
+void MidiClock::tick(uint64_t timestamp){
+	beginUpdate();
+	uint64_t last = lastTickTime.load(std::memory_order_relaxed);
+	if(last > 0 && timestamp > last){
+		double interval = timestamp - last;
+		double prevInterval = tickInterval.load(std::memory_order_relaxed);
+		if(interval > MIDI_CLOCK_MAX_TICK_INTERVAL || prevInterval == 0)
+			tickInterval.store(interval > MIDI_CLOCK_MAX_TICK_INTERVAL ? 0 : interval, std::memory_order_relaxed); // clock [re]started
+		else
+			tickInterval.store(prevInterval + MIDI_CLOCK_SMOOTHING*(interval - prevInterval), std::memory_order_relaxed); // smooths usb jitter
+	}
+	lastTickTime.store(timestamp, std::memory_order_relaxed);
+	if(running.load(std::memory_order_relaxed)){
+		if(holdNextTick.load(std::memory_order_relaxed))
+			holdNextTick.store(false, std::memory_order_relaxed);
+		else
+			ticks.fetch_add(1, std::memory_order_relaxed);
+	}
+	endUpdate();
+}
+
+void MidiClock::start(){
+	beginUpdate();
+	ticks.store(0, std::memory_order_relaxed);
+	holdNextTick.store(true, std::memory_order_relaxed); // first tick after start is the beginning
+	running.store(true, std::memory_order_relaxed);
+	endUpdate();
+}
+
+void MidiClock::resume(){
+	beginUpdate();
+	running.store(true, std::memory_order_relaxed);
+	endUpdate();
+}
+
+void MidiClock::stop(){
+	beginUpdate();
+	running.store(false, std::memory_order_relaxed);
+	endUpdate();
+}
+
+void MidiClock::setSongPosition(unsigned int sixteenths){
+	beginUpdate();
+	ticks.store((uint64_t)sixteenths * 6, std::memory_order_relaxed); // 6 ticks per sixteenth
+	holdNextTick.store(true, std::memory_order_relaxed);
+	endUpdate();
+}
+
+float MidiClock::getBpm(){
+	double interval = tickInterval.load(std::memory_order_relaxed);
+	if(interval <= 0)
+		return 0;
+	return 60000000000.0 / (interval * 24);
+}
+
+bool MidiClock::isRunning(){
+	return running.load(std::memory_order_relaxed);
+}
+
+double MidiClock::getBeats(unsigned int frame, unsigned int audioFrames, float sampleRate){
+	uint64_t last;
+	uint64_t tickCount;
+	double interval;
+	bool isRunning;
+	bool isHeld;
+	unsigned int s1, s2;
+	do {
+		s1 = seq.load(std::memory_order_acquire);
+		last = lastTickTime.load(std::memory_order_relaxed);
+		tickCount = ticks.load(std::memory_order_relaxed);
+		interval = tickInterval.load(std::memory_order_relaxed);
+		isRunning = running.load(std::memory_order_relaxed);
+		isHeld = holdNextTick.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s2 = seq.load(std::memory_order_relaxed);
+	} while((s1 & 1) || s1 != s2);
+
+	double position = tickCount;
+	uint64_t periodTime = LDSP_getPeriodTime();
+	if(isRunning && !isHeld && interval > 0 && last > 0 && periodTime > 0){
+		// time of the frame, with the same one block delay used for messages
+		double frameTime = (double)periodTime - (double)(audioFrames - frame) * 1000000000.0 / sampleRate;
+		double sinceTick = (frameTime - (double)last) / interval;
+		if(sinceTick > 1)
+			sinceTick = 1; // never run ahead of the next tick
+		else if(sinceTick < 0)
+			sinceTick = 0;
+		position += sinceTick;
+	}
+	return position / 24;
+}
+
+
+//VIC state of the thread that serves all the ports of all Midi objects
+struct midiEngineState {
+	int epoll = -1;
+	int wakeEvent = -1; // signaled when output is queued while the thread sleeps, or to make it stop
+	pthread_t thread;
+	bool running = false;
+	int prioOrder = LDSPprioOrder_midiRead;
+	std::atomic<bool> shouldStop{false};
+	std::atomic<bool> sleeping{false};
+	std::mutex lifeMutex; // start/stop
+	std::mutex mutex; // protects port lists and parsers while the thread uses them
+	std::vector<Midi *> inputs;
+	std::vector<Midi *> outputs;
+	// hot-plug
+	int inotify = -1;
+	std::string devDir = MIDI_DEV_DIR;
+	std::string procDir = MIDI_PROC_DIR;
+	std::vector<Midi *> autoConnects;
+};
+
+// never destroyed, Midi objects may be global and be destroyed after this file's statics
+static midiEngineState &getMidiEngine(){
+	static midiEngineState *engine = new midiEngineState();
+	return *engine;
+}
+
+static int startMidiEngine(int prioOrder, void *(*loop)(void *)){
+	midiEngineState &engine = getMidiEngine();
+	std::lock_guard<std::mutex> lock(engine.lifeMutex);
+	if(engine.running)
+		return 0;
+
+	engine.epoll = epoll_create(1); // epoll_create1() needs API 21, size is ignored anyway
+	if(engine.epoll >= 0)
+		fcntl(engine.epoll, F_SETFD, FD_CLOEXEC);
+	engine.wakeEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	struct epoll_event wakeEv = {};
+	wakeEv.events = EPOLLIN;
+	wakeEv.data.ptr = NULL;
+	if(engine.epoll < 0 || engine.wakeEvent < 0 || epoll_ctl(engine.epoll, EPOLL_CTL_ADD, engine.wakeEvent, &wakeEv) < 0){
+		fprintf(stderr, "Cannot start Midi thread, error %d\n", errno);
+		if(engine.epoll >= 0)
+			close(engine.epoll);
+		if(engine.wakeEvent >= 0)
+			close(engine.wakeEvent);
+		engine.epoll = -1;
+		engine.wakeEvent = -1;
+		return -1;
+	}
+
+	engine.prioOrder = prioOrder;
+	engine.shouldStop = false;
+	if(pthread_create(&engine.thread, NULL, loop, NULL) != 0){
+		fprintf(stderr, "Cannot start Midi thread\n");
+		close(engine.epoll);
+		close(engine.wakeEvent);
+		engine.epoll = -1;
+		engine.wakeEvent = -1;
+		return -1;
+	}
+	engine.running = true;
+	return 0;
+}
+
+static void stopMidiEngine(){
+	midiEngineState &engine = getMidiEngine();
+	std::lock_guard<std::mutex> lock(engine.lifeMutex);
+	if(!engine.running)
+		return;
+
+	engine.shouldStop = true;
+	uint64_t one = 1;
+	write(engine.wakeEvent, &one, sizeof(one));
+	pthread_join(engine.thread, NULL);
+	close(engine.epoll);
+	close(engine.wakeEvent);
+	engine.epoll = -1;
+	engine.wakeEvent = -1;
+	if(engine.inotify >= 0){
+		close(engine.inotify);
+		engine.inotify = -1;
+	}
+	engine.running = false;
+}
+
+// ports folder is watched by the midi thread, so that ports can be connected/disconnected as devices are plugged/unplugged
+static int watchMidiPorts(){
+	midiEngineState &engine = getMidiEngine();
+	std::lock_guard<std::mutex> lock(engine.lifeMutex);
+	if(engine.inotify >= 0)
+		return 0;
+
+	engine.inotify = inotify_init(); // inotify_init1() needs API 21
+	if(engine.inotify >= 0){
+		fcntl(engine.inotify, F_SETFL, fcntl(engine.inotify, F_GETFL) | O_NONBLOCK);
+		fcntl(engine.inotify, F_SETFD, FD_CLOEXEC);
+	}
+	struct epoll_event watchEv = {};
+	watchEv.events = EPOLLIN;
+	watchEv.data.ptr = &engine.inotify;
+	if(engine.inotify < 0 ||
+	   inotify_add_watch(engine.inotify, engine.devDir.c_str(), IN_CREATE | IN_ATTRIB | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0 ||
+	   epoll_ctl(engine.epoll, EPOLL_CTL_ADD, engine.inotify, &watchEv) < 0){
+		fprintf(stderr, "Cannot watch Midi ports in %s, error %d\n", engine.devDir.c_str(), errno);
+		if(engine.inotify >= 0)
+			close(engine.inotify);
+		engine.inotify = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static std::string toLower(std::string str){
+	for(char &c : str)
+		c = tolower(c);
+	return str;
+}
+
 
 Midi::Midi(){
 	outputPort = -1;
 	inputPort = -1;
+	inputRef.obj = this;
+	inputRef.isOutput = false;
+	outputRef.obj = this;
+	outputRef.isOutput = true;
 	inputParser = 0;
 	parserEnabled = false;
-	outputBytesReadPointer = -1;
-	outputBytesWritePointer = -1;
-	size_t inputBytesInitialSize = 1000;
-	inputBytes.resize(inputBytesInitialSize);
-	outputBytes.resize(inputBytesInitialSize);
+	inputBytes.resize(MIDI_QUEUE_BYTES);
+	outputBytes.resize(MIDI_QUEUE_BYTES);
 	inputBytesWritePointer = 0;
-	inputBytesReadPointer = inputBytes.size() - 1;
+	inputBytesReadPointer = 0;
+	outputBytesReadPointer = 0;
+	outputBytesWritePointer = 0;
+	outputBlocked = false;
+	outputReady = false;
+	autoInput = false;
+	autoOutput = false;
 	//AV: Static Constructor has been replaced
 	/*
 	if(!staticConstructed){
 		staticConstructor();
 	}
 	*/
-	midiObjectNumber++;
 }
 
 /*
@@ -147,153 +524,405 @@ void Midi::staticConstructor(){
 */
 
 Midi::~Midi(){
-	midiObjectNumber--;
-
-	if (midiObjectNumber <= 0){
-		shouldStop = true;
+	midiEngineState &engine = getMidiEngine();
+	bool noPortsLeft;
+	//VIC stop serving this object's ports before it goes away, the thread may be still serving other objects
+	{
+		std::lock_guard<std::mutex> lock(engine.mutex);
+		auto it = std::find(engine.autoConnects.begin(), engine.autoConnects.end(), this);
+		if(it != engine.autoConnects.end())
+			engine.autoConnects.erase(it);
+		closePort(false);
+		closePort(true);
+		noPortsLeft = engine.inputs.empty() && engine.outputs.empty() && engine.autoConnects.empty();
 	}
+
+	if(noPortsLeft)
+		stopMidiEngine();
+
+	delete inputParser;
 }
 
 void Midi::enableParser(bool enable){
+	// parser may be in use on the midi thread
+	std::lock_guard<std::mutex> lock(getMidiEngine().mutex);
+	delete/*[]*/ inputParser;
+	inputParser = 0;
 	if(enable == true){
-		delete/*[]*/ inputParser;
 		inputParser = new MidiParser();
 		parserEnabled = true;
 	} else {
-		delete/*[]*/ inputParser;
 		parserEnabled = false;
 	}
 }
 
-void *Midi::midiInputLoop(void*){
+//VIC a single thread blocks on all the opened ports, parses input bytes as soon as they arrive and sends queued output
+// no polling period, so no added latency/jitter and no wake ups when ports are silent
+// output ports are non-blocking, a slow port waits for EPOLLOUT without holding back the others
+void *Midi::midiLoop(void*){
+	midiEngineState &engine = getMidiEngine();
+
     // set thread priority
-	set_priority(prioOrderReadThrd, "MidiInput", false);
+	set_priority(engine.prioOrder, "Midi", false);
 
 	// set minimum thread niceness
- 	set_niceness(-20, "MidiInput", false);
-	
-	for(unsigned int n = 0; n < objAddrs[kMidiInput].size(); n++){
-		objAddrs[kMidiInput][n] -> readInputLoop();
+ 	set_niceness(-20, "Midi", false);
+
+	struct epoll_event events[MIDI_MAX_EVENTS];
+	while(!engine.shouldStop){
+		// announce we may sleep, then check queued output again, or we may miss bytes queued right before the announcement
+		engine.sleeping.store(true);
+		bool pending = false;
+		{
+			std::lock_guard<std::mutex> lock(engine.mutex);
+			for(Midi *obj : engine.outputs)
+				pending |= (!obj->outputBlocked && obj->outputPending());
+		}
+		int ready = epoll_wait(engine.epoll, events, MIDI_MAX_EVENTS, pending ? 0 : -1);
+		engine.sleeping.store(false);
+		if(ready < 0){
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "Error while waiting for midi ports %d\n", errno);
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(engine.mutex);
+		for(int i = 0; i < ready; i++){
+			void *ref = events[i].data.ptr;
+			if(ref == NULL){ // wake up event, just reset it
+				uint64_t count;
+				read(engine.wakeEvent, &count, sizeof(count));
+				continue;
+			}
+			if(ref == &engine.inotify){ // something changed in ports folder
+				char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+				while(read(engine.inotify, buf, sizeof(buf)) > 0); // we rescan anyway, no need to look at single events
+				handlePortsChange();
+				continue;
+			}
+			// the port may have been closed since epoll_wait() returned, so look for it before using the reference
+			for(Midi *obj : engine.inputs){
+				if(ref == &obj->inputRef){
+					obj->handlePortEvent(false, events[i].events);
+					break;
+				}
+			}
+			for(Midi *obj : engine.outputs){
+				if(ref == &obj->outputRef){
+					obj->handlePortEvent(true, events[i].events);
+					break;
+				}
+			}
+		}
+
+		// send queued output, whether we were woken up for it or not
+		for(Midi *obj : engine.outputs){
+			if(!obj->outputBlocked)
+				obj->writeQueuedOutput();
+		}
 	}
 	return (void *)0;
 }
 
-void *Midi::midiOutputLoop(void*){
-    // set thread priority
-	set_priority(prioOrderWriteThrd, "MidiOutput", false);
-
-	// set minimum thread niceness
- 	set_niceness(-20, "MidiOutput", false);
+// called on the midi thread only, with port lists locked
+void Midi::handlePortEvent(bool isOutput, unsigned int events){
+	int epoll = getMidiEngine().epoll;
+	if(!isOutput){
+		if(readInput() < 0 || (events & (EPOLLERR | EPOLLHUP))){
+			// port is gone [e.g., device unplugged], stop listening or we would be woken up forever
+			epoll_ctl(epoll, EPOLL_CTL_DEL, inputPort, NULL);
+		}
+		return;
+	}
 
-	for(unsigned int n = 0; n < objAddrs[kMidiOutput].size(); n++){
-		objAddrs[kMidiOutput][n] -> writeOutputLoop();
+	if(events & (EPOLLERR | EPOLLHUP)){
+		printf("Midi output port closed\n");
+		epoll_ctl(epoll, EPOLL_CTL_DEL, outputPort, NULL);
+		outputReady = false;
+		return;
+	}
+	if(events & EPOLLOUT){
+		// port can take bytes again, stop watching it and let the loop send what is queued
+		struct epoll_event portEv = {};
+		portEv.events = 0;
+		portEv.data.ptr = &outputRef;
+		epoll_ctl(epoll, EPOLL_CTL_MOD, outputPort, &portEv);
+		outputBlocked = false;
 	}
-	return (void *)0;
 }
 
-void Midi::readInputLoop(){
-	while(!shouldStop){
-		int maxBytesToRead = inputBytes.size() - inputBytesWritePointer;
-		int ret = read(inputPort, &inputBytes[inputBytesWritePointer], sizeof(midi_byte_t)*maxBytesToRead);
+// reads everything available on the port and parses it or queues it for getInput(), called on the midi thread only
+// returns 0 once there is nothing left to read, -1 on error
+int Midi::readInput(){
+	midi_byte_t buffer[MIDI_READ_BYTES];
+	while(true){
+		int ret = read(inputPort, buffer, sizeof(buffer));
 		if(ret < 0){
-			if(errno != EAGAIN){ // read() would return EAGAIN when no data are available to read just now
-				//AV: printf change
-				printf("Error while reading midi %d\n", errno);
-			}
-			usleep(1000);
-			continue;
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN) // read() would return EAGAIN when no data are available to read just now
+				return 0;
+			//AV: printf change
+			printf("Error while reading midi %d\n", errno);
+			return -1;
 		}
-		inputBytesWritePointer += ret;
-		if(inputBytesWritePointer == inputBytes.size()){ //wrap pointer around
-			inputBytesWritePointer = 0;
+		if(ret == 0) // no more data
+			return 0;
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t timestamp = (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+
+		if(parserEnabled == true){ // if the parser is enabled, send the new data to it
+			inputParser->parse(buffer, ret, timestamp);
 		}
-
-		if(parserEnabled == true && ret > 0){ // if the parser is enabled and there is new data, send the data to it
-			int input;
-			while((input=_getInput()) >= 0){
-				midi_byte_t inputByte = (midi_byte_t)(input);
-				inputParser->parse(&inputByte, 1);
+		else {
+			unsigned int size = inputBytes.size();
+			unsigned int writePointer = inputBytesWritePointer.load(std::memory_order_relaxed);
+			for(int n = 0; n < ret; n++){
+				unsigned int nextWritePointer = (writePointer + 1) % size;
+				if(nextWritePointer == inputBytesReadPointer.load(std::memory_order_acquire))
+					break; // full, bytes are not retrieved fast enough
+				inputBytes[writePointer] = buffer[n];
+				writePointer = nextWritePointer;
 			}
+			inputBytesWritePointer.store(writePointer, std::memory_order_release);
 		}
-		if(ret < maxBytesToRead){ //no more data to retrieve at the moment
-			usleep(1000);
-		} // otherwise there might be more data ready to be read (we were at the end of the buffer), so don't sleep
-	}
-	printf("Input Loop Ended. ");
-	inputThreadRunning = false;
-}
-
-//VIC it seems that no bytes are ever written to outputBytes and the pointer are never moved
-// hence this thread IS NOT USED, it never sends any message to the port
-// the only way to send a MIDI messages is to use writeOutput() directly
-void Midi::writeOutputLoop(){
-	while(!shouldStop){
-		usleep(1000);
-		int length = outputBytesWritePointer - outputBytesReadPointer;
-		if(length < 0){
-			length = outputBytes.size() - outputBytesReadPointer;
-		}
-		if(length == 0){ //nothing to be written
-			continue;
-		}
-		int ret;
-		ret = write(outputPort, &outputBytes[outputBytesReadPointer], sizeof(midi_byte_t)*length);
-		if(ret < 0){ //error occurred
+		if(ret < (int)sizeof(buffer)){ //no more data to retrieve at the moment
+			return 0;
+		} // otherwise there might be more data ready to be read
+	}
+}
+
+// sends as many queued bytes as the port takes, called on the midi thread only
+// returns the number of bytes written, -1 on error
+int Midi::writeQueuedOutput(){
+	unsigned int readPointer = outputBytesReadPointer.load(std::memory_order_relaxed);
+	unsigned int writePointer = outputBytesWritePointer.load(std::memory_order_acquire);
+	int written = 0;
+	while(readPointer != writePointer){
+		// contiguous chunk, up to the end of the buffer
+		unsigned int length = (writePointer > readPointer) ? writePointer - readPointer : outputBytes.size() - readPointer;
+		int ret = write(outputPort, &outputBytes[readPointer], sizeof(midi_byte_t)*length);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN){
+				// port is full, wait until it can take more bytes
+				struct epoll_event portEv = {};
+				portEv.events = EPOLLOUT;
+				portEv.data.ptr = &outputRef;
+				epoll_ctl(getMidiEngine().epoll, EPOLL_CTL_MOD, outputPort, &portEv);
+				outputBlocked = true;
+				return written;
+			}
 			//AV: printf change
 			printf("error occurred while writing: %d\n", errno);
-			usleep(10000); //wait before retrying
-			continue;
+			// drop what is queued and stop using the port, retrying would likely fail again and keep the queue full
+			outputBytesReadPointer.store(writePointer, std::memory_order_release);
+			epoll_ctl(getMidiEngine().epoll, EPOLL_CTL_DEL, outputPort, NULL);
+			outputReady = false;
+			return -1;
 		}
+		readPointer = (readPointer + ret) % outputBytes.size();
+		outputBytesReadPointer.store(readPointer, std::memory_order_release); // free space as soon as possible
+		written += ret;
 	}
-	printf("Output Loop Ended. ");
-	outputThreadRunning = false;
+	return written;
+}
+
+bool Midi::outputPending(){
+	return outputBytesReadPointer.load(std::memory_order_relaxed) != outputBytesWritePointer.load(); // seq_cst, pairs with writeOutput()
 }
+
 int Midi::readFrom(const char* port,/*VIC added*/ int prioOrder){
-	objAddrs[kMidiInput].push_back(this);
-	inputPort = open(port, O_RDONLY | O_NONBLOCK | O_NOCTTY);
-	if(inputPort < 0){
+	//AV: Commented Auxiliary Task
+	//Bela_scheduleAuxiliaryTask(midiInputTask);
+	if(startMidiEngine(prioOrder, midiLoop) < 0)
 		return -1;
-	} else {
-		printf("Reading from Midi port %s\n", port);
-		//AV: Commented Auxiliary Task
-		//Bela_scheduleAuxiliaryTask(midiInputTask);
-		if(!inputThreadRunning) {
-			prioOrderReadThrd = prioOrder; //VIC
-			pthread_create(&inputThread, NULL, midiInputLoop, NULL);
-			inputThreadRunning = true;
-		}
-		return 1;
-	}
+	std::lock_guard<std::mutex> lock(getMidiEngine().mutex);
+	if(openPort(port, false) < 0)
+		return -1;
+	return 1;
 }
 
 int Midi::writeTo(const char* port,/*VIC added*/ int prioOrder){
-	objAddrs[kMidiOutput].push_back(this);
-	outputPort = open(port, O_WRONLY, 0);
-	if(outputPort < 0){
+	//AV: Commented Aux
+	//Bela_scheduleAuxiliaryTask(midiOutputTask);
+	if(startMidiEngine(prioOrder, midiLoop) < 0)
 		return -1;
-	} else {
+	std::lock_guard<std::mutex> lock(getMidiEngine().mutex);
+	if(openPort(port, true) < 0)
+		return -1;
+	return 1;
+}
+
+// opens the port and hands it to the midi thread, with port lists locked
+int Midi::openPort(const char* port, bool isOutput){
+	midiEngineState &engine = getMidiEngine();
+	int &fd = isOutput ? outputPort : inputPort;
+	if(fd >= 0)
+		closePort(isOutput); // one port per direction
+
+	// non-blocking, so that a slow output port cannot hold back the midi thread
+	int newFd = isOutput ? open(port, O_WRONLY | O_NONBLOCK, 0) : open(port, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+	if(newFd < 0)
+		return -1;
+
+	// outputs have no events to wait for until they get full, errors are reported anyway
+	// the thread can be waiting, it will be woken up right away if input data are already there
+	struct epoll_event portEv = {};
+	portEv.events = isOutput ? 0u : (uint32_t)EPOLLIN;
+	portEv.data.ptr = isOutput ? &outputRef : &inputRef;
+	if(epoll_ctl(engine.epoll, EPOLL_CTL_ADD, newFd, &portEv) < 0){
+		fprintf(stderr, "Cannot use Midi port %s, error %d\n", port, errno);
+		close(newFd);
+		return -1;
+	}
+
+	fd = newFd;
+	if(isOutput){
 		printf("Writing to Midi port %s\n", port);
-		//AV: Commented Aux
-		//Bela_scheduleAuxiliaryTask(midiOutputTask);
-		if(!outputThreadRunning) {
-			prioOrderWriteThrd = prioOrder; //VIC
-			pthread_create(&outputThread, NULL, midiOutputLoop, NULL);
-			outputThreadRunning = true;
+		outputPath = port;
+		outputBlocked = false;
+		engine.outputs.push_back(this);
+		outputReady = true;
+	}
+	else {
+		printf("Reading from Midi port %s\n", port);
+		inputPath = port;
+		engine.inputs.push_back(this);
+	}
+	return 0;
+}
+
+// with port lists locked
+void Midi::closePort(bool isOutput){
+	midiEngineState &engine = getMidiEngine();
+	int &fd = isOutput ? outputPort : inputPort;
+	if(fd < 0)
+		return;
+
+	std::vector<Midi *> &ports = isOutput ? engine.outputs : engine.inputs;
+	auto it = std::find(ports.begin(), ports.end(), this);
+	if(it != ports.end())
+		ports.erase(it);
+	if(engine.epoll >= 0)
+		epoll_ctl(engine.epoll, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	fd = -1;
+
+	if(isOutput){
+		outputReady = false;
+		outputBytesReadPointer.store(outputBytesWritePointer.load()); // drop what was meant for this port
+		outputPath.clear();
+	}
+	else
+		inputPath.clear();
+}
+
+std::vector<MidiPortInfo> Midi::getPorts(){
+	midiEngineState &engine = getMidiEngine();
+	std::vector<MidiPortInfo> ports;
+	DIR *dir = opendir(engine.devDir.c_str());
+	if(dir == NULL)
+		return ports;
+
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL){
+		MidiPortInfo info;
+		char extra;
+		if(sscanf(entry->d_name, "midiC%dD%d%c", &info.card, &info.device, &extra) != 2)
+			continue; // not a rawmidi port
+		info.path = engine.devDir + "/" + entry->d_name;
+		// first line of the rawmidi proc file is the port name
+		std::ifstream procFile(engine.procDir + "/card" + std::to_string(info.card) + "/midi" + std::to_string(info.device));
+		if(procFile.is_open())
+			getline(procFile, info.name);
+		ports.push_back(info);
+	}
+	closedir(dir);
+
+	std::sort(ports.begin(), ports.end(), [](const MidiPortInfo &a, const MidiPortInfo &b) {
+		return (a.card != b.card) ? a.card < b.card : a.device < b.device;
+	});
+	return ports;
+}
+
+void Midi::setPortsDirs(const char* devDir, const char* procDir){
+	midiEngineState &engine = getMidiEngine();
+	engine.devDir = devDir;
+	engine.procDir = procDir;
+}
+
+int Midi::autoConnect(const char* match, bool input, bool output, int prioOrder){
+	midiEngineState &engine = getMidiEngine();
+	if(startMidiEngine(prioOrder, midiLoop) < 0 || watchMidiPorts() < 0)
+		return -1;
+
+	std::lock_guard<std::mutex> lock(engine.mutex);
+	autoMatch = toLower(match);
+	autoInput = input;
+	autoOutput = output;
+	if(std::find(engine.autoConnects.begin(), engine.autoConnects.end(), this) == engine.autoConnects.end())
+		engine.autoConnects.push_back(this);
+
+	// in case the port is already there
+	handlePortsChange();
+	bool connected = (!input || inputPort >= 0) && (!output || outputPort >= 0);
+	return connected ? 1 : 0;
+}
+
+//VIC rescans the ports folder, closes the ports that disappeared and connects the auto connect objects still waiting for a port
+// called with port lists locked, by the midi thread when the folder changes or by autoConnect()
+// opening a port right when it is created may fail [permissions are set right after], so we retry on the next change [IN_ATTRIB]
+void Midi::handlePortsChange(){
+	midiEngineState &engine = getMidiEngine();
+
+	// copies, lists are modified while closing
+	std::vector<Midi *> inputs = engine.inputs;
+	for(Midi *obj : inputs){
+		if(access(obj->inputPath.c_str(), F_OK) != 0){
+			printf("Midi port %s unplugged\n", obj->inputPath.c_str());
+			obj->closePort(false);
+		}
+	}
+	std::vector<Midi *> outputs = engine.outputs;
+	for(Midi *obj : outputs){
+		if(access(obj->outputPath.c_str(), F_OK) != 0){
+			printf("Midi port %s unplugged\n", obj->outputPath.c_str());
+			obj->closePort(true);
+		}
+	}
+
+	if(engine.autoConnects.empty())
+		return;
+
+	std::vector<MidiPortInfo> ports = getPorts();
+	for(Midi *obj : engine.autoConnects){
+		for(MidiPortInfo &info : ports){
+			if(!obj->autoMatch.empty() && toLower(info.name).find(obj->autoMatch) == std::string::npos && toLower(info.path).find(obj->autoMatch) == std::string::npos)
+				continue;
+			if(obj->autoInput && obj->inputPort < 0)
+				obj->openPort(info.path.c_str(), false);
+			if(obj->autoOutput && obj->outputPort < 0)
+				obj->openPort(info.path.c_str(), true);
 		}
-		return 1;
 	}
 }
 
 int Midi::_getInput(){
 	if(inputPort < 0)
 		return -2;
-	if(inputBytesReadPointer == inputBytesWritePointer){
+	unsigned int readPointer = inputBytesReadPointer.load(std::memory_order_relaxed);
+	if(readPointer == inputBytesWritePointer.load(std::memory_order_acquire)){
 		return -1; // no bytes to read
 	}
-	midi_byte_t inputMessage = inputBytes[inputBytesReadPointer++];
-	if(inputBytesReadPointer == inputBytes.size()){ // wrap pointer
-		inputBytesReadPointer = 0;
+	midi_byte_t inputMessage = inputBytes[readPointer++];
+	if(readPointer == inputBytes.size()){ // wrap pointer
+		readPointer = 0;
 	}
+	inputBytesReadPointer.store(readPointer, std::memory_order_release);
 	return inputMessage;
 }
 
@@ -315,21 +944,42 @@ int Midi::writeOutput(midi_byte_t byte){
 	return writeOutput(&byte, 1);
 }
 
+//VIC no syscalls here, unless the midi thread is sleeping and needs to be woken up [non-blocking eventfd write]
 int Midi::writeOutput(midi_byte_t* bytes, unsigned int length){
-	int ret = write(outputPort, bytes, length);
-	if(ret < 0)
+	if(!outputReady)
 		return -1;
-	else
-		return 1;
+
+	unsigned int size = outputBytes.size();
+	unsigned int writePointer = outputBytesWritePointer.load(std::memory_order_relaxed);
+	unsigned int readPointer = outputBytesReadPointer.load(std::memory_order_acquire);
+	unsigned int freeBytes = (readPointer + size - writePointer - 1) % size; // one slot always empty, to tell full from empty
+	if(length > freeBytes)
+		return -1;
+
+	for(unsigned int n = 0; n < length; n++){
+		outputBytes[writePointer] = bytes[n];
+		if(++writePointer == size)
+			writePointer = 0;
+	}
+	outputBytesWritePointer.store(writePointer); // seq_cst, must not be reordered with the check below
+
+	midiEngineState &engine = getMidiEngine();
+	if(engine.sleeping.exchange(false)){
+		uint64_t one = 1;
+		write(engine.wakeEvent, &one, sizeof(one));
+	}
+	return 1;
 }
 
 MidiChannelMessage::MidiChannelMessage(){
 	_statusByte = -1;
 	_type 	 	= kmmNoteOff;
 	_channel 	= -1;
+	_timestamp	= 0;
 };
 MidiChannelMessage::MidiChannelMessage(MidiMessageType type){
 	setType(type);
+	_timestamp = 0;
 };
 MidiChannelMessage::~MidiChannelMessage(){};
 MidiMessageType MidiChannelMessage::getType(){
@@ -74,12 +74,17 @@ void LDSP_usage(const char *argv)
 	fprintf(stderr, "-i | --input-path <path name>\t\t\tInput mixer path\n");
 	fprintf(stderr, "-O | --capture-off\t\t\t\tDisables audio capture [capture enabled]\n");
 	fprintf(stderr, "-P | --sensors-off\t\t\t\tDisables sensors [sensors enabled]\n");
+	fprintf(stderr, "-e | --sensors-config <list>\t\t\tPer-sensor settings, as comma separated sensor[:rate Hz[:max report latency ms]] or sensor:off\n");
 	fprintf(stderr, "-Q | --ctrl-inputs-off\t\t\t\tDisables control inputs [control inputs enabled]\n");
 	fprintf(stderr, "-R | --ctrl-outputs-off\t\t\t\tDisables control outputs [control outputs enabled]\n");
 	fprintf(stderr, "-A | --audioserver-off\t\t\tTemporarily disables the Android audio server while LDSP is running [audioserver enabled]\n");
 	fprintf(stderr, "-m | --preserve-mixer-paths\t\t\tDoes not reset mixer paths to defaults at startup [mixer paths not preserved]\n");
+	fprintf(stderr, "-K | --probe-cache-off\t\t\t\tProbes devices from scratch, ignoring results cached in previous runs [cache enabled]\n");
 	fprintf(stderr, "-F | --perf-mode-off\t\t\t\tDisables CPU's governor peformance mode [performance mode enabled]\n");
 	fprintf(stderr, "-C | --cpu-affinity <cpu index>\t\t\tSets CPU affinity for the audio thread\n");
+	fprintf(stderr, "-w | --record-inputs <file>\t\t\tRecords audio in, sensors and control inputs of each period to file\n");
+	fprintf(stderr, "-y | --replay-inputs <file>\t\t\tReplays recorded inputs, in place of audio capture, sensors and control inputs\n");
+	fprintf(stderr, "-H | --render-module <file>\t\t\tRender module to load and watch, in hot reload builds only [libldsp_render.so]\n");
 	fprintf(stderr, "-v | --verbose\t\t\t\t\tPrints all phone's info, current settings main function calls [off]\n");
 	fprintf(stderr, "-h | --help\t\t\t\t\tPrints this and exits [off]\n");
 }
@@ -118,12 +123,17 @@ int LDSP_parseArguments(int *argc, char** argv, LDSPinitSettings *settings)
 		{ "input-path",       	 	'i', OPTPARSE_REQUIRED },
 		{ "capture-off",       	 	'O', OPTPARSE_NONE },
 		{ "sensors-off",       	 	'P', OPTPARSE_NONE },
+		{ "sensors-config",     	'e', OPTPARSE_REQUIRED },
 		{ "ctrl-inputs-off",     	'Q', OPTPARSE_NONE },
 		{ "ctrl-outputs-off",    	'R', OPTPARSE_NONE },
 		{ "audioserver-off", 		'A', OPTPARSE_NONE },
 		{ "preserve-mixer-paths",	'm', OPTPARSE_NONE },
+		{ "probe-cache-off",      	'K', OPTPARSE_NONE },
 		{ "perf-mode-off",      	'F', OPTPARSE_NONE },
 		{ "cpu-affinity",      		'C', OPTPARSE_REQUIRED },
+		{ "record-inputs",     		'w', OPTPARSE_REQUIRED },
+		{ "replay-inputs",     		'y', OPTPARSE_REQUIRED },
+		{ "render-module",     		'H', OPTPARSE_REQUIRED },
 		{ "verbose",         		'v', OPTPARSE_NONE },
 		{ "help",         			'h', OPTPARSE_NONE },
 		{ 0, 0, OPTPARSE_NONE }
@@ -181,6 +191,9 @@ int LDSP_parseArguments(int *argc, char** argv, LDSPinitSettings *settings)
 			case 'P':
 				settings->sensorsOff = 1;
 			 	break;
+			case 'e':
+				settings->sensorsConfig = opts.optarg;
+			 	break;
 			case 'Q':
 				settings->ctrlInputsOff = 1;
 			 	break;
@@ -193,9 +206,21 @@ int LDSP_parseArguments(int *argc, char** argv, LDSPinitSettings *settings)
 			case 'A':
 				settings->audioserverOff = 1;
 				break;
+			case 'K':
+				settings->probeCacheOff = 1;
+			 	break;
 			case 'F':
 				settings->perfModeOff = 1;
 			 	break;
+			case 'w':
+				settings->recordInputsFile = opts.optarg;
+			 	break;
+			case 'y':
+				settings->replayInputsFile = opts.optarg;
+			 	break;
+			case 'H':
+				settings->renderModule = opts.optarg;
+			 	break;
 			case 'v':
 				settings->verbose = 1;
 			 	break;
@@ -6,6 +6,7 @@
 #include "LDSP.h"
 #include "tinyalsaAudio.h" // for LDSPinternalContext
 #include "thread_utils.h"
+#include "probeCache.h"
 
 #include <sys/poll.h>
 #include <fcntl.h>
@@ -20,6 +21,14 @@ using std::pair;
 
 typedef vector<pair<string, string>> DevInfo;
 
+// an event of a device that we are interested into, with the max value of abs ones
+struct ctrlInputCap {
+    unsigned short event;
+    int code;
+    int absMax;
+};
+typedef vector<ctrlInputCap> DevCaps;
+
 LDSPctrlInputsContext ctrlInputsContext;
 extern LDSPinternalContext intContext;
 
@@ -36,6 +45,8 @@ pthread_t ctrlInput_thread = 0;
 struct pollfd *ufds;
 char **device_names;
 int nfds;
+DevInfo monitoredDevices; // path and name of each device we poll, to be cached
+vector<DevCaps> monitoredDevicesCaps; // and its capabilities, so that cached devices are not scanned again
 
 enum {
     PRINT_DEVICE_ERRORS     = 1U << 0,
@@ -55,9 +66,14 @@ int print_flags = 0;
 
 
 int initCtrlInputs();
+int openCachedCtrlInputDevices(DevInfo *devinfo);
+void cacheCtrlInputDevices();
+void resetCtrlInputDevices(DevInfo *devinfo);
 void initCtrlInputBuffers();
 void* ctrlInputs_loop(void*);
 void closeCtrlInputDevices();
+void storeCtrlInputEvent(int chn, int slot, int value);
+void publishCtrlInputsFrame();
 
 //VIC not important if unseuccessful, we will still run LDSP if no inputs can be read
 void LDSP_initCtrlInputs(LDSPinitSettings* settings)
@@ -65,6 +81,9 @@ void LDSP_initCtrlInputs(LDSPinitSettings* settings)
     ctrlInputsVerbose = settings->verbose;
     ctrlInputsOff = settings->ctrlInputsOff;
 
+    // changes are exposed even when ctrl inputs are off, they will simply never be set
+    intContext.ctrlInChanges = &ctrlInputsContext.changes;
+
     if(ctrlInputsOff)
         return;
 
@@ -75,10 +94,13 @@ void LDSP_initCtrlInputs(LDSPinitSettings* settings)
         // print_flags |= PRINT_DEVICE_ERRORS | PRINT_DEVICE | PRINT_DEVICE_NAME | PRINT_DEVICE_INFO | PRINT_VERSION;
     }
 
+    initProbeCache(settings);
+
     // if control inputs are off, we don't init them!
     bool inited = false;
     if(!ctrlInputsOff)
         inited = (initCtrlInputs()==0);
+    saveProbeCache();
     initCtrlInputBuffers();
 
 
@@ -90,7 +112,7 @@ void LDSP_initCtrlInputs(LDSPinitSettings* settings)
     //VIC user context is reference of this internal one, so no need to update it
         
     // run thread that monitors devices for events, only if we found at least one device that raises events we are interested into
-    if(inited && ctrlInputsContext.inputsCount > 0)
+    if(inited && ctrlInputsContext.inputsCount > 0 && ctrlInputsContext.inFrames.block != nullptr)
          pthread_create(&ctrlInput_thread, NULL, ctrlInputs_loop, NULL);
 }
 
@@ -117,13 +139,14 @@ void LDSP_cleanupCtrlInputs()
         delete[] ctrlInputsContext.ctrlInBuffer;
     if(ctrlInputsContext.buttonSupported != nullptr)
         delete[] ctrlInputsContext.buttonSupported;
+    if(ctrlInputsContext.inFrames.block != nullptr)
+        free(ctrlInputsContext.inFrames.block);
 }
 
 
 
 //--------------------------------------------------------------------------------------------------
 
-//TODO improve this code in terms of identation and atomics!
 void* ctrlInputs_loop(void* arg)
 {
     struct input_event event;
@@ -155,8 +178,17 @@ void* ctrlInputs_loop(void* arg)
                             continue;
                         }
                         
+                        // all the events received since the previous report belong to the same frame
+                        // so they are made visible to the audio thread all together
+                        if(event.type == EV_SYN)
+                        {
+                            if(event.code == SYN_REPORT)
+                                publishCtrlInputsFrame();
+                            continue;
+                        }
+
                         //VIC unfortunately, this has to be done explicitly
-                        if(event.code == ABS_MT_SLOT)
+                        if(event.type == EV_ABS && event.code == ABS_MT_SLOT)
                         {
                             slot = event.value;
                             continue;
@@ -165,23 +197,16 @@ void* ctrlInputs_loop(void* arg)
                         // let's check if the event that we received is among those that we want to store
                         // even if we are monitoring only the devices that send the events we are interested into, 
                         // it does not mean that such devices could not raise additional/unwanted events!
-                        if( event_map.find(event.type) != event_map.end() )  // only correct types
-                        {
-                            unordered_map<int, int> &code_map = event_map[event.type];    
-                            if (code_map.find(event.code) != code_map.end() ) // only correct codes
-                            {
-                                // let's restrieve associated ctrl input structure, via the associated channel
-                                int chn = code_map[event.code];
-                                ctrlInput_struct &ctrlIn = ctrlInputsContext.ctrlInputs[chn];
-                                
-                                // only multievent ctrl inputs have more slots to store parallel events
-                                int idx=0;
-                                if(ctrlIn.isMultiInput)
-                                     idx = slot;
-                                //printf("____event %d, code %d, value %d, chn %d, idx %d, vec %d\n", event.type, event.code, event.value, chn, idx, ctrlIn.value.size());
-                                ctrlIn.value[idx]->store(event.value, std::memory_order_relaxed); // atomic store, thread-safe!
-                            }
-                        }
+                        auto type_it = event_map.find(event.type);
+                        if(type_it == event_map.end()) // only correct types
+                            continue;
+                        auto code_it = type_it->second.find(event.code);
+                        if(code_it == type_it->second.end()) // only correct codes
+                            continue;
+
+                        // the associated channel tells us where to store the value
+                        //printf("____event %d, code %d, value %d, chn %d, slot %d\n", event.type, event.code, event.value, code_it->second, slot);
+                        storeCtrlInputEvent(code_it->second, slot, event.value);
                     }
                 }
             }
@@ -190,21 +215,65 @@ void* ctrlInputs_loop(void* arg)
     return (void *)0;
 }
 
-bool checkEvents(int fd, int print_flags, const char *device, const char *name, DevInfo *devinfo)
+// updates the staging frame and keeps track of what changed, called on the ctrl inputs thread only
+void storeCtrlInputEvent(int chn, int slot, int value)
 {
-    bool foundTouchPresent = false;
-    bool to_monitor = false;
+    ctrlInputsFrames &inFrames = ctrlInputsContext.inFrames;
+    const int offset = chn_btn_count+1; // same layout as user exposed buffer, see readCtrlInputs()
 
+    int pos = chn;
+    // only multievent ctrl inputs have more slots to store parallel events
+    if(ctrlInputsContext.ctrlInputs[chn].isMultiInput)
+    {
+        int touchSlots = ctrlInputsContext.mtInfo.touchSlots;
+        if(slot < 0 || slot >= touchSlots)
+            return; // some single touch phones still report slots
+        pos = offset + (chn-offset)*touchSlots + slot;
+    }
+
+    if(inFrames.staging[pos] == value)
+        return;
+    inFrames.staging[pos] = value;
+
+    if(pos < offset)
+        inFrames.pendingSingleInputs |= (1u << pos);
+    else
+        inFrames.pendingTouchSlots |= (1ull << (slot < 63 ? slot : 63)); // slots beyond the mask share the last bit
+}
+
+// makes the staging frame visible to the audio thread, called on the ctrl inputs thread only
+void publishCtrlInputsFrame()
+{
+    ctrlInputsFrames &inFrames = ctrlInputsContext.inFrames;
+
+    // nothing changed since last report
+    if(inFrames.pendingSingleInputs == 0 && inFrames.pendingTouchSlots == 0)
+        return;
+
+    memcpy(inFrames.frames[inFrames.writeFrame], inFrames.staging, inFrames.frameBytes);
+    // swap the frame we just filled with the one in the middle, that will be our next write frame
+    unsigned int prev = inFrames.middleFrame.exchange(inFrames.writeFrame | CTRL_INPUTS_FRAME_FRESH, std::memory_order_acq_rel);
+    inFrames.writeFrame = prev & ~CTRL_INPUTS_FRAME_FRESH;
+
+    // changes are flagged only after the frame is published
+    inFrames.changedSingleInputs.fetch_or(inFrames.pendingSingleInputs, std::memory_order_release);
+    inFrames.changedTouchSlots.fetch_or(inFrames.pendingTouchSlots, std::memory_order_release);
+    inFrames.pendingSingleInputs = 0;
+    inFrames.pendingTouchSlots = 0;
+}
+
+// collects the events of the device that we are interested into
+// returns false if the device raises events that ctrl inputs do not use [e.g., relative axes of a mouse]
+bool scanCtrlInputDevCaps(int fd, DevCaps &caps)
+{
     uint8_t *bits = NULL;
     ssize_t bits_size = 0;
-    //const char* label;
     int res;
-    
-    //printf("  events:\n");
+    unordered_map<unsigned short, unordered_map<int, int> > &event_map = ctrlInputsContext.ctrlInputsEvent_channel;
+
     // skip EV_SYN since we cannot query its available codes
     for(int event = EV_KEY; event <= EV_MAX; event++) 
     { 
-        int count = 0;
         //while(1) //VIC we can never be cautious enough...
         while(!gShouldStop) 
         {
@@ -213,138 +282,145 @@ bool checkEvents(int fd, int print_flags, const char *device, const char *name,
                 break;
             bits_size = res + 16;
             bits = (uint8_t *)realloc(bits, bits_size * 2);
-            //if(bits == NULL)
-            //    fprintf(stderr, "failed to allocate buffer of size %d\n", (int)bits_size);
         }
 
-        // switch(event) {
-        //     case EV_KEY:
-        //         label = "EV_KEY";
-                
-        //         break;
-        //     case EV_ABS:
-        //         label = "EV_ABS";
-                
-        //         break;
-        //     default:
-        //         label = "???";
-        // }
         for(int j=0; j <res; j++) 
         {
             for(int k=0; k<8; k++)
             {
-                if(bits[j] & 1<<k) 
-                {   
-                    // on android/linux, buttons can raise both events EV_KEY and events EV_SW
-                    if(event!=EV_KEY && event!=EV_SW && event!=EV_ABS)
-                        return false;
-
-                    // if(count == 0)
-                    //     printf("    %s (%04x):", label, event);
-                    // else if((count & (print_flags & PRINT_LABELS ? 0x3 : 0x7)) == 0 || event == EV_ABS)
-                    //     printf("\n               ");
-                    int code = j * 8 + k;
-                    // printf(" %04x", code);
-     
-                    unordered_map<unsigned short, unordered_map<int, int> > &event_map = ctrlInputsContext.ctrlInputsEvent_channel;
-                    if(event_map.find(event) != event_map.end()) 
-                    {
-                        unordered_map<int, int> &code_map = event_map[event];    
+                if(!(bits[j] & 1<<k))
+                    continue;
 
-                        if(event != EV_ABS)
-                        {
-                            // all non multitouch events [e.g., buttons]
-                            if(code_map.find(code) != code_map.end())
-                            {
-                                to_monitor = true; // yes, we will monitor this device, because it raises non multitouch events we are interested into
-                                int chn = code_map[code]; // this is the channel that tells us which ctrl input this specific event is associated to
-                                // in other words, we can say that the ctrl input is supported, because this device sends the events associated to it!
-                                // but more devices can send the same input, so it is possible that this ctrl input was marked as supported already
-                                // that's what we check here!
-                                if(!ctrlInputsContext.ctrlInputs[chn].supported)
-                                {
-                                    // if this is the first time we find a device that raises the event associated to this ctrl input, we update our records
-                                    ctrlInputsContext.ctrlInputs[chn].supported = true; // for our internal records
-                                    ctrlInputsContext.ctrlInputs[chn].isMultiInput = false; // only multi touch ctrl inputs are multi event, cos can receive data from multiple fingers
-                                    ctrlInputsContext.inputsCount++;
-                                }
-                                // store/pass info for verobse printing
-                                pair<string, string> info;
-                                info.first = device;
-                                info.second = name;
-                                devinfo[chn].push_back(info);
-                            }      
-                        }
-                        else
-                        {
-                            struct input_absinfo abs;
-                            if(ioctl(fd, EVIOCGABS(j * 8 + k), &abs) == 0) 
-                            {
-                                //  printf("code %d : value %d, min %d, max %d, fuzz %d, flat %d, resolution %d\n",
-                                //      code, abs.value, abs.minimum, abs.maximum, abs.fuzz, abs.flat,
-                                //      abs.resolution);
-
-                                // all multitouch events 
-                                if(code_map.find(code) != code_map.end())
-                                {
-                                    to_monitor = true; // yes, we will monitor this device, because it raises multitouch events we are interested into
-                                    // same as non multi touch event here
-                                    int chn = code_map[code];
-                                    if(!ctrlInputsContext.ctrlInputs[chn].supported)
-                                    {
-                                        ctrlInputsContext.ctrlInputs[chn].supported = true;
-                                        ctrlInputsContext.ctrlInputs[chn].isMultiInput = true;  // only difference is taht multi touch ctrl inputs are multi event, cos can receive data from multiple fingers
-                                        ctrlInputsContext.inputsCount++;
-
-                                        // update user exposed info for multi ctrl/multitouch
-                                        //VIC unfortunately, this has to be done manually
-                                        switch(code)
-                                        {
-                                        case ABS_MT_POSITION_X:
-                                                ctrlInputsContext.mtInfo.screenResolution[0] = abs.maximum+1;
-                                            break;
-                                        case ABS_MT_POSITION_Y:
-                                                ctrlInputsContext.mtInfo.screenResolution[1] = abs.maximum+1;
-                                            break;
-                                        case ABS_MT_TOUCH_MAJOR:
-                                                ctrlInputsContext.mtInfo.touchAxisMax = abs.maximum;
-                                            break;
-                                        case ABS_MT_WIDTH_MAJOR:
-                                                ctrlInputsContext.mtInfo.touchWidthMax = abs.maximum;
-                                            break;
-                                        }
-                                    }
-                                    // store/pass info for verobse printing
-                                    pair<string, string> info;
-                                    info.first = device;
-                                    info.second = name;
-                                    devinfo[chn].push_back(info);
-                                }
-                                //VIC unfortunately, this has to be done manually
-                                else if(code == ABS_MT_SLOT)
-                                    ctrlInputsContext.mtInfo.touchSlots = abs.maximum+1;
-                            }
-                        }
-                    }
-                    //count++;
+                // on android/linux, buttons can raise both events EV_KEY and events EV_SW
+                if(event!=EV_KEY && event!=EV_SW && event!=EV_ABS)
+                {
+                    free(bits);
+                    return false;
+                }
+
+                auto type_it = event_map.find(event);
+                if(type_it == event_map.end())
+                    continue;
+
+                int code = j * 8 + k;
+                if(event != EV_ABS)
+                {
+                    // all non multitouch events [e.g., buttons]
+                    if(type_it->second.find(code) != type_it->second.end())
+                        caps.push_back({(unsigned short)event, code, 0});
+                }
+                else
+                {
+                    // all multitouch events, ABS_MT_SLOT tells us how many touch slots there are
+                    struct input_absinfo abs;
+                    if((type_it->second.find(code) != type_it->second.end() || code == ABS_MT_SLOT) && ioctl(fd, EVIOCGABS(code), &abs) == 0)
+                        caps.push_back({(unsigned short)event, code, abs.maximum});
                 }
             }
         }
-        // if(count)
-        //     printf("\n");
     }
     free(bits);
+    return true;
+}
+
+// updates ctrl inputs with the events raised by the device, returns true if the device has to be monitored
+bool applyCtrlInputDevCaps(const DevCaps &caps, const char *device, const char *name, DevInfo *devinfo)
+{
+    bool to_monitor = false;
+    unordered_map<unsigned short, unordered_map<int, int> > &event_map = ctrlInputsContext.ctrlInputsEvent_channel;
+
+    for(const ctrlInputCap &cap : caps)
+    {
+        unordered_map<int, int> &code_map = event_map[cap.event];
+        auto code_it = code_map.find(cap.code);
+        if(code_it == code_map.end())
+        {
+            //VIC unfortunately, this has to be done manually
+            if(cap.event == EV_ABS && cap.code == ABS_MT_SLOT)
+                ctrlInputsContext.mtInfo.touchSlots = cap.absMax+1;
+            continue;
+        }
+
+        to_monitor = true; // yes, we will monitor this device, because it raises events we are interested into
+        int chn = code_it->second; // this is the channel that tells us which ctrl input this specific event is associated to
+        // in other words, we can say that the ctrl input is supported, because this device sends the events associated to it!
+        // but more devices can send the same input, so it is possible that this ctrl input was marked as supported already
+        // that's what we check here!
+        if(!ctrlInputsContext.ctrlInputs[chn].supported)
+        {
+            // if this is the first time we find a device that raises the event associated to this ctrl input, we update our records
+            ctrlInputsContext.ctrlInputs[chn].supported = true; // for our internal records
+            ctrlInputsContext.ctrlInputs[chn].isMultiInput = (cap.event == EV_ABS); // only multi touch ctrl inputs are multi event, cos can receive data from multiple fingers
+            ctrlInputsContext.inputsCount++;
+
+            // update user exposed info for multi ctrl/multitouch
+            //VIC unfortunately, this has to be done manually
+            if(cap.event == EV_ABS)
+            {
+                switch(cap.code)
+                {
+                case ABS_MT_POSITION_X:
+                        ctrlInputsContext.mtInfo.screenResolution[0] = cap.absMax+1;
+                    break;
+                case ABS_MT_POSITION_Y:
+                        ctrlInputsContext.mtInfo.screenResolution[1] = cap.absMax+1;
+                    break;
+                case ABS_MT_TOUCH_MAJOR:
+                        ctrlInputsContext.mtInfo.touchAxisMax = cap.absMax;
+                    break;
+                case ABS_MT_WIDTH_MAJOR:
+                        ctrlInputsContext.mtInfo.touchWidthMax = cap.absMax;
+                    break;
+                }
+            }
+        }
+        // store/pass info for verobse printing
+        pair<string, string> info;
+        info.first = device;
+        info.second = name;
+        devinfo[chn].push_back(info);
+    }
     return to_monitor;
 }
 
+// adds the device to the ones polled by the ctrl inputs thread
+int monitorCtrlInputDev(int fd, const char *device, const char *name, const DevCaps &caps)
+{
+    struct pollfd *new_ufds;
+    char **new_device_names;
+
+    new_ufds = (pollfd *)realloc(ufds, sizeof(ufds[0]) * (nfds + 1));
+    if(new_ufds == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    ufds = new_ufds;
+    new_device_names = (char **)realloc(device_names, sizeof(device_names[0]) * (nfds + 1));
+    if(new_device_names == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    device_names = new_device_names;
+
+    if( ctrlInputsVerbose && (print_flags & PRINT_DEVICE) )
+        printf("\tMonitoring control input device %d: %s\n", nfds, device);
+
+    ufds[nfds].fd = fd;
+    ufds[nfds].events = POLLIN;
+    device_names[nfds] = strdup(device);
+    nfds++;
+
+    monitoredDevices.push_back(pair<string, string>(device, name));
+    monitoredDevicesCaps.push_back(caps);
+
+    return 0;
+}
 
 int openCtrlInputDev(const char *device, int print_flags, DevInfo *devinfo) 
 {
     int version;
     int fd;
     int clkid = CLOCK_MONOTONIC;
-    struct pollfd *new_ufds;
-    char **new_device_names;
     char name[80];
     char location[80];
     char idstr[80];
@@ -397,28 +473,19 @@ int openCtrlInputDev(const char *device, int print_flags, DevInfo *devinfo)
 
     // check all the events supported by this file/device
     // and see if this is a device we need to poll to get ctrl inputs
-    if(!checkEvents(fd, print_flags, device, name, devinfo))
+    DevCaps caps;
+    if(!scanCtrlInputDevCaps(fd, caps) || !applyCtrlInputDevCaps(caps, device, name, devinfo))
     {
         close(fd);
         return -2;
     }
 
-
-    new_ufds = (pollfd *)realloc(ufds, sizeof(ufds[0]) * (nfds + 1));
-    if(new_ufds == NULL) {
-        fprintf(stderr, "out of memory\n");
-        return -1;
-    }
-    ufds = new_ufds;
-    new_device_names = (char **)realloc(device_names, sizeof(device_names[0]) * (nfds + 1));
-    if(new_device_names == NULL) {
-        fprintf(stderr, "out of memory\n");
+    if(monitorCtrlInputDev(fd, device, name, caps) != 0)
+    {
+        close(fd);
         return -1;
     }
-    device_names = new_device_names;
 
-    if( ctrlInputsVerbose && (print_flags & PRINT_DEVICE) )
-        printf("\tMonitoring control input device %d: %s\n", nfds, device);
     if( ctrlInputsVerbose && (print_flags & PRINT_DEVICE_INFO) )
         printf("\t\tbus: %04x\n"
                "\t\tvendor: %04x\n"
@@ -434,17 +501,42 @@ int openCtrlInputDev(const char *device, int print_flags, DevInfo *devinfo)
         printf("\t\tversion: %d.%d.%d\n",
                version >> 16, (version >> 8) & 0xff, version & 0xff);
 
+    return 0;
+}
 
-    ufds[nfds].fd = fd;
-    ufds[nfds].events = POLLIN;
-    device_names[nfds] = strdup(device);
-    nfds++;
-    
+// opens a device found in a previous run, its capabilities come from the probe cache
+// device nodes are renumbered at every boot, so the name must match too
+int openCachedCtrlInputDev(const char *device, string &name, const DevCaps &caps, DevInfo *devinfo)
+{
+    int clkid = CLOCK_MONOTONIC;
+    char devName[80];
 
+    int fd = open(device, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return -1;
+
+    devName[sizeof(devName) - 1] = '\0';
+    if(ioctl(fd, EVIOCGNAME(sizeof(devName) - 1), &devName) < 1)
+        devName[0] = '\0';
+    if(name != devName)
+    {
+        close(fd);
+        return -1;
+    }
+
+    ioctl(fd, EVIOCSCLOCKID, &clkid); // a non-fatal error
+
+    if(!applyCtrlInputDevCaps(caps, device, devName, devinfo) || monitorCtrlInputDev(fd, device, devName, caps) != 0)
+    {
+        close(fd);
+        return -1;
+    }
     return 0;
 }
 
 
+
+
 int openCtrlInputDevices(const char *dirname, int print_flags, DevInfo *devinfo)
 {
     char devname[PATH_MAX];
@@ -486,11 +578,17 @@ int initCtrlInputs()
     ctrlInputsContext.mtInfo.touchWidthMax = -1;
     ctrlInputsContext.mtInfo.anyTouchSupported = false;
 
-    int res = openCtrlInputDevices(ctrlInput_devPath, print_flags, devinfo);
-    if(res < 0) 
+    // try the devices found in a previous run first, only if any of them changed we scan the whole dir
+    if(openCachedCtrlInputDevices(devinfo) != 0)
     {
-        fprintf(stderr, "Opening control input devices - scan dir failed for %s\n", ctrlInput_devPath);
-        return -1;
+        resetCtrlInputDevices(devinfo);
+        int res = openCtrlInputDevices(ctrlInput_devPath, print_flags, devinfo);
+        if(res < 0) 
+        {
+            fprintf(stderr, "Opening control input devices - scan dir failed for %s\n", ctrlInput_devPath);
+            return -1;
+        }
+        cacheCtrlInputDevices();
     }
 
     if(ctrlInputsVerbose)
@@ -499,19 +597,6 @@ int initCtrlInputs()
     for(int i=0; i<chn_cin_count; i++)
     {
         ctrlInput_struct &ctrlIn = ctrlInputsContext.ctrlInputs[i];
-        // prepare ctrl inputs to receive/store a single value or multiple values
-        int len = 1;
-        if(ctrlIn.isMultiInput)
-            len = ctrlInputsContext.mtInfo.touchSlots; // only multievent ctrl inputs have more slots to store parallel events
-        ctrlIn.value.resize(len);
-        for(auto &v : ctrlIn.value)
-        {
-            v = std::make_shared< atomic<signed int> >(); // we allocate the atomic container
-            if(i < chn_mt_anyTouch)
-                v->store(0); // init all button values and anyTouche to 0 [not pressed/not present]
-            else
-                v->store(-1); // init all other values to -1 [not set]
-        }
 
         if(ctrlInputsVerbose)
         {
@@ -550,6 +635,112 @@ int initCtrlInputs()
     return 0;
 }
 
+// counts the nodes in the input dir, without opening them
+int countCtrlInputNodes()
+{
+    DIR *dir = opendir(ctrlInput_devPath);
+    if(dir == NULL)
+        return -1;
+    int count = 0;
+    struct dirent *de;
+    while((de = readdir(dir)))
+    {
+        if(de->d_name[0] != '.')
+            count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// cached entries: number of nodes in the input dir, then one "path name" entry per monitored device
+// and one with its capabilities, as "event,code,absMax" triplets separated by spaces
+int openCachedCtrlInputDevices(DevInfo *devinfo)
+{
+    string value;
+    if(!probeCacheGet("ctrlin.nodes", value))
+        return -1;
+    // a device was added or removed [e.g., usb keyboard], cached list is not complete
+    if(atoi(value.c_str()) != countCtrlInputNodes())
+        return -1;
+    if(!probeCacheGet("ctrlin.devices", value))
+        return -1;
+    int cachedDevices = atoi(value.c_str());
+    if(cachedDevices <= 0)
+        return -1;
+
+    for(int i=0; i<cachedDevices; i++)
+    {
+        if(!probeCacheGet("ctrlin.device"+std::to_string(i), value))
+            return -1;
+        size_t pos = value.find(' ');
+        string device = value.substr(0, pos);
+        string name = (pos != string::npos) ? value.substr(pos+1) : "";
+
+        if(!probeCacheGet("ctrlin.caps"+std::to_string(i), value))
+            return -1;
+        DevCaps caps;
+        std::istringstream capsStream(value);
+        string capStr;
+        while(capsStream >> capStr)
+        {
+            ctrlInputCap cap;
+            unsigned int event;
+            if(sscanf(capStr.c_str(), "%u,%d,%d", &event, &cap.code, &cap.absMax) != 3)
+                return -1;
+            cap.event = event;
+            caps.push_back(cap);
+        }
+
+        if(openCachedCtrlInputDev(device.c_str(), name, caps, devinfo) != 0)
+            return -1;
+    }
+
+    if(ctrlInputsVerbose)
+        printf("Control input devices loaded from probe cache\n");
+    return 0;
+}
+
+void cacheCtrlInputDevices()
+{
+    probeCacheSet("ctrlin.nodes", std::to_string(countCtrlInputNodes()));
+    probeCacheSet("ctrlin.devices", std::to_string(monitoredDevices.size()));
+    for(unsigned int i=0; i<monitoredDevices.size(); i++)
+    {
+        probeCacheSet("ctrlin.device"+std::to_string(i), monitoredDevices[i].first+" "+monitoredDevices[i].second);
+        string caps;
+        for(const ctrlInputCap &cap : monitoredDevicesCaps[i])
+            caps += std::to_string(cap.event)+","+std::to_string(cap.code)+","+std::to_string(cap.absMax)+" ";
+        probeCacheSet("ctrlin.caps"+std::to_string(i), caps);
+    }
+}
+
+// brings back the state we had before any device was opened
+void resetCtrlInputDevices(DevInfo *devinfo)
+{
+    for(int i=0; i<nfds; i++)
+    {
+        free(device_names[i]);
+        close(ufds[i].fd);
+    }
+    nfds = 0;
+    monitoredDevices.clear();
+    monitoredDevicesCaps.clear();
+
+    for(int i=0; i<chn_cin_count; i++)
+    {
+        ctrlInputsContext.ctrlInputs[i].supported = false;
+        ctrlInputsContext.ctrlInputs[i].isMultiInput = false;
+        devinfo[i].clear();
+    }
+    ctrlInputsContext.inputsCount = 0;
+
+    ctrlInputsContext.mtInfo.touchSlots = 1;
+    ctrlInputsContext.mtInfo.touchAxisMax = -1;
+    ctrlInputsContext.mtInfo.touchWidthMax = -1;
+    ctrlInputsContext.mtInfo.screenResolution[0] = 0;
+    ctrlInputsContext.mtInfo.screenResolution[1] = 0;
+}
+
 void initCtrlInputBuffers()
 {
     // allocate buffers for ctrl input values
@@ -567,12 +758,57 @@ void initCtrlInputBuffers()
         ctrlInputsContext.mtInfo.anyTouchSupported = true;
 
     // then multi ctrl/multitouch
-    len +=  (chn_mt_count-1)*ctrlInputsContext.mtInfo.touchSlots; // plus all multi events, excludes chn_mt_anyTouch
+    int touchSlots = ctrlInputsContext.mtInfo.touchSlots;
+    len +=  (chn_mt_count-1)*touchSlots; // plus all multi events, excludes chn_mt_anyTouch
     ctrlInputsContext.ctrlInBuffer = new int[len];
-    
-    for(int i=0; i<len; i++)
-        ctrlInputsContext.ctrlInBuffer[i] = 0;
     // user exposed info is set in initCtrlInputs() already
+
+    ctrlInputsContext.changes.singleInputs = 0;
+    ctrlInputsContext.changes.touchSlots = 0;
+
+
+    // frames shared with the ctrl inputs thread
+    // all in one block, with each frame starting on its own cache line
+    ctrlInputsFrames &inFrames = ctrlInputsContext.inFrames;
+    inFrames.frameLen = len;
+    inFrames.frameBytes = len*sizeof(int);
+    size_t stride = (inFrames.frameBytes + 63) & ~(size_t)63;
+    if(posix_memalign((void**)&inFrames.block, 64, stride*(CTRL_INPUTS_FRAME_NUM+1)) != 0)
+    {
+        fprintf(stderr, "Could not allocate control input frames\n");
+        inFrames.block = nullptr;
+        for(int i=0; i<len; i++)
+            ctrlInputsContext.ctrlInBuffer[i] = 0;
+        return;
+    }
+    for(int f=0; f<CTRL_INPUTS_FRAME_NUM; f++)
+        inFrames.frames[f] = (int *)((char *)inFrames.block + f*stride);
+    inFrames.staging = (int *)((char *)inFrames.block + CTRL_INPUTS_FRAME_NUM*stride);
+
+    // init all button values and anyTouch to 0 [not pressed/not present]
+    // and all supported multitouch values to -1 [not set]
+    // unsupported ctrl inputs are never updated and stay 0
+    const int offset = chn_btn_count+1;
+    for(int i=0; i<len; i++)
+        inFrames.staging[i] = 0;
+    for(int chn=offset; chn<chn_cin_count; chn++)
+    {
+        if(!ctrlInputsContext.ctrlInputs[chn].supported)
+            continue;
+        for(int slot=0; slot<touchSlots; slot++)
+            inFrames.staging[offset+(chn-offset)*touchSlots+slot] = -1;
+    }
+    for(int f=0; f<CTRL_INPUTS_FRAME_NUM; f++)
+        memcpy(inFrames.frames[f], inFrames.staging, inFrames.frameBytes);
+    memcpy(ctrlInputsContext.ctrlInBuffer, inFrames.staging, inFrames.frameBytes);
+
+    inFrames.writeFrame = 0;
+    inFrames.middleFrame.store(1, std::memory_order_relaxed);
+    inFrames.readFrame = 2;
+    inFrames.changedSingleInputs.store(0, std::memory_order_relaxed);
+    inFrames.changedTouchSlots.store(0, std::memory_order_relaxed);
+    inFrames.pendingSingleInputs = 0;
+    inFrames.pendingTouchSlots = 0;
 }
 
 void closeCtrlInputDevice(int dev)
@@ -595,22 +831,23 @@ void readCtrlInputs()
 {
     // BE CAREFUL, mapping is manual!
     // and must be the same in LDSP.h buttonRead() and multitouchRead()
-    const int offset = chn_btn_count+1;
-    // put in context buffer lastest single event values first
-    for(int chn=0; chn<offset; chn++) // includes chn_mt_anyTouch
-    {
-        if(ctrlInputsContext.ctrlInputs[chn].supported)
-            ctrlInputsContext.ctrlInBuffer[chn] = ctrlInputsContext.ctrlInputs[chn].value[0]->load(std::memory_order_relaxed);
-    }
+    // single event values first [includes chn_mt_anyTouch], then touchSlots values per each multi event [excludes chn_mt_anyTouch]
+    ctrlInputsFrames &inFrames = ctrlInputsContext.inFrames;
+    if(inFrames.block == nullptr)
+        return;
 
-    int touchSlots = ctrlInputsContext.mtInfo.touchSlots;
-    for(int chn=0; chn<chn_mt_count-1; chn++) // excludes chn_mt_anyTouch
-    {
-        if(!ctrlInputsContext.ctrlInputs[offset+chn].supported)
-            continue;
+    // changes are cleared before the frame is taken, see ctrlInputsFrames
+    ctrlInputsContext.changes.singleInputs = inFrames.changedSingleInputs.exchange(0, std::memory_order_acquire);
+    ctrlInputsContext.changes.touchSlots = inFrames.changedTouchSlots.exchange(0, std::memory_order_acquire);
 
-        for(int slot=0; slot<touchSlots; slot++)
-            ctrlInputsContext.ctrlInBuffer[offset+chn*touchSlots+slot] = ctrlInputsContext.ctrlInputs[offset+chn].value[slot]->load(std::memory_order_relaxed);
-        
-    }    
+    // no new frame since last period
+    if( !(inFrames.middleFrame.load(std::memory_order_relaxed) & CTRL_INPUTS_FRAME_FRESH) )
+        return;
+
+    // take latest frame and give the one we read last back to the ctrl inputs thread
+    unsigned int prev = inFrames.middleFrame.exchange(inFrames.readFrame, std::memory_order_acq_rel);
+    inFrames.readFrame = prev & ~CTRL_INPUTS_FRAME_FRESH;
+
+    // put in context buffer the whole frame at once
+    memcpy(ctrlInputsContext.ctrlInBuffer, inFrames.frames[inFrames.readFrame], inFrames.frameBytes);
 }
@@ -20,6 +20,7 @@
 #include "LDSP.h"
 #include "tinyalsaAudio.h" // for LDSPinternalContext
 #include "thread_utils.h"
+#include "probeCache.h"
 
 #include <sstream> // for ostream
 #include <dirent.h> // to search for files
@@ -27,6 +28,12 @@
 #include <regex> // replace substring
 #include <cstdlib> // for system()
 #include <unistd.h> // for usleep()
+#include <fcntl.h> // for open()
+#if __ANDROID_API__ >= 28
+#include <spawn.h> // for posix_spawn()
+#endif
+#include <sys/wait.h> // for waitpid()
+#include <atomic>
 
 
 
@@ -49,10 +56,14 @@ extern LDSPinternalContext intContext;
 
 // screen control
 screenCtrlsCommands screenCmds;
+bool screenCmdsProbed = false; // dumpsys is probed only if backlight cannot be read
 const char *pwrBtn_input_cmd = "input keyevent 26";
 const char *tap_input_cmd = "input tap 1 1";
 extern bool gShouldStop; // extern from tinyalsaAudio.cpp
 pthread_t screenCtl_thread = 0;
+std::atomic<bool> screenState(true); // cached, so that screenGetState() is cheap
+int backlightFd = -1; // if available, brightness of lcd backlight tells us the state of the screen
+std::atomic<bool> backlightZeroWritten(false); // backlight turned off by us [or by the user via ctrl outputs], does not mean that screen is off
 bool initialScreenState;
 int nextScreenState = -1;
 float nextBrightness = 0;
@@ -63,7 +74,10 @@ int initCtrlOutputs(string **ctrlOutputsFiles);
 void cleanupCtrlOutputs(ctrlout_struct *ctrlOutputs, int numOfOutputs);
 void probeScreenCommands();
 bool isScreenOn();
+bool readBacklightState(bool &screenIsOn);
+void updateScreenState();
 void setScreen(float brightness);
+int runCommand(const char *cmd);
 void* screenCtrl_loop(void* arg);
 
 
@@ -81,21 +95,38 @@ int LDSP_initCtrlOutputs(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
     // if control outputs are off, we don't init them!
     if(!ctrlOutputsOff)
     {
+        initProbeCache(settings);
         int retVal = initCtrlOutputs(hwconfig->ctrl_outputs);
         if(retVal!=0) 
             return retVal;
+        saveProbeCache();
     }
 
     // screen
-    probeScreenCommands();
-    initialScreenState = isScreenOn();
+    // reading the lcd backlight is way cheaper than probing the system via dumpsys, so we try that first
+    if(!ctrlOutputsOff && ctrlOutputsContext.ctrlOutputs[chn_cout_lcdBacklight].configured)
+        backlightFd = open(hwconfig->ctrl_outputs[DEVICE_CTRL_FILE][chn_cout_lcdBacklight].c_str(), O_RDONLY | O_CLOEXEC);
+    bool screenIsOn;
+    if(readBacklightState(screenIsOn))
+    {
+        if(ctrlOutputsVerbose)
+            printf("\tScreen state tracked via lcd backlight\n");
+    }
+    else
+    {
+        // dumpsys is used only here and after we change the state of the screen
+        probeScreenCommands();
+        screenIsOn = isScreenOn();
+    }
+    screenState = screenIsOn;
+    initialScreenState = screenIsOn;
     pthread_create(&screenCtl_thread, NULL, screenCtrl_loop, NULL);
 
     // update context
     intContext.ctrlOutputs = ctrlOutputsContext.ctrlOutBuffer;
     intContext.ctrlOutChannels = chn_cout_count;
     intContext.ctrlOutputsSupported = ctrlOutputsContext.ctrlOutSupported;
-    intContext.screenGetStateSupported = (screenCmds.idx != -1);
+    intContext.screenGetStateSupported = (backlightFd != -1 || screenCmds.idx != -1);
 
     return 0;
 }
@@ -120,9 +151,13 @@ void LDSP_cleanupCtrlOutputs()
     }
 
     // ...then reset screen to inital state
-    if(isScreenOn() != initialScreenState)
+    updateScreenState();
+    if(screenState != initialScreenState)
         setScreen(initialScreenState); // brightness is not important as it reset in the next line 
 
+    if(backlightFd != -1)
+        close(backlightFd);
+
     cleanupCtrlOutputs(ctrlOutputsContext.ctrlOutputs, chn_cout_count);
 }
 
@@ -140,13 +175,13 @@ void screenSetState(bool stateOn, float brightness, bool stayOn)
 
 bool screenGetState()
 {
-    return isScreenOn();
+    return screenState.load(std::memory_order_relaxed);
 }
 
 //----------------------------------------------------------------------------------------------------------
 
 
-bool ctrlOutputAutoFill_ctrl(int out, shared_ptr<ctrlOutputKeywords> keywords, string &control_file)
+bool probeCtrlOutput_ctrl(int out, shared_ptr<ctrlOutputKeywords> keywords, string &control_file)
 {     
     DIR* directory;
     string path;
@@ -242,7 +277,29 @@ bool ctrlOutputAutoFill_ctrl(int out, shared_ptr<ctrlOutputKeywords> keywords, s
 }
 
 
-void ctrlOutputAutoFill_scale(int out, shared_ptr<ctrlOutputKeywords> keywords, string control_file, string &scale_file)
+// the search in /sys/class is skipped if a previous run already found the control file [or found out that there is none]
+bool ctrlOutputAutoFill_ctrl(int out, shared_ptr<ctrlOutputKeywords> keywords, string &control_file)
+{
+    string cacheKey = "ctrlout."+LDSP_ctrlOutput[out]+".ctrl";
+    string cached;
+    if(probeCacheGet(cacheKey, cached))
+    {
+        if(cached == "")
+            return false;
+        if(access(cached.c_str(), F_OK) == 0)
+        {
+            control_file = cached;
+            return true;
+        }
+    }
+
+    bool found = probeCtrlOutput_ctrl(out, keywords, control_file);
+    probeCacheSet(cacheKey, found ? control_file : "");
+    return found;
+}
+
+
+void probeCtrlOutput_scale(int out, shared_ptr<ctrlOutputKeywords> keywords, string control_file, string &scale_file)
 {
     // if vibration is set manually, this will never be called for vibration, cos once vibration is found in hwConfig file scale is set to 1 by default
     // so here we are dealing with the case where vibration is all automatice... and we set default scale to 1
@@ -283,6 +340,31 @@ void ctrlOutputAutoFill_scale(int out, shared_ptr<ctrlOutputKeywords> keywords,
 }
 
 
+void ctrlOutputAutoFill_scale(int out, shared_ptr<ctrlOutputKeywords> keywords, string control_file, string &scale_file)
+{
+    // cached entry is valid only for the same control file
+    string cacheKey = "ctrlout."+LDSP_ctrlOutput[out]+".scale";
+    string cached;
+    if(probeCacheGet(cacheKey, cached))
+    {
+        size_t pos = cached.find(' ');
+        if(pos != string::npos && cached.substr(0, pos) == control_file)
+        {
+            string scale = cached.substr(pos+1);
+            // either a value or a file that still exists
+            if(isdigit(scale.c_str()[0]) || access(scale.c_str(), F_OK) == 0)
+            {
+                scale_file = scale;
+                return;
+            }
+        }
+    }
+
+    probeCtrlOutput_scale(out, keywords, control_file, scale_file);
+    probeCacheSet(cacheKey, control_file+" "+scale_file);
+}
+
+
 int initCtrlOutputs(string **ctrlOutputsFiles)
 {
     shared_ptr<ctrlOutputKeywords> keywords = make_shared<ctrlOutputKeywords>(); // will be useful in auto config
@@ -460,6 +542,9 @@ void writeCtrlOutputs()
 
         // update prev val for next call
         ctrlOutput->prevVal = outInt;
+
+        if(out == chn_cout_lcdBacklight)
+            backlightZeroWritten.store(outInt == 0, std::memory_order_relaxed);
     }
 }
 
@@ -487,6 +572,7 @@ void cleanupCtrlOutputs(ctrlout_struct *ctrlOutputs, int numOfOutputs)
 
 void probeScreenCommands()
 {
+    screenCmdsProbed = true;
     for(int i=0; i<screenCmds.idx_cnt; i++)
     {
         // try all dumpsys commands stored in service
@@ -524,6 +610,10 @@ void probeScreenCommands()
 
 bool isScreenOn()
 {
+    // backlight was working at init
+    if(!screenCmdsProbed)
+        probeScreenCommands();
+
     int idx = screenCmds.idx;
     if(idx == -1)
         return true;
@@ -560,10 +650,71 @@ bool isScreenOn()
 }
 
 
+// returns false if the state of the screen cannot be retrieved from lcd backlight
+bool readBacklightState(bool &screenIsOn)
+{
+    if(backlightFd == -1)
+        return false;
+
+    char buffer[16];
+    ssize_t len = pread(backlightFd, buffer, sizeof(buffer)-1, 0);
+    if(len <= 0)
+        return false;
+    buffer[len] = '\0';
+
+    // screen is off when backlight is completely off
+    // unless we turned it off ourselves, in that case screen may still be on and only dumpsys can tell
+    int brightness = atoi(buffer);
+    if(brightness == 0 && backlightZeroWritten.load(std::memory_order_relaxed))
+        return false;
+    screenIsOn = (brightness > 0);
+    return true;
+}
+
+void updateScreenState()
+{
+    bool screenIsOn;
+    if(readBacklightState(screenIsOn))
+        screenState.store(screenIsOn, std::memory_order_relaxed);
+    // otherwise, cached state is updated only when we change the state of the screen
+}
+
 void setScreen(float brightness)
 {
     ctrlOutputWrite((LDSPcontext *)&intContext, chn_cout_lcdBacklight, brightness);
-    system(pwrBtn_input_cmd);
+    runCommand(pwrBtn_input_cmd);
+}
+
+// runs a shell command and waits for it to finish
+// posix_spawn() and vfork() do not duplicate the address space of LDSP [unlike fork() as in system()]
+// so the audio thread does not pay for copy-on-write page faults afterwards
+int runCommand(const char *cmd)
+{
+    pid_t pid;
+#if __ANDROID_API__ >= 28
+    const char *argv[] = {"sh", "-c", cmd, NULL};
+    if(posix_spawn(&pid, "/system/bin/sh", NULL, NULL, (char * const *)argv, environ) != 0)
+    {
+        fprintf(stderr, "Error: unable to run \"%s\"\n", cmd);
+        return -1;
+    }
+#else
+    // posix_spawn() is not available before Android 9
+    pid = vfork();
+    if(pid == 0)
+    {
+        execl("/system/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127); // exec failed, only async-safe calls allowed here
+    }
+    if(pid < 0)
+    {
+        fprintf(stderr, "Error: unable to run \"%s\"\n", cmd);
+        return -1;
+    }
+#endif
+    int status;
+    waitpid(pid, &status, 0);
+    return status;
 }
 
 void* screenCtrl_loop(void* arg)
@@ -571,11 +722,9 @@ void* screenCtrl_loop(void* arg)
     static const useconds_t sleepTime_us = 100000;
     static const unsigned int tapInterval = 20; // as a multiple of sleep time [sleep cycles]!
     
-    // set thread priority    
-    set_priority(LDSPprioOrder_screenCtl, "controlOutputs", false);
-
-    // set minimum thread niceness
- 	set_niceness(-20, "controlOutputs", false);
+    //VIC this thread spawns processes and polls the screen, no need for real-time priority
+    // and processes spawned from here do not inherit a real-time policy
+    set_niceness(0, "controlOutputs", false);
     
     bool tapActive = false;
     unsigned int tapCounter = 0;
@@ -586,7 +735,10 @@ void* screenCtrl_loop(void* arg)
         if(nextScreenState != -1)
         {
             // if change is requested, first check current state of screen
-            bool screenIsOn = isScreenOn();
+            // dumpsys is heavy, but here we are not in a hurry
+            bool screenIsOn;
+            if(!readBacklightState(screenIsOn))
+                screenIsOn = isScreenOn();
 
             // if requested state is different than current state 
             if(screenIsOn!=nextScreenState)
@@ -594,12 +746,16 @@ void* screenCtrl_loop(void* arg)
                 if(!nextScreenState)
                 {
                     setScreen(0); // turn off
+                    screenState = false;
                     // and disable tap, just in case
                     tapActive = false;
                     nextStayOn = false;
                 }
                 else
+                {
                     setScreen(nextBrightness); // turn on
+                    screenState = true;
+                }
             }
             // if keep-screen-on setting has been changed
             if(tapActive!=nextStayOn)
@@ -625,13 +781,16 @@ void* screenCtrl_loop(void* arg)
             if(tapCounter >= tapInterval)
             {
                 // time to tap to keep screen on
-                system("input tap 1 1"); // top left area of screen... this tap is not detected as multitouch event!
+                runCommand(tap_input_cmd); // top left area of screen... this tap is not detected as multitouch event!
                 tapCounter = 0;
             }
             else
                 tapCounter++; 
         }
 
+        // keep cached state in sync with changes that do not come from us [e.g., power button, screen timeout]
+        updateScreenState();
+
         //Zzz... for quite a while
         usleep(sleepTime_us);
     }
@@ -1,10 +1,23 @@
 #include "LDSP.h"
 #include "PdBase.hpp"
+#include "m_pd.h" // t_symbol, t_atom, pd_float(), pd_list()
+#include "g_canvas.h" // t_canvas, canvas_class
+#include <numeric> // gcd
+#include <atomic>
+#include <algorithm> // sort
+#include <time.h> // clock_gettime
+#include <semaphore.h>
+#include "thread_utils.h"
+#ifdef PD_MULTI_INSTANCE
+#include <fstream> // instances file
+#include <sstream> // istringstream
+#endif
 #ifdef PD_SCOPE
 #include <libraries/Scope/Scope.h>
+#define PD_SCOPE_FIRST_CHANNEL 26 // dac~ 27
+#define PD_SCOPE_CHANNELS 4
 #endif
 
-#define PD_MINIMUM_BLOCK_SIZE 64
 #define PD_AUDIO_IN_CHANNELS 8
 // this macro is needed to make sure that the input channels to access sensor streams in teh patches are fixed
 // as a side consequence, this values determines the max num of input channels an card can have to work in libpd!
@@ -16,8 +29,8 @@ LDSPcontext * g_ctx;
 
 bool gSensorsEnabled;
 bool gControlInEnabled; 
-bool gSendMultiTouch;
-bool gSendBtnInputs;
+std::atomic<bool> gSendMultiTouch; // set by the messages thread
+std::atomic<bool> gSendBtnInputs;
 std::string pd_enableMtObj = "ldsp_enable_multitouch";
 std::string pd_getMtInfoObj = "ldsp_get_mt_info";
 std::string pd_mtInfoObj = "ldsp_mt_info";
@@ -25,9 +38,15 @@ std::string pd_flashlightObj = "ldsp_flashlight";
 std::string pd_backlightObj = "ldsp_backlight";
 std::string pd_vibrationObj = "ldsp_vibration";
 std::string pd_touchObjPrefix = "ldsp_touch_";
+std::string pd_sensorObjPrefix = "ldsp_sensor_";
+std::string pd_mtAnyTouchObj = "ldsp_mt_anyTouch";
 std::string pd_enableBtnObj = "ldsp_enable_buttons";
 std::string pd_btnInputObjPrefix = "ldsp_btn_";
 std::string pd_screenObj = "ldsp_screen";
+std::string pd_profileObj = "ldsp_profile";
+
+void pdProfileSet(bool on);
+void pdProfileReport();
 
 #ifdef PD_SCOPE
 Scope scope;
@@ -48,6 +67,9 @@ class LDSP_EventHandler : public pd::PdReceiver
         else if (dest == pd_enableBtnObj) {
             gSendBtnInputs = true;
         }
+        else if (dest == pd_profileObj) {
+            pdProfileReport();
+        }
         else if (dest == pd_getMtInfoObj) {
             if (gControlInEnabled) {
                 pd::List mtInfoList;
@@ -81,6 +103,9 @@ class LDSP_EventHandler : public pd::PdReceiver
                 ctrlOutputWrite(g_ctx, chn_cout_lcdBacklight, num);
             }
         }
+        else if (dest == pd_profileObj) {
+            pdProfileSet(num > 0);
+        }
         else if (dest == pd_screenObj) {
             if(num <= 0)
                 screenSetState(false); // set screen off
@@ -150,6 +175,14 @@ class LDSP_MidiHandler : public pd::PdMidiReceiver
 LDSP_EventHandler eventHandler;
 LDSP_MidiHandler midiHandler;
 
+// libpd is initialized in queued mode, so messages and midi sent by the patch wait in ring buffers
+// they are received here, on a lower priority thread woken up after each period, 
+// so that the handlers' side effects [e.g., ctrl outputs, screen] never slow down the audio thread
+pthread_t pdMessagesThread;
+bool pdMessagesThreadStarted = false;
+sem_t pdMessagesSem;
+std::atomic<bool> pdMessagesShouldStop;
+
 int pdBlockSize;
 int pdInChannels;
 int pdOutChannels;
@@ -161,11 +194,28 @@ float *outBuffer;
 int outBufferSize;
 #endif
 
+// block adapter, used when the period is not a multiple of the pd block size
+// inputs wait in the fifo until a whole pd block is available, outputs are delayed by the minimum latency that never underruns
+bool pdFifoOn;
+int pdMaxFrames; // max frames pd can process in a single period
+float *pdInFifo;
+int pdInFifoFrames;
+float *pdOutFifo;
+int pdOutFifoFrames;
+
+
+
+// Sensors
+// same values that adc~ 9 onwards read, sent to [receive ldsp_sensor_<name>] only when they change
+std::vector<float> sensorStates;
+std::vector<std::string> pdSensorNames;
+std::vector<t_symbol *> pdSensorSyms; // receivers, looked up once in setup
 
 
 // Button Input
 std::vector<float> buttonInputStates;
 std::vector<std::string> pdButtonNames;
+std::vector<t_symbol *> pdButtonSyms; // receivers, looked up once in setup
 
 
 // MultiTouch 
@@ -177,6 +227,9 @@ int mtStateBufferSize;
 float anyTouchState;
 
 multiTouchInputChannel pdMTChannelMappings[PD_MULTITOUCH_INPUTS];
+std::vector<t_symbol *> pdTouchSyms; // receivers, one per slot, looked up once in setup
+t_symbol *pdAnyTouchSym;
+t_atom touchAtoms[PD_MULTITOUCH_INPUTS]; // reused for every touch list
 // Be careful adding more channels, the channel names and mappings MUST be manually updated too
 enum pdMTChannel {
     pd_mt_x,
@@ -187,6 +240,408 @@ enum pdMTChannel {
 
 
 
+#ifdef PD_MULTI_INSTANCE
+//VIC extra patches listed in the instances file run each in its own libpd instance, on its own thread
+// _main.pd stays on the audio thread and is the only one that exchanges ctrl inputs/outputs and messages with LDSP
+// all instances get the same inputs [audio + sensors] and their dac~ outputs are summed into the context outputs
+// the file has one line per extra patch: <patch file> <cpu index, -1 for any> <first output channel>
+// e.g.: "drums.pd 2 0" runs drums.pd on cpu 2 and sums its dac~ 1 and 2 into output channels 0 and 1
+#define PD_INSTANCES_FILE "_instances.txt"
+
+struct pdInstance {
+    t_pdinstance *pd;
+    std::string patchFile;
+    int cpu;
+    int outOffset;
+    float *outBuffer; // pdInstanceOutChannels interleaved
+    pthread_t thread;
+    sem_t go; // period can be processed
+    sem_t done; // period processed
+    bool threadStarted;
+};
+
+std::vector<pdInstance *> pdInstances;
+int pdInstanceOutChannels;
+// written by the audio thread before waking up the workers
+const float *pdInstancesIn;
+int pdInstancesBlocks;
+bool pdInstancesShouldStop = false;
+bool pdAudioThreadInstanceSet = false; // setup() runs on another thread
+
+void *pdInstance_loop(void *arg)
+{
+    pdInstance *inst = (pdInstance *)arg;
+    std::string name = "pd_" + inst->patchFile;
+
+    if (inst->cpu > -1)
+        set_cpu_affinity(inst->cpu, name, false);
+    // part of the audio processing, so same priority as the audio thread
+    set_priority(LDSPprioOrder_audio, name, false);
+    set_niceness(-20, name, false);
+
+    // instance is per thread, from now on all libpd calls in here refer to this instance
+    libpd_set_instance(inst->pd);
+
+    while (true) {
+        sem_wait(&inst->go);
+        if (pdInstancesShouldStop)
+            break;
+        libpd_process_float(pdInstancesBlocks, pdInstancesIn, inst->outBuffer);
+        sem_post(&inst->done);
+    }
+    return (void *)0;
+}
+
+void cleanupPdInstances()
+{
+    // never free the current instance
+    libpd_set_instance(libpd_main_instance());
+
+    pdInstancesShouldStop = true;
+    for (pdInstance *inst : pdInstances) {
+        if (inst->threadStarted) {
+            sem_post(&inst->go);
+            pthread_join(inst->thread, NULL);
+        }
+        sem_destroy(&inst->go);
+        sem_destroy(&inst->done);
+        if (inst->pd != NULL)
+            libpd_free_instance(inst->pd);
+        free(inst->outBuffer);
+        delete inst;
+    }
+    pdInstances.clear();
+}
+
+// returns -1 if a listed patch cannot be loaded
+int initPdInstances(LDSPcontext *context, int inChannels)
+{
+    std::ifstream instancesFile(PD_INSTANCES_FILE);
+    if (!instancesFile.is_open())
+        return 0; // _main.pd only
+
+    pdInstanceOutChannels = context->audioOutChannels;
+
+    std::string line;
+    while (std::getline(instancesFile, line)) {
+        std::istringstream lineStream(line);
+        pdInstance *inst = new pdInstance();
+        if (!(lineStream >> inst->patchFile) || inst->patchFile[0] == '#') {
+            delete inst;
+            continue; // empty line or comment
+        }
+        inst->cpu = -1;
+        inst->outOffset = 0;
+        lineStream >> inst->cpu >> inst->outOffset;
+        inst->threadStarted = false;
+        inst->outBuffer = (float *) calloc(pdMaxFrames*pdInstanceOutChannels, sizeof(float));
+        sem_init(&inst->go, 0, 0);
+        sem_init(&inst->done, 0, 0);
+        pdInstances.push_back(inst);
+
+        // new instance becomes the current one of this thread
+        inst->pd = libpd_new_instance();
+        libpd_init_audio(inChannels, pdInstanceOutChannels, context->audioSampleRate);
+        // [; pd dsp 1(
+        libpd_start_message(1);
+        libpd_add_float(1);
+        libpd_finish_message("pd", "dsp");
+        if (inst->outBuffer == NULL || libpd_openfile(inst->patchFile.c_str(), ".") == NULL) {
+            std::cout << "Failed to Load PD Patch " << inst->patchFile << " in its own instance" << std::endl;
+            cleanupPdInstances();
+            return -1;
+        }
+
+        if (pthread_create(&inst->thread, NULL, pdInstance_loop, inst) != 0) {
+            std::cout << "Failed to start thread of PD Patch " << inst->patchFile << std::endl;
+            cleanupPdInstances();
+            return -1;
+        }
+        inst->threadStarted = true;
+        std::cout << "Loaded PD Patch " << inst->patchFile << " in its own instance";
+        if (inst->cpu > -1)
+            std::cout << ", on cpu " << inst->cpu;
+        std::cout << ", summed into outputs from " << inst->outOffset << std::endl;
+    }
+
+    // back to main instance, that setup() and render() keep using
+    libpd_set_instance(libpd_main_instance());
+    return 0;
+}
+
+// sums the outputs of all the instances into the main instance's outputs, waiting for each one to be done
+void mixPdInstances(float *out, int outChannels, int frames)
+{
+    for (pdInstance *inst : pdInstances) {
+        sem_wait(&inst->done);
+        for (int n = 0; n < frames; n++) {
+            for (int chn = 0; chn < pdInstanceOutChannels; chn++) {
+                int outChn = inst->outOffset + chn;
+                if (outChn >= pdInstanceOutChannels)
+                    break;
+                out[n*outChannels + outChn] += inst->outBuffer[n*pdInstanceOutChannels + chn];
+            }
+        }
+    }
+}
+#endif
+
+
+//VIC opt-in DSP profiler, turned on/off with [; ldsp_profile 1/0( and reported with [; ldsp_profile bang( and at exit
+// every subpatch and abstraction is timed in place, between two markers added to the dsp chain around its own perform routines
+// times include nested subpatches, while objects that sit directly in _main.pd are timed all together, as the remainder
+// to profile the very same session more times, run with --replay-inputs
+struct pdProfileEntry {
+    t_canvas *canvas;
+    std::string name; // path from _main.pd, e.g. "synth.pd/voices"
+    int depth; // 0 for subpatches/abstractions in _main.pd
+    uint64_t start; // audio thread only
+    uint64_t periodNs; // audio thread only
+    std::atomic<uint64_t> totalNs;
+    std::atomic<uint64_t> peakNs;
+};
+
+std::atomic<bool> pdProfileOn;
+bool pdProfileUsed = false;
+t_pdinstance *pdProfileInstance; // extra instances are not profiled
+t_gotfn pdCanvasDsp; // original dsp method of subpatches and abstractions
+std::vector<pdProfileEntry *> pdProfileEntries; // protected by pd lock, entries are reused when dsp chain is rebuilt
+std::atomic<uint64_t> pdProfilePeriods;
+std::atomic<uint64_t> pdProfileTotalNs;
+std::atomic<uint64_t> pdProfilePeakNs;
+float pdProfilePeriodUs;
+
+static inline uint64_t pdProfileNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+}
+
+static t_int *pdProfile_startPerform(t_int *w)
+{
+    pdProfileEntry *entry = (pdProfileEntry *)w[1];
+    entry->start = pdProfileNow();
+    return w+2;
+}
+
+static t_int *pdProfile_endPerform(t_int *w)
+{
+    pdProfileEntry *entry = (pdProfileEntry *)w[1];
+    entry->periodNs += pdProfileNow() - entry->start;
+    return w+2;
+}
+
+// called while the dsp chain is built, with pd lock held
+pdProfileEntry *pdProfileGetEntry(t_canvas *canvas)
+{
+    for (pdProfileEntry *entry : pdProfileEntries) {
+        if (entry->canvas == canvas)
+            return entry;
+    }
+
+    pdProfileEntry *entry = new pdProfileEntry();
+    entry->canvas = canvas;
+    entry->depth = -1;
+    for (t_canvas *c = canvas; c->gl_owner != NULL; c = c->gl_owner) {
+        entry->name = (entry->depth < 0) ? c->gl_name->s_name : std::string(c->gl_name->s_name) + "/" + entry->name;
+        entry->depth++;
+    }
+    entry->periodNs = 0;
+    entry->totalNs = 0;
+    entry->peakNs = 0;
+    pdProfileEntries.push_back(entry);
+    return entry;
+}
+
+// replaces the dsp method of canvases
+static void pdProfile_canvasDsp(t_canvas *x, t_signal **sp)
+{
+    if (!pdProfileOn || pd_this != pdProfileInstance) {
+        ((void (*)(t_canvas *, t_signal **))pdCanvasDsp)(x, sp);
+        return;
+    }
+
+    pdProfileEntry *entry = pdProfileGetEntry(x);
+    dsp_add(pdProfile_startPerform, 1, (t_int)entry);
+    ((void (*)(t_canvas *, t_signal **))pdCanvasDsp)(x, sp);
+    dsp_add(pdProfile_endPerform, 1, (t_int)entry);
+}
+
+void initPdProfile(LDSPcontext *context)
+{
+    pdProfileOn = false;
+    pdProfileInstance = pd_this;
+    pdProfilePeriodUs = 1000000.0*context->audioFrames/context->audioSampleRate;
+
+    // the original method is renamed, ours is used from now on
+    t_pd canvasPd = canvas_class;
+    pdCanvasDsp = zgetfn(&canvasPd, gensym("dsp"));
+    class_addmethod(canvas_class, (t_method)pdProfile_canvasDsp, gensym("dsp"), A_CANT, 0);
+}
+
+// starts from scratch every time profiler is turned on
+void pdProfileSet(bool on)
+{
+    if (on == pdProfileOn)
+        return;
+
+    sys_lock();
+    for (pdProfileEntry *entry : pdProfileEntries) {
+        entry->periodNs = 0;
+        entry->totalNs = 0;
+        entry->peakNs = 0;
+    }
+    pdProfilePeriods = 0;
+    pdProfileTotalNs = 0;
+    pdProfilePeakNs = 0;
+    pdProfileOn = on;
+    // rebuild dsp chain, with or without markers [computeAudio(true) does nothing if dsp is already on]
+    canvas_update_dsp();
+    sys_unlock();
+    if (on)
+        pdProfileUsed = true;
+
+    printf("Pd DSP profiler %s\n", on ? "on" : "off");
+}
+
+// called on the audio thread after each period
+void pdProfileEndPeriod(uint64_t periodNs)
+{
+    sys_lock();
+    for (pdProfileEntry *entry : pdProfileEntries) {
+        entry->totalNs.store(entry->totalNs.load(std::memory_order_relaxed) + entry->periodNs, std::memory_order_relaxed);
+        if (entry->periodNs > entry->peakNs.load(std::memory_order_relaxed))
+            entry->peakNs.store(entry->periodNs, std::memory_order_relaxed);
+        entry->periodNs = 0;
+    }
+    sys_unlock();
+
+    pdProfileTotalNs.store(pdProfileTotalNs.load(std::memory_order_relaxed) + periodNs, std::memory_order_relaxed);
+    if (periodNs > pdProfilePeakNs.load(std::memory_order_relaxed))
+        pdProfilePeakNs.store(periodNs, std::memory_order_relaxed);
+    pdProfilePeriods.fetch_add(1, std::memory_order_release);
+}
+
+// sorted by total time, most expensive first
+void pdProfileReport()
+{
+    if (!pdProfileUsed) {
+        printf("Pd DSP profiler was never turned on, send 1 to %s first\n", pd_profileObj.c_str());
+        return;
+    }
+
+    struct pdProfileRow {
+        std::string name;
+        uint64_t totalNs;
+        uint64_t peakNs;
+    };
+    std::vector<pdProfileRow> rows;
+    uint64_t subpatchesNs = 0;
+
+    sys_lock();
+    for (pdProfileEntry *entry : pdProfileEntries) {
+        uint64_t totalNs = entry->totalNs.load(std::memory_order_relaxed);
+        if (totalNs == 0)
+            continue; // not part of the current dsp chain
+        rows.push_back({entry->name, totalNs, entry->peakNs.load(std::memory_order_relaxed)});
+        if (entry->depth == 0)
+            subpatchesNs += totalNs;
+    }
+    sys_unlock();
+
+    uint64_t periods = pdProfilePeriods.load(std::memory_order_acquire);
+    uint64_t totalNs = pdProfileTotalNs.load(std::memory_order_relaxed);
+    if (periods == 0 || totalNs == 0) {
+        printf("Pd DSP profiler has no data yet\n");
+        return;
+    }
+    rows.push_back({"[_main.pd objects]", totalNs > subpatchesNs ? totalNs-subpatchesNs : 0, 0});
+    std::sort(rows.begin(), rows.end(), [](const pdProfileRow &a, const pdProfileRow &b) { return a.totalNs > b.totalNs; });
+
+    double avgUs = totalNs/1000.0/periods;
+    printf("\nPd DSP profile over %llu periods of %.1f us\n", (unsigned long long)periods, pdProfilePeriodUs);
+    printf("  total: %.1f us per period on average [%.1f%% of period], %.1f us peak\n", avgUs, 100.0*avgUs/pdProfilePeriodUs, pdProfilePeakNs.load()/1000.0);
+    printf("  %10s %10s %8s   %s\n", "avg us", "peak us", "% dsp", "subpatch");
+    for (const pdProfileRow &row : rows) {
+        if (row.peakNs > 0)
+            printf("  %10.1f %10.1f %7.1f%%   %s\n", row.totalNs/1000.0/periods, row.peakNs/1000.0, 100.0*row.totalNs/totalNs, row.name.c_str());
+        else
+            printf("  %10.1f %10s %7.1f%%   %s\n", row.totalNs/1000.0/periods, "-", 100.0*row.totalNs/totalNs, row.name.c_str());
+    }
+    printf("\n");
+}
+
+void cleanupPdProfile()
+{
+    if (pdProfileUsed)
+        pdProfileReport();
+    for (pdProfileEntry *entry : pdProfileEntries)
+        delete entry;
+    pdProfileEntries.clear();
+}
+
+
+void *pdMessages_loop(void *arg)
+{
+    set_priority(LDSPprioOrder_pdMessages, "pdMessages", false);
+#ifdef PD_MULTI_INSTANCE
+    // instance is per thread, messages come from _main.pd only
+    libpd_set_instance(libpd_main_instance());
+#endif
+
+    while (true) {
+        sem_wait(&pdMessagesSem);
+        if (pdMessagesShouldStop)
+            break;
+        lpd.receiveMessages();
+        lpd.receiveMidi();
+    }
+    return (void *)0;
+}
+
+// render() sends straight to the objects bound to the receiver symbol, like libpd_float() and libpd_list() do,
+// but using symbols prepared in setup(), so that no string is built or hashed [gensym()] on the audio thread
+static inline void pdSendFloat(t_symbol *dest, float value)
+{
+    if (dest->s_thing == NULL)
+        return; // no [receive] in the patch
+    sys_lock();
+    pd_float(dest->s_thing, value);
+    sys_unlock();
+}
+
+static inline void pdSendList(t_symbol *dest, int argc, t_atom *argv)
+{
+    if (dest->s_thing == NULL)
+        return; // no [receive] in the patch
+    sys_lock();
+    pd_list(dest->s_thing, &s_list, argc, argv);
+    sys_unlock();
+}
+
+// returns -1 if fifos cannot be allocated
+int initPdFifo(LDSPcontext *context)
+{
+    // leftover input frames are always a multiple of gcd(period, block size), up to block size-gcd
+    // and that is exactly how many output frames we need to have ready in advance
+    int latency = pdBlockSize - std::gcd((int)context->audioFrames, pdBlockSize);
+
+    pdInFifo = (float *) calloc((pdBlockSize-1+context->audioFrames)*pdInChannels + 1, sizeof(float)); // +1 in case there are no inputs
+    pdInFifoFrames = 0;
+    pdOutFifo = (float *) calloc((latency+context->audioFrames)*pdOutChannels, sizeof(float));
+    pdOutFifoFrames = latency; // starts with silence
+    if (pdInFifo == NULL || pdOutFifo == NULL) {
+        std::cout << "Failed to allocate memory for pure data block adapter" << std::endl;
+        return -1;
+    }
+
+    printf("Period size %d is not a multiple of pure data block size %d, adding %d frames of latency [%.2f ms]\n",
+           context->audioFrames, pdBlockSize, latency, 1000.0*latency/context->audioSampleRate);
+    return 0;
+}
+
+
 bool setup(LDSPcontext *context, void *userData)
 {
     // Store a reference to context so we can access it during receive hooks
@@ -196,12 +651,6 @@ bool setup(LDSPcontext *context, void *userData)
     lpd.setReceiver(&eventHandler);
     lpd.setMidiReceiver(&midiHandler);
 
-    if (context->audioFrames < PD_MINIMUM_BLOCK_SIZE) {
-        std::cout << "Setup Failed: The minimum pure-data block size is " << PD_MINIMUM_BLOCK_SIZE  << ", " << context->audioFrames << " was given." << std::endl;
-        return false;
-    }
-
-
     // Check if sensors are enabled
     gSensorsEnabled = false;
     for (int i = 0; i < context->sensorChannels; i++) {
@@ -213,28 +662,36 @@ bool setup(LDSPcontext *context, void *userData)
     // Check if control inputs are on globaly (buttons + multitouch)
     gControlInEnabled = context->ctrlInChannels > 0;
 
+    // Process audio as normal, unless sensors are read through adc~ too
+    pdInChannels = context->audioInChannels;
     if (gSensorsEnabled) {
         std::cout << "Sensor inputs are on" << std::endl;
+        // -1 never matches a sensor value, so that all supported sensors are sent at the first period
+        sensorStates.assign(context->sensorChannels, -1);
+        for (int i = 0; i < context->sensorChannels; i++) {
+            if (!context->sensorsSupported[i])
+                sensorStates[i] = 0;
+        }
+#ifdef PD_SENSORS_ADC
         // Force 2 audio channels, even if R channel isn't used, 
         // so that users won't have to refactor adc channel routing if switching between the two
         pdInChannels = PD_AUDIO_IN_CHANNELS+context->sensorChannels;
         // Try to allocate memory to hold our input and output buffers that will be used to pass sensor+audio data to pure-data
         inBufferSize = context->audioFrames*pdInChannels;
         printf("Pure data input buffer size is: %d\n" , inBufferSize);
-        inBuffer = (float *) malloc(inBufferSize * sizeof(float));
+        inBuffer = (float *) calloc(inBufferSize, sizeof(float)); // unused audio channels stay silent
         if (inBuffer == NULL) {
             std::cout << "Failed to allocate memory for input channels" << std::endl;
             return false;
         }
+#endif
     }
     else {
         std::cout << "Sensor inputs are off" << std::endl;
-        // Process audio as normal if not using sensors
-        pdInChannels = context->audioInChannels;
     }
 
 #ifdef PD_SCOPE
-    pdOutChannels = 30; // if scope if used, we need to be abel to accomodate channels 27, 28, 29 and 30! //VIC is this really needed?
+    pdOutChannels = PD_SCOPE_FIRST_CHANNEL+PD_SCOPE_CHANNELS; // if scope if used, we need to be abel to accomodate channels 27, 28, 29 and 30! //VIC is this really needed?
     outBufferSize = context->audioFrames*pdOutChannels;
     printf("Pure data output buffer size is: %d\n" , outBufferSize);
     outBuffer = (float *) malloc(outBufferSize * sizeof(float));
@@ -262,6 +719,10 @@ bool setup(LDSPcontext *context, void *userData)
     lpd.subscribe(pd_enableMtObj);
     // Listen to bangs sent to the enable buttons object
     lpd.subscribe(pd_enableBtnObj);
+    // Listen to profiler controls
+    lpd.subscribe(pd_profileObj);
+    // before patch is opened and dsp chain is built
+    initPdProfile(context);
     
 
 
@@ -279,6 +740,25 @@ bool setup(LDSPcontext *context, void *userData)
 
 
 
+    if (gSensorsEnabled) {
+        // Be careful, these need to be manually updated too!
+        pdSensorNames.resize(chn_sens_count);
+        pdSensorNames[chn_sens_accelX] = "accelX";
+        pdSensorNames[chn_sens_accelY] = "accelY";
+        pdSensorNames[chn_sens_accelZ] = "accelZ";
+        pdSensorNames[chn_sens_magX] = "magX";
+        pdSensorNames[chn_sens_magY] = "magY";
+        pdSensorNames[chn_sens_magZ] = "magZ";
+        pdSensorNames[chn_sens_gyroX] = "gyroX";
+        pdSensorNames[chn_sens_gyroY] = "gyroY";
+        pdSensorNames[chn_sens_gyroZ] = "gyroZ";
+        pdSensorNames[chn_sens_light] = "light";
+        pdSensorNames[chn_sens_proximity] = "proximity";
+        pdSensorSyms.resize(chn_sens_count);
+        for (int i = 0; i < chn_sens_count; i++)
+            pdSensorSyms[i] = gensym((pd_sensorObjPrefix + pdSensorNames[i]).c_str());
+    }
+
     if (gControlInEnabled) {    
         std::cout << "Control Inputs are on" << std::endl;
         // Initialize button input resource
@@ -289,6 +769,9 @@ bool setup(LDSPcontext *context, void *userData)
         pdButtonNames[chn_btn_power] = "power";
         pdButtonNames[chn_btn_volDown] = "volDown";
         pdButtonNames[chn_btn_volUp] = "volUp";
+        pdButtonSyms.resize(chn_btn_count);
+        for (int i = 0; i < chn_btn_count; i++)
+            pdButtonSyms[i] = gensym((pd_btnInputObjPrefix + pdButtonNames[i]).c_str());
 
 
         // Initliaze multitouch resources
@@ -308,6 +791,11 @@ bool setup(LDSPcontext *context, void *userData)
         pdMTChannelMappings[pd_mt_y] = chn_mt_y;
         pdMTChannelMappings[pd_mt_id] = chn_mt_id;
         pdMTChannelMappings[pd_mt_pressure] = chn_mt_pressure;
+
+        pdTouchSyms.resize(gNumTouchSlots);
+        for (int slot = 0; slot < gNumTouchSlots; slot++)
+            pdTouchSyms[slot] = gensym((pd_touchObjPrefix + std::to_string(slot)).c_str());
+        pdAnyTouchSym = gensym(pd_mtAnyTouchObj.c_str());
     }
     else {
         std::cout << "Control Inputs are off" << std::endl;
@@ -319,12 +807,31 @@ bool setup(LDSPcontext *context, void *userData)
     gSendBtnInputs = false;
 
 
+    pdMessagesShouldStop = false;
+    sem_init(&pdMessagesSem, 0, 0);
+    if (pthread_create(&pdMessagesThread, NULL, pdMessages_loop, NULL) != 0) {
+        std::cout << "Failed to start pure data messages thread" << std::endl;
+        return false;
+    }
+    pdMessagesThreadStarted = true;
+
     // Turn on audio
     lpd.computeAudio(true);
     pdBlockSize = libpd_blocksize(); 
 
+    // any period size works, but if it is not a multiple of the block size we need to buffer
+    pdFifoOn = (context->audioFrames % pdBlockSize) != 0;
+    pdMaxFrames = pdFifoOn ? (context->audioFrames/pdBlockSize + 1)*pdBlockSize : context->audioFrames;
+    if (pdFifoOn && initPdFifo(context) < 0)
+        return false;
+
+#ifdef PD_MULTI_INSTANCE
+    if (initPdInstances(context, pdInChannels) < 0)
+        return false;
+#endif
+
 #ifdef PD_SCOPE
-    scope.setup(4, context->audioSampleRate);
+    scope.setup(PD_SCOPE_CHANNELS, context->audioSampleRate);
 #endif
 
 
@@ -334,8 +841,13 @@ bool setup(LDSPcontext *context, void *userData)
 
 void render(LDSPcontext *context, void *userData)
 {
-
-    int pdBlocks = context->audioFrames / pdBlockSize;
+#ifdef PD_MULTI_INSTANCE
+    // instance is per thread, like in the messages thread the main one is selected once
+    if (!pdAudioThreadInstanceSet) {
+        libpd_set_instance(libpd_main_instance());
+        pdAudioThreadInstanceSet = true;
+    }
+#endif
 
     // If control inputs are off globally (via command line), ignore them completely
     // even if user tries to enable them from inside pure-data 
@@ -345,9 +857,11 @@ void render(LDSPcontext *context, void *userData)
         // send button inputs to pure data if user has enabled them
         if (gSendBtnInputs) {
             for (int i = 0; i < chn_btn_count; i++) {
+                if (!buttonChanged(context, (btnInputChannel) i))
+                    continue;
                 int newButtonVal = buttonRead(context, (btnInputChannel) i);
                 if (newButtonVal != buttonInputStates[i] && newButtonVal != -1) {
-                    lpd.sendFloat(pd_btnInputObjPrefix + pdButtonNames[i], newButtonVal);
+                    pdSendFloat(pdButtonSyms[i], newButtonVal);
                     buttonInputStates[i] = newButtonVal;
                 }
             }
@@ -360,19 +874,21 @@ void render(LDSPcontext *context, void *userData)
             // Send anyTouch through to PD if it changed since last render call
             float anyTouch = multiTouchRead(context, chn_mt_anyTouch, 0);
             if (anyTouch != anyTouchState && anyTouch != -1) {
-                lpd.sendFloat("ldsp_mt_anyTouch", anyTouch);
+                pdSendFloat(pdAnyTouchSym, anyTouch);
                 anyTouchState = anyTouch;
             }
 
             int numElements;
             // Send each touch slot to its respective pd receive element
             for (int slot = 0; slot < gNumTouchSlots; slot++) {
+                // skip slots that were not touched since last period
+                if (!multiTouchChanged(context, slot))
+                    continue;
                 int chunkStart = slot*PD_MULTITOUCH_INPUTS;
-                pd::List touchList;
                 numElements = 0;
                 for (int i = 0; i < PD_MULTITOUCH_INPUTS; i++) {
                     float newVal = multiTouchRead(context, pdMTChannelMappings[i], slot); 
-                    touchList.addFloat(newVal);
+                    SETFLOAT(&touchAtoms[i], newVal);
                     if (newVal != multiTouchState[chunkStart+i]  && (newVal != -1 || i == (int)pd_mt_id) ) { // no -1 values, except for id=-1; it is a good way to signal that there is no touch in that slot
                         numElements++;             
                         multiTouchState[chunkStart+i] = newVal;
@@ -380,84 +896,146 @@ void render(LDSPcontext *context, void *userData)
                 }
                 // Don't send the list if nothing has changed, 
                 // but send the whole list if at least one element has changed
-                if (numElements > 0) {
-                    std::string destObj = pd_touchObjPrefix + std::to_string(slot);
-                    lpd.sendList(destObj, touchList);
-                }
+                if (numElements > 0)
+                    pdSendList(pdTouchSyms[slot], PD_MULTITOUCH_INPUTS, touchAtoms);
             }
         }
     }
 
-    const float *inBuffPtr;
+    // sensors change at most once per period, so they are sent as control-rate values
+    // and only the ones that changed [the receivers are looked up once, in setup()]
+#ifdef PD_SENSORS_ADC
+    bool sensorsChanged = false; // sensor channels of the inputs are rewritten only if needed
+#endif
+    if (gSensorsEnabled) {
+        for (int i = 0; i < context->sensorChannels; i++) {
+            if (!context->sensorsSupported[i] || context->sensors[i] == sensorStates[i])
+                continue;
+            sensorStates[i] = context->sensors[i];
+            pdSendFloat(pdSensorSyms[i], sensorStates[i]);
+#ifdef PD_SENSORS_ADC
+            sensorsChanged = true;
+#endif
+        }
+    }
 
+    // inputs go straight to pd, unless they need to be queued or sensors have to be interleaved with audio
+    const float *pdIn = context->audioIn;
+    float *pdInFrames = pdFifoOn ? &pdInFifo[pdInFifoFrames*pdInChannels] : inBuffer;
+#ifdef PD_SENSORS_ADC
     if (gSensorsEnabled) {
-        int audioChunkStart, sensorChunkStart;
+        // inBuffer still holds the sensor values of the previous period, the fifo does not
+        bool writeSensors = pdFifoOn || sensorsChanged;
         for (int i = 0; i < context->audioFrames; i++) {
             int frameOffset = i * pdInChannels;
             
             // Fill the first N channels with audio data 
-            memcpy(&inBuffer[frameOffset], 
+            memcpy(&pdInFrames[frameOffset], 
                    &context->audioIn[i * context->audioInChannels], 
                    context->audioInChannels * sizeof(float));
             
             // if audioInChannels < PD_AUDIO_IN_CHANNELS, there are empty frames between audio frames and sensor frames!
             
-            // Fill the rest of the channels with the sensor data
-            memcpy(&inBuffer[frameOffset + PD_AUDIO_IN_CHANNELS], 
-                   context->sensors, 
-                   context->sensorChannels * sizeof(float));
-
-            // Fill the first N channels with audio data (force 2 even if unused)
-            // audioChunkStart = i*pdInChannels;
-            // for (int audioChannel = 0; audioChannel < context->audioInChannels; audioChannel++) {
-            //     inBuffer[audioChunkStart+audioChannel] = audioRead(context, i, audioChannel);
-            // }
-
-            // // Fill the rest of the channels with the sensor data
-            // sensorChunkStart = audioChunkStart+PD_AUDIO_IN_CHANNELS;
-            // for (int sensorIdx = 0; sensorIdx < context->sensorChannels; sensorIdx++) {
-            //     inBuffer[sensorChunkStart+sensorIdx] = sensorRead(context, (sensorChannel) sensorIdx); 
+            // Fill the rest of the channels with the sensor data, same for each frame of the period
+            if (writeSensors)
+                memcpy(&pdInFrames[frameOffset + PD_AUDIO_IN_CHANNELS], 
+                       sensorStates.data(), 
+                       context->sensorChannels * sizeof(float));
         }
-        // lpd.processFloat(pdBlocks, inBuffer, context->audioOut);
-        inBuffPtr = inBuffer;
+        pdIn = pdInFrames;
+    }
+    else
+#endif
+    if (pdFifoOn && pdInChannels > 0)
+        memcpy(pdInFrames, context->audioIn, context->audioFrames*pdInChannels*sizeof(float));
+
+    float *pdOut;
+    int pdBlocks;
+    if (pdFifoOn) {
+        pdInFifoFrames += context->audioFrames;
+        pdBlocks = pdInFifoFrames / pdBlockSize;
+        pdIn = pdInFifo;
+        pdOut = &pdOutFifo[pdOutFifoFrames*pdOutChannels];
     }
     else {
-        // Process audio as normal if not using sens
-        // lpd.processFloat(pdBlocks, context->audioIn, context->audioOut);
-        inBuffPtr = context->audioIn;
+        pdBlocks = context->audioFrames / pdBlockSize;
+#ifdef PD_SCOPE
+        pdOut = outBuffer;
+#else
+        pdOut = context->audioOut;
+#endif
+    }
+
+    // with small periods, some render calls may have no full block to process
+    if (pdBlocks > 0) {
+#ifdef PD_MULTI_INSTANCE
+        // extra instances process the same inputs in parallel with the main one
+        pdInstancesIn = pdIn;
+        pdInstancesBlocks = pdBlocks;
+        for (pdInstance *inst : pdInstances)
+            sem_post(&inst->go);
+#endif
+
+        bool profiling = pdProfileOn;
+        uint64_t profileStart = profiling ? pdProfileNow() : 0;
+        lpd.processFloat(pdBlocks, pdIn, pdOut);
+        if (profiling)
+            pdProfileEndPeriod(pdProfileNow() - profileStart);
+
+#ifdef PD_MULTI_INSTANCE
+        mixPdInstances(pdOut, pdOutChannels, pdBlocks*pdBlockSize);
+#endif
+    }
+
+    if (pdFifoOn) {
+        pdOutFifoFrames += pdBlocks*pdBlockSize;
+        pdOut = pdOutFifo; // oldest frames first
     }
 
 #ifdef PD_SCOPE
-    lpd.processFloat(pdBlocks, inBuffPtr, outBuffer);
-    
     for (int i = 0; i < context->audioFrames; i++) {
         // Copy the first audioOutChannels from each frame
         memcpy(&context->audioOut[i * context->audioOutChannels], 
-               &outBuffer[i * pdOutChannels],
+               &pdOut[i * pdOutChannels],
                context->audioOutChannels * sizeof(float));
-
-        // Extract scope channels 27-30 (indices 26-29) for this frame
-        float scope1 = outBuffer[i * pdOutChannels + 26];  
-        float scope2 = outBuffer[i * pdOutChannels + 27];  
-        float scope3 = outBuffer[i * pdOutChannels + 28];  
-        float scope4 = outBuffer[i * pdOutChannels + 29]; 
-        
-        scope.log(scope1, scope2, scope3, scope4);
     }
+    // scope channels 27-30 (indices 26-29) are contiguous in each frame, so they are logged in place, all at once
+    scope.logBlock(&pdOut[PD_SCOPE_FIRST_CHANNEL], context->audioFrames, pdOutChannels);
 #else
-    lpd.processFloat(pdBlocks, inBuffPtr, context->audioOut);
+    if (pdFifoOn)
+        memcpy(context->audioOut, pdOut, context->audioFrames*pdOutChannels*sizeof(float));
 #endif
 
+    // drop what was consumed, leftovers are at most block size-1 input frames and latency output frames
+    if (pdFifoOn) {
+        pdInFifoFrames -= pdBlocks*pdBlockSize;
+        memmove(pdInFifo, &pdInFifo[pdBlocks*pdBlockSize*pdInChannels], pdInFifoFrames*pdInChannels*sizeof(float));
+        pdOutFifoFrames -= context->audioFrames;
+        memmove(pdOutFifo, &pdOutFifo[context->audioFrames*pdOutChannels], pdOutFifoFrames*pdOutChannels*sizeof(float));
+    }
+
 
-    lpd.receiveMessages();
-    lpd.receiveMidi();
+    // non blocking, messages are received on their own thread
+    sem_post(&pdMessagesSem);
 }
 
 void cleanup(LDSPcontext *context, void *userData)
 {
+    if (pdMessagesThreadStarted) {
+        pdMessagesShouldStop = true;
+        sem_post(&pdMessagesSem);
+        pthread_join(pdMessagesThread, NULL);
+        sem_destroy(&pdMessagesSem);
+    }
+#ifdef PD_MULTI_INSTANCE
+    cleanupPdInstances();
+#endif
+    cleanupPdProfile();
     free(inBuffer);
 #ifdef PD_SCOPE
     free(outBuffer);
 #endif
+    free(pdInFifo);
+    free(pdOutFifo);
     
 }
\ No newline at end of file
@@ -40,6 +40,7 @@ bool hwconfigVerbose = false;
 void parseMixerSettings(ordered_json *config, LDSPhwConfig *hwconfig);
 void parseDefaultAudioParams(ordered_json *config, LDSPhwConfig *hwconfig);
 void parseCtrlOutputs(ordered_json *config, LDSPhwConfig *hwconfig);
+void parseSensors(ordered_json *config, LDSPhwConfig *hwconfig);
 
 
 LDSPhwConfig* LDSP_HwConfig_alloc()
@@ -99,6 +100,7 @@ int LDSP_parseHwConfigFile(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 	parseMixerSettings(&config, hwconfig);
 	parseDefaultAudioParams(&config, hwconfig);
 	parseCtrlOutputs(&config, hwconfig);
+	parseSensors(&config, hwconfig);
 
     // done parsing config file
 	f_config.close();
@@ -316,3 +318,38 @@ void parseCtrlOutputs(ordered_json *config, LDSPhwConfig *hwconfig)
 		}
 	}
 }
+
+
+void parseSensors(ordered_json *config, LDSPhwConfig *hwconfig)
+{
+    if(hwconfigVerbose)
+        printf("Parsing sensors...\n");
+
+    // parse sensors container
+    ordered_json config_ = *(config);
+
+	// these are all optional
+	// sensor names are checked when sensors are initialized
+	ordered_json sensors = config_["[sensors]"];
+	for(auto &it : sensors.items())
+	{
+		ordered_json sensor = it.value();
+		LDSPsensorConfig sensConfig;
+
+		json val = sensor["enabled"];
+		if(val.is_boolean())
+			sensConfig.enabled = val;
+
+		// rate in Hz, -1 means max rate
+		val = sensor["rate"];
+		if(val.is_number())
+			sensConfig.rate = val;
+
+		// max report latency in ms, -1 or 0 mean no batching
+		val = sensor["max report latency"];
+		if(val.is_number())
+			sensConfig.maxReportLatency = val;
+
+		hwconfig->sensors[it.key()] = sensConfig;
+	}
+}
@@ -0,0 +1,381 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring> // memcpy, strerror
+#include <cerrno>
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h> // usleep, close
+
+#include "inputsRecording.h"
+#include "tinyalsaAudio.h" // for LDSPinternalContext
+#include "thread_utils.h"
+
+bool inputsRecordingVerbose = false;
+bool recordingInputs = false;
+bool replayingInputs = false;
+
+LDSPinputsRecordingContext inRecContext;
+extern LDSPinternalContext intContext;
+
+int initRecording(string filename);
+int initReplay(string filename);
+void *inputsRecording_writerLoop(void*);
+void fillRecordingHeader();
+
+
+int initInputsRecording(LDSPinitSettings *settings)
+{
+    inputsRecordingVerbose = settings->verbose;
+
+    if(settings->recordInputsFile == "" && settings->replayInputsFile == "")
+        return 0;
+
+    if(settings->recordInputsFile != "" && settings->replayInputsFile != "")
+    {
+        fprintf(stderr, "Cannot record and replay inputs at the same time, inputs will be neither recorded nor replayed\n");
+        return -1;
+    }
+
+    if(inputsRecordingVerbose)
+        printf("\ninitInputsRecording()\n");
+
+    fillRecordingHeader();
+
+    if(settings->recordInputsFile != "")
+    {
+        if(initRecording(settings->recordInputsFile) < 0)
+            return -1;
+        recordingInputs = true;
+    }
+    else
+    {
+        if(initReplay(settings->replayInputsFile) < 0)
+            return -1;
+        replayingInputs = true;
+    }
+
+    return 0;
+}
+
+void cleanupInputsRecording()
+{
+    if(recordingInputs)
+    {
+        if(inputsRecordingVerbose)
+            printf("cleanupInputsRecording()\n");
+
+        // writer flushes whatever is left in the ring before exiting
+        inRecContext.writerShouldStop = true;
+        pthread_join(inRecContext.writerThread, NULL);
+        fclose(inRecContext.recFile);
+        free(inRecContext.ring);
+
+        if(inRecContext.droppedRecords > 0)
+            fprintf(stderr, "Warning! %u periods could not be recorded, the file writer could not keep up\n", inRecContext.droppedRecords);
+        recordingInputs = false;
+    }
+
+    if(replayingInputs)
+    {
+        if(inputsRecordingVerbose)
+            printf("cleanupInputsRecording()\n");
+
+        munmap(inRecContext.replayData, inRecContext.replayDataSize);
+        delete[] inRecContext.sensors;
+        delete[] inRecContext.ctrlInputs;
+        replayingInputs = false;
+    }
+}
+
+bool isRecordingInputs()
+{
+    return recordingInputs;
+}
+
+bool isReplayingInputs()
+{
+    return replayingInputs;
+}
+
+// called on the audio thread, after all inputs have been read
+void recordInputs()
+{
+    LDSPinputsRecordingContext &ctx = inRecContext;
+
+    // file cannot be written anymore
+    if(ctx.writeFailed.load(std::memory_order_relaxed))
+        return;
+
+    unsigned int write = ctx.ringWrite.load(std::memory_order_relaxed);
+    unsigned int read = ctx.ringRead.load(std::memory_order_acquire);
+
+    // ring is full, we cannot block the audio thread!
+    if(write - read >= INPUTS_RECORDING_RING_PERIODS)
+    {
+        ctx.droppedRecords++;
+        return;
+    }
+
+    char *record = ctx.ring + (write % INPUTS_RECORDING_RING_PERIODS)*ctx.header.recordBytes;
+    memcpy(record, intContext.audioIn, ctx.audioInBytes);
+    record += ctx.audioInBytes;
+    memcpy(record, intContext.sensors, ctx.sensorsBytes);
+    record += ctx.sensorsBytes;
+    if(ctx.ctrlInputsBytes > 0) // ctrl inputs may be off
+        memcpy(record, intContext.ctrlInputs, ctx.ctrlInputsBytes);
+    record += ctx.ctrlInputsBytes;
+    memcpy(record, intContext.ctrlInChanges, sizeof(ctrlInputsChangeMask));
+
+    ctx.ringWrite.store(write+1, std::memory_order_release);
+}
+
+// called on the audio thread, in place of capture, readSensors() and readCtrlInputs()
+// returns -1 when there is nothing left to replay
+int replayInputs()
+{
+    LDSPinputsRecordingContext &ctx = inRecContext;
+    if(ctx.replayIdx >= ctx.replayRecords)
+        return -1;
+
+    const char *record = ctx.replayData + sizeof(inputsRecordingHeader) + ctx.replayIdx*ctx.header.recordBytes;
+    // audio in is replayed only if the current engine has a matching capture buffer
+    if(ctx.audioInBytes > 0)
+        memcpy(intContext.audioIn, record, ctx.audioInBytes);
+    record += ctx.header.audioInChannels*ctx.header.audioFrames*sizeof(float);
+    memcpy(ctx.sensors, record, ctx.sensorsBytes);
+    record += ctx.sensorsBytes;
+    if(ctx.replayCtrlInputs)
+    {
+        memcpy(ctx.ctrlInputs, record, ctx.ctrlInputsBytes);
+        memcpy(intContext.ctrlInChanges, record + ctx.ctrlInputsBytes, sizeof(ctrlInputsChangeMask));
+    }
+
+    ctx.replayIdx++;
+    return 0;
+}
+
+
+
+//--------------------------------------------------------------------------------------------------
+
+// describes the inputs of the current engine
+void fillRecordingHeader()
+{
+    inputsRecordingHeader &header = inRecContext.header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, INPUTS_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = INPUTS_RECORDING_VERSION;
+    header.audioFrames = intContext.audioFrames;
+    header.audioInChannels = (intContext.audioIn != nullptr) ? intContext.audioInChannels : 0;
+    header.sensorChannels = intContext.sensorChannels;
+    header.audioSampleRate = intContext.audioSampleRate;
+    memcpy(header.sensorsSupported, intContext.sensorsSupported, sizeof(header.sensorsSupported));
+    // ctrl inputs buffers are not even allocated when ctrl inputs are off, then nothing is recorded [zeroed above]
+    if(intContext.mtInfo != nullptr)
+    {
+        // BE CAREFUL, this must match the layout of ctrl inputs buffer, see initCtrlInputBuffers()
+        header.ctrlInputsLen = chn_btn_count+1 + (chn_mt_count-1)*intContext.mtInfo->touchSlots;
+        memcpy(header.buttonsSupported, intContext.buttonsSupported, sizeof(header.buttonsSupported));
+        header.mtInfo = *intContext.mtInfo;
+    }
+
+    inRecContext.audioInBytes = header.audioInChannels*header.audioFrames*sizeof(float);
+    inRecContext.sensorsBytes = header.sensorChannels*sizeof(float);
+    inRecContext.ctrlInputsBytes = header.ctrlInputsLen*sizeof(int);
+    header.recordBytes = inRecContext.audioInBytes + inRecContext.sensorsBytes + inRecContext.ctrlInputsBytes + sizeof(ctrlInputsChangeMask);
+}
+
+int initRecording(string filename)
+{
+    LDSPinputsRecordingContext &ctx = inRecContext;
+
+    ctx.recFile = fopen(filename.c_str(), "wb");
+    if(ctx.recFile == NULL)
+    {
+        fprintf(stderr, "Cannot open inputs recording file %s: %s\n", filename.c_str(), strerror(errno));
+        return -1;
+    }
+
+    if(fwrite(&ctx.header, sizeof(ctx.header), 1, ctx.recFile) != 1)
+    {
+        fprintf(stderr, "Cannot write inputs recording file %s: %s\n", filename.c_str(), strerror(errno));
+        fclose(ctx.recFile);
+        return -1;
+    }
+
+    ctx.ring = (char *)malloc(INPUTS_RECORDING_RING_PERIODS*ctx.header.recordBytes);
+    if(ctx.ring == NULL)
+    {
+        fprintf(stderr, "Could not allocate inputs recording buffer\n");
+        fclose(ctx.recFile);
+        return -1;
+    }
+    ctx.ringWrite = 0;
+    ctx.ringRead = 0;
+    ctx.droppedRecords = 0;
+    ctx.writeFailed = false;
+    ctx.writerShouldStop = false;
+
+    if(pthread_create(&ctx.writerThread, NULL, inputsRecording_writerLoop, NULL))
+    {
+        fprintf(stderr, "Error: unable to create inputs recording thread\n");
+        free(ctx.ring);
+        fclose(ctx.recFile);
+        return -1;
+    }
+
+    if(inputsRecordingVerbose)
+        printf("\tRecording inputs to %s [%u bytes per period]\n", filename.c_str(), ctx.header.recordBytes);
+
+    return 0;
+}
+
+int initReplay(string filename)
+{
+    LDSPinputsRecordingContext &ctx = inRecContext;
+    const inputsRecordingHeader &current = ctx.header;
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Cannot open inputs recording file %s: %s\n", filename.c_str(), strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(inputsRecordingHeader))
+    {
+        fprintf(stderr, "Inputs recording file %s is not valid\n", filename.c_str());
+        close(fd);
+        return -1;
+    }
+
+    // the whole file is mapped and prefaulted, so that the audio thread never waits for disk reads
+    ctx.replayDataSize = st.st_size;
+    ctx.replayData = (char *)mmap(NULL, ctx.replayDataSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(ctx.replayData == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot map inputs recording file %s: %s\n", filename.c_str(), strerror(errno));
+        return -1;
+    }
+
+    inputsRecordingHeader recorded;
+    memcpy(&recorded, ctx.replayData, sizeof(recorded));
+    // the engine must process periods of the same size, otherwise replay would not be faithful
+    if(memcmp(recorded.magic, INPUTS_RECORDING_MAGIC, sizeof(recorded.magic)) != 0 || recorded.version != INPUTS_RECORDING_VERSION ||
+       recorded.sensorChannels != current.sensorChannels || recorded.audioFrames != current.audioFrames ||
+       recorded.audioSampleRate != current.audioSampleRate)
+    {
+        fprintf(stderr, "Inputs recording file %s is not compatible with current settings [period size %u, recorded %u; sample rate %.0f, recorded %.0f]\n",
+                filename.c_str(), current.audioFrames, recorded.audioFrames, current.audioSampleRate, recorded.audioSampleRate);
+        munmap(ctx.replayData, ctx.replayDataSize);
+        return -1;
+    }
+
+    // audio in is replayed only if capture is on with same number of channels
+    ctx.audioInBytes = 0;
+    if(recorded.audioInChannels > 0 && recorded.audioInChannels == current.audioInChannels)
+        ctx.audioInBytes = recorded.audioInChannels*recorded.audioFrames*sizeof(float);
+    else if(recorded.audioInChannels != current.audioInChannels)
+        fprintf(stderr, "Warning! Recorded audio in has %u channels, current capture has %u, audio in will not be replayed\n", recorded.audioInChannels, current.audioInChannels);
+    ctx.sensorsBytes = recorded.sensorChannels*sizeof(float);
+    ctx.ctrlInputsBytes = recorded.ctrlInputsLen*sizeof(int);
+    // ctrl inputs are replayed only if they are on now and were on when recording
+    ctx.replayCtrlInputs = (recorded.ctrlInputsLen > 0 && current.ctrlInputsLen > 0);
+    if(!ctx.replayCtrlInputs && recorded.ctrlInputsLen != current.ctrlInputsLen)
+        fprintf(stderr, "Warning! Ctrl inputs are off either in the recording or now, they will not be replayed\n");
+    ctx.header = recorded;
+    ctx.replayRecords = (ctx.replayDataSize-sizeof(inputsRecordingHeader)) / recorded.recordBytes;
+    ctx.replayIdx = 0;
+
+    // replayed sensors and ctrl inputs live in their own buffers, along with what was supported on the recording phone
+    ctx.sensors = new float[recorded.sensorChannels];
+    memset(ctx.sensors, 0, ctx.sensorsBytes);
+    memcpy(ctx.sensorsSupported, recorded.sensorsSupported, sizeof(ctx.sensorsSupported));
+    ctx.ctrlInputs = nullptr;
+    if(ctx.replayCtrlInputs)
+    {
+        ctx.ctrlInputs = new int[recorded.ctrlInputsLen];
+        memset(ctx.ctrlInputs, 0, ctx.ctrlInputsBytes);
+        memcpy(ctx.buttonsSupported, recorded.buttonsSupported, sizeof(ctx.buttonsSupported));
+        ctx.mtInfo = recorded.mtInfo;
+    }
+
+    // update context
+    intContext.sensors = ctx.sensors;
+    intContext.sensorsSupported = ctx.sensorsSupported;
+    if(ctx.replayCtrlInputs)
+    {
+        intContext.ctrlInputs = ctx.ctrlInputs;
+        intContext.buttonsSupported = ctx.buttonsSupported;
+        intContext.mtInfo = &ctx.mtInfo;
+    }
+    //VIC user context is reference of this internal one, so no need to update it
+
+    if(inputsRecordingVerbose)
+        printf("\tReplaying %zu periods of inputs from %s\n", ctx.replayRecords, filename.c_str());
+
+    return 0;
+}
+
+void *inputsRecording_writerLoop(void*)
+{
+    LDSPinputsRecordingContext &ctx = inRecContext;
+
+    // file writes are not time critical
+    set_niceness(10, "inputsRecording", inputsRecordingVerbose);
+
+    while(true)
+    {
+        bool shouldStop = ctx.writerShouldStop; // checked before draining, so that the last records are not lost
+        unsigned int read = ctx.ringRead.load(std::memory_order_relaxed);
+        unsigned int write = ctx.ringWrite.load(std::memory_order_acquire);
+
+        while(read != write)
+        {
+            // write as many contiguous records as possible at once
+            unsigned int idx = read % INPUTS_RECORDING_RING_PERIODS;
+            unsigned int count = write - read;
+            if(idx + count > INPUTS_RECORDING_RING_PERIODS)
+                count = INPUTS_RECORDING_RING_PERIODS - idx;
+            if(fwrite(ctx.ring + idx*ctx.header.recordBytes, ctx.header.recordBytes, count, ctx.recFile) != count)
+            {
+                fprintf(stderr, "Error! Cannot write inputs recording file: %s, recording stopped\n", strerror(errno));
+                ctx.writeFailed = true; // audio thread stops filling the ring
+                return (void *)0;
+            }
+            read += count;
+            ctx.ringRead.store(read, std::memory_order_release);
+        }
+
+        if(shouldStop)
+            break;
+        usleep(10000);
+    }
+    if(fflush(ctx.recFile) != 0)
+    {
+        fprintf(stderr, "Error! Cannot write inputs recording file: %s, last periods are missing\n", strerror(errno));
+        ctx.writeFailed = true;
+    }
+
+    return (void *)0;
+}
@@ -7,6 +7,7 @@
 #include "commandLineArgs.h"
 #include "mixer.h"
 #include "ctrlOutputs.h"
+#include "startup.h"
 
 // defined in root's CMakeLists.txt
 #ifdef PROJECT_NAME
@@ -59,37 +60,11 @@ int main(int argc, char** argv)
 		fprintf(stderr, "Error: unable to parse hardwar configuration file\n");
 	}
 
-	if(LDSP_setMixerPaths(settings, hwconfig) < 0)
+	// mixer paths, audio, sensors and control inputs/outputs
+	if(LDSP_initEngine(settings, hwconfig) < 0)
 	{
 		LDSP_HwConfig_free(hwconfig);
 		LDSP_InitSettings_free(settings);
-		fprintf(stderr, "Error: unable to set mixer paths\n");
-		return 1;
-	}
-
-	LDSP_initSensors(settings);
-
-	LDSP_initCtrlInputs(settings);
-
-	if(LDSP_initCtrlOutputs(settings, hwconfig) < 0)
-	{
-		LDSP_resetMixerPaths(hwconfig);
-		LDSP_HwConfig_free(hwconfig);
-		LDSP_cleanupSensors();
-		LDSP_cleanupCtrlInputs();
-		LDSP_InitSettings_free(settings);
-		fprintf(stderr, "Error: unable to intialize control outputs\n");
-		return 1;
-	}
-
-	if(LDSP_initAudio(settings, 0) != 0) 
-	{
-		LDSP_cleanupCtrlOutputs();
-		LDSP_cleanupCtrlInputs();
-		LDSP_cleanupSensors();
-		LDSP_resetMixerPaths(hwconfig);
-		LDSP_HwConfig_free(hwconfig);
-		fprintf(stderr, "Error: unable to initialize audio\n");
 		return 1;
 	}
 
@@ -31,6 +31,15 @@
 
 #include "mixer.h"
 #include "audioDeviceInfo.h"
+#include "probeCache.h"
+#include <unistd.h> // access
+#include <sys/stat.h> // stat
+#include <map> // map
+#include <algorithm> // find
+#include <mutex> // mutex, lock_guard, unique_lock
+#include <condition_variable> // condition_variable
+#include <pthread.h>
+#include <sstream> // stringstream
 #include "libraries/XML/pugixml.hpp"
 
 using std::string;
@@ -45,14 +54,50 @@ bool preserveMixerPaths = false;
 
 mixer *mix = nullptr;
 
+// XML paths are compiled into lists of control settings, with controls referenced by index rather than by name
+// lists are cached across runs and applied writing only the controls whose current value differs
+struct mixerCtlSetting {
+	unsigned int ctl; // index in mixer
+	unsigned int valueId;
+	int value; // enums are stored as index
+	bool reportErrors; // errors in default controls are harmless, see compileDefaultMixerPath()
+};
+typedef vector<mixerCtlSetting> mixerProgram;
+
+mixerProgram defaultProgram; // kept to reset the mixer at cleanup, without parsing the XML again
+bool defaultProgramReady = false;
+
+// current route, needed to switch paths at runtime
+LDSPhwConfig *routeHwconfig = nullptr;
+LDSPinitSettings routeSettings; // copy, original settings are freed once engine is running
+xml_document mixerDocs[2]; // [0] -> mixer paths, [1] -> mixer volumes (optional), parsed at most once
+mixerProgram routePrograms[2]; // [0] -> playback, [1] -> capture
+std::map<unsigned long long, mixerCtlSetting> preservedValues; // with preserved paths, values of route controls before we first set them
+vector<string> primaryActivationCtls;
+string secondaryActivationCtls[2];
+
+// runtime route switching is done on a dedicated thread, so that callers never wait for the mixer
+// it is the only one that writes to the mixer while it runs [it starts after setup and is joined before reset]
+std::mutex routeRequestMutex;
+std::condition_variable routeRequestCond;
+string requestedPaths[2];
+bool routeRequested[2] = {false, false};
+bool routeThreadShouldStop = false;
+pthread_t mixerRoute_thread = 0;
+
 
 int setupDevicesNumAndId(LDSPinitSettings *settings, LDSPhwConfig *hwconfig);
 int mixerCtl_setInt(mixer *mx, const char *name, int val, int id=0, bool verbose=true);
 int mixerCtl_setStr(mixer *mx, const char *name, const char *val, bool verbose=true);
-int setDefaultMixerPath(mixer *mx, xml_document *xml);
 int activateDevice(mixer *mx, LDSPhwConfig *hwconfig, string &deviceActivationCtl, string device_id);
 void deactivateDevice(mixer *mx, string deviceActivationCtl);
-int loadPath(mixer *mx, xml_document *xml, LDSPhwConfig *hwconfig, LDSPinitSettings *settings, string &pathAlias, bool isCapture=false);
+int loadPath(mixer *mx, LDSPhwConfig *hwconfig, LDSPinitSettings *settings, string &pathAlias, string &pathName, string &activationCtl, bool isCapture=false);
+int getMixerProgram(mixer *mx, xml_document *xml, LDSPhwConfig *hwconfig, string pathName, mixerProgram &program);
+void applyMixerPrograms(mixer *mx, vector<mixerProgram *> programs, vector<string> &skipCtls);
+int loadRoute(mixer *mx, string &pathAlias, bool isCapture);
+void applyRoute(mixer *mx);
+void *mixerRoute_loop(void *);
+int requestRoute(string pathAlias, bool isCapture);
 
 
 
@@ -106,32 +151,24 @@ int LDSP_setMixerPaths(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
     }
 	
 
-	// use XML to load paths
-	xml_document mixer_docs[2]; // [0] -> mixer paths, [1] -> mixer volumes (optional)
-   
-    // load the mixer paths XML file
-    if(!mixer_docs[0].load_file(hwconfig->xml_paths_file.c_str()))
-	{
-		LDSP_resetMixerPaths(hwconfig);
-		return -4;
-	}
-	// load the mixer volumes XML file, if present
-	if(!hwconfig->xml_volumes_file.empty())
+	routeHwconfig = hwconfig;
+	routeSettings = *settings; // device ids are set at this point
+
+	// compile default path, unless requested to preserve the current paths
+	// if paths are preservered, more than one alsa device can be routed to the codec at once
+	// XML files are parsed only if the compiled paths are not in the probe cache yet
+	if(!preserveMixerPaths)
 	{
-		if(!mixer_docs[1].load_file(hwconfig->xml_volumes_file.c_str()))
+		if(getMixerProgram(mix, mixerDocs, hwconfig, "", defaultProgram) < 0)
 		{
 			LDSP_resetMixerPaths(hwconfig);
 			return -4;
 		}
-	} 
-		
-
-	// start from loading default paths, unless requested to preserve the current paths
-	// if paths are preservered, more than one alsa device can be routed to the codec at once
-	if(!preserveMixerPaths)
-		setDefaultMixerPath(mix, &mixer_docs[0]);
-
+		defaultProgramReady = true;
+	}
 
+	// activation controls are set right away and are left out of the programs, 
+	// otherwise default values could turn them off again
 	
 	// if necessary, activate devices, i.e., when in config file device activation path is given
 	// secondary activation is checked after path is set, in loadPath()
@@ -142,6 +179,7 @@ int LDSP_setMixerPaths(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 			LDSP_resetMixerPaths(hwconfig);
 			return -5;
 		}
+		primaryActivationCtls.push_back(hwconfig->dev_activation_ctl_p);
 	}
 	if(!settings->captureOff)
 	{
@@ -152,16 +190,19 @@ int LDSP_setMixerPaths(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 				LDSP_resetMixerPaths(hwconfig);
 				return -5;
 			}
+			primaryActivationCtls.push_back(hwconfig->dev_activation_ctl_c);
 		}
 	}
 
-	// set actual playback and capture paths
+	// resolve actual playback and capture paths
 	string pathAlias = settings->pathOut;
-	if(loadPath(mix, mixer_docs, hwconfig, settings, pathAlias)!=0)
+	int res = loadRoute(mix, pathAlias, false);
+	if(res != 0)
 	{
-		fprintf(stderr, "Playback path error\n");
+		if(res == -6)
+			fprintf(stderr, "Playback path error\n");
 		LDSP_resetMixerPaths(hwconfig);
-		return -6;
+		return res;
 	}
 	if(mixerVerbose)
 		printf("Playback path loaded: \"%s\"\n", pathAlias.c_str());
@@ -169,20 +210,28 @@ int LDSP_setMixerPaths(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 	if(!settings->captureOff)
 	{
 		pathAlias = settings->pathIn;
-		if(loadPath(mix, mixer_docs, hwconfig, settings, pathAlias, true)!=0)
+		res = loadRoute(mix, pathAlias, true);
+		if(res != 0)
 		{
-			fprintf(stderr, "Capture path error\n");
+			if(res == -6)
+				fprintf(stderr, "Capture path error\n");
 			LDSP_resetMixerPaths(hwconfig);
-			return -6;
+			return res;
 		}
 		if(mixerVerbose)
 			printf("Capture path loaded: \"%s\"\n", pathAlias.c_str());
 	}
+
+	applyRoute(mix);
+
+	saveProbeCache();
+
+	// from now on, paths can be switched at runtime
+	pthread_create(&mixerRoute_thread, NULL, mixerRoute_loop, NULL);
 	
 	return 0;
 }
 
-
 void LDSP_resetMixerPaths(LDSPhwConfig *hwconfig)
 {
 	if(skipMixerPaths)
@@ -191,12 +240,35 @@ void LDSP_resetMixerPaths(LDSPhwConfig *hwconfig)
 	if(mixerVerbose)
 		printf("LDSP_resetMixerPaths()\n");
 
-	xml_document mixer_docs;
-    if(!preserveMixerPaths && mixer_docs.load_file(hwconfig->xml_paths_file.c_str()))
-		setDefaultMixerPath(mix, &mixer_docs); // deactivates devices too, if necessary on phone
+	// no more route switching
+	if(mixerRoute_thread != 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(routeRequestMutex);
+			routeThreadShouldStop = true;
+		}
+		routeRequestCond.notify_one();
+		pthread_join(mixerRoute_thread, NULL);
+		mixerRoute_thread = 0;
+	}
+
+	// deactivates devices too, if necessary on phone
+	if(!preserveMixerPaths && mix != nullptr)
+	{
+		if(!defaultProgramReady)
+			defaultProgramReady = (getMixerProgram(mix, mixerDocs, hwconfig, "", defaultProgram) == 0);
+		if(defaultProgramReady)
+		{
+			vector<mixerProgram *> programs = {&defaultProgram};
+			vector<string> noSkip;
+			applyMixerPrograms(mix, programs, noSkip);
+		}
+	}
 
 	if (mix != nullptr) 
 		mixer_close(mix);
+	mix = nullptr;
+	preservedValues.clear();
 }
 
 //----------------------------------------------------------------------------------
@@ -251,7 +323,43 @@ int findDeviceInfo(vector<string> deviceInfoPath, string match_a, string name, s
 	return -2;
 }
 
-int setupDeviceNumAndId(vector<string> deviceInfoPath, int &deviceNum, int defaultNum, string &deviceId, string defaultId)
+// only the embedded card is cached, external cards can be swapped between runs
+bool getCachedDeviceInfo(int card, bool is_playback, string key, string &value, int &deviceNum)
+{
+	if(card != 0)
+		return false;
+
+	string cacheKey = "card"+to_string(card)+".pcm"+(is_playback ? "p" : "c")+"."+key;
+	string cached;
+	if(!probeCacheGet(cacheKey, cached))
+		return false;
+
+	// the cached entry has the form "number id"
+	size_t pos = cached.find(' ');
+	if(pos == string::npos)
+		return false;
+	int num = atoi(cached.substr(0, pos).c_str());
+
+	// cheap check, the device must still be there
+	if(access(getDeviceInfoPath(card, num, "info", is_playback).c_str(), F_OK) != 0)
+	{
+		probeCacheRemove(cacheKey);
+		return false;
+	}
+	deviceNum = num;
+	value = cached.substr(pos+1);
+	return true;
+}
+
+void setCachedDeviceInfo(int card, bool is_playback, string key, int deviceNum, string deviceId)
+{
+	if(card != 0)
+		return;
+	string cacheKey = "card"+to_string(card)+".pcm"+(is_playback ? "p" : "c")+"."+key;
+	probeCacheSet(cacheKey, to_string(deviceNum)+" "+deviceId);
+}
+
+int setupDeviceNumAndId(int card, bool is_playback, vector<string> &deviceInfoPath_p, vector<string> &deviceInfoPath_c, int &deviceNum, int defaultNum, string &deviceId, string defaultId)
 {
 	// device id has priority!
 	// but device number is always set, at least as a default value
@@ -262,6 +370,22 @@ int setupDeviceNumAndId(vector<string> deviceInfoPath, int &deviceNum, int defau
 	if(deviceNum == -1)
 		deviceNum = defaultNum; // the config file may not include a default id, in which case the value is set to 0 [check LDSP_HwConfig_alloc()]
 
+	// try the results of previous runs first
+	string cacheKey = (deviceId!="") ? "id:"+deviceId : "num:"+to_string(deviceNum);
+	string cachedId;
+	int cachedNum;
+	if(getCachedDeviceInfo(card, is_playback, cacheKey, cachedId, cachedNum))
+	{
+		deviceNum = cachedNum;
+		deviceId = cachedId;
+		return 0;
+	}
+
+	// get the paths to the info files of all devices, only once
+	if(deviceInfoPath_p.empty() && deviceInfoPath_c.empty())
+		getDeviceInfoPaths(card, "info", deviceInfoPath_p, deviceInfoPath_c);
+	vector<string> &deviceInfoPath = is_playback ? deviceInfoPath_p : deviceInfoPath_c;
+
 	// if device is set by id, adjust number accordingly
 	if(deviceId!="")
 	{
@@ -285,6 +409,8 @@ int setupDeviceNumAndId(vector<string> deviceInfoPath, int &deviceNum, int defau
 			id = id.substr(0, len-3);
 		deviceId = id;
 	}
+
+	setCachedDeviceInfo(card, is_playback, cacheKey, deviceNum, deviceId);
 	
 	return 0;
 }
@@ -295,8 +421,8 @@ int setupDevicesNumAndId(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 	vector<string> deviceInfoPath_p;
 	vector<string> deviceInfoPath_c;
 
-	// get the paths to the info files of all devices 
-	getDeviceInfoPaths(settings->card, "info", deviceInfoPath_p, deviceInfoPath_c);
+	// the paths to the info files of all devices are retrieved only if the probe cache cannot help
+	initProbeCache(settings);
 
 	// if using an external card, we force the default device numbers to 0
 	// because what we read from the hw config file applies to the embedded card only
@@ -314,16 +440,18 @@ int setupDevicesNumAndId(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 	}
 
 	// playback
-	if(setupDeviceNumAndId(deviceInfoPath_p, settings->deviceOutNum, defaultDevNum_p, settings->deviceOutId, hwconfig->default_dev_id_p)!=0)
+	if(setupDeviceNumAndId(settings->card, true, deviceInfoPath_p, deviceInfoPath_c, settings->deviceOutNum, defaultDevNum_p, settings->deviceOutId, hwconfig->default_dev_id_p)!=0)
 		return -1;
 
 	if(!settings->captureOff)
 	{
 		// capture
-		if(setupDeviceNumAndId(deviceInfoPath_c, settings->deviceInNum, defaultDevNum_c, settings->deviceInId, hwconfig->default_dev_id_c)!=0)
+		if(setupDeviceNumAndId(settings->card, false, deviceInfoPath_p, deviceInfoPath_c, settings->deviceInNum, defaultDevNum_c, settings->deviceInId, hwconfig->default_dev_id_c)!=0)
 			return -1;
 	}
 
+	saveProbeCache();
+
 	return 0;
 }
 
@@ -349,55 +477,6 @@ int mixerCtl_setStr(mixer *mx, const char *name, const char *val, bool verbose)
 	return ret;
 }
 
-int setCtlFromXmlNode(mixer *mx, xml_node ctl_node, bool verbose)
-{
-	int ret = 0;
-
-	string name = ctl_node.attribute("name").value();
-
-	struct mixer_ctl *ctl = mixer_get_ctl_by_name(mx, name.c_str());
-	mixer_ctl_type ctlType  = mixer_ctl_get_type(ctl);
-	
-	string value = ctl_node.attribute("value").value();
-	
-	//VIC not sure why, but these are not recognized as mixer enums
-	if(value.compare("On") == 0)
-		value = "1";
-	else if(value.compare("Off") == 0)
-		value = "0";
-
-	if(isdigit(value.c_str()[0]))
-	{
-		// set everything else as int
-		int id = 0;
-		// not all nodes have a declared id
-		if(!ctl_node.attribute("id").empty()) 
-			id = ctl_node.attribute("id").as_int();
-		int intValue = atoi(value.c_str());//ctl_node.attribute("value").as_int();
-		ret += mixerCtl_setInt(mx, name.c_str(), intValue, id, verbose);
-	}
-	else //if(ctlType==MIXER_CTL_TYPE_ENUM)
-		ret += mixerCtl_setStr(mx, name.c_str(), value.c_str(), verbose);
-		
-	return ret;
-}
-
-int setDefaultMixerPath(mixer *mx, xml_document *xml)
-{
-	// default path is defined as a series of controls laid out at the beginning of the mixer file
-	// as 'ctl' nodes inside the 'mixer' node
-	int ret = 0;
-	for(xml_node ctl_node: xml->child("mixer").children("ctl"))
-	{
-		//VIC some of these controls will not work and the mixer will output some errors
-		// but we don't care, this is vendor's problem and is harmless to us!
-		// and this is why error messages from mixerCtl_set functions are disabled here [false argument]!
-		ret += setCtlFromXmlNode(mx, ctl_node, false);
-	}
-
-	return ret;	
-}
-
 // first completes device activation control string and then activates device
 int activateDevice(mixer *mx, LDSPhwConfig *hwconfig, string &deviceActivationCtl, string device_id)
 {
@@ -430,59 +509,6 @@ void deactivateDevice(mixer *mx, string deviceActivationCtl)
 	mixerCtl_setInt(mx, deviceActivationCtl.c_str(), 0);
 }
 
-int setPath(mixer *mx, xml_document *xml, string pathName, LDSPhwConfig *hwconfig, bool volumesPath=false) 
-{
-	int ret = 0;
-
-	bool path_found =false;
-	xml_node path;
-	// first search for the requested path 
-	for(xml_node path_node: xml->child("mixer").children("path"))
-	{
-		string pathNode_name = path_node.attribute("name").as_string();
-		if(pathName.compare(pathNode_name) == 0)
-		{
-			path_found = true;
-			path = path_node;
-			break;
-		}		
-	}
-
-	if(!path_found)
-	{
-		// if we are trying to set a volume path, it is possible that the current mixer path is not associated to any volume settings
-		if(volumesPath)
-			return 0;
-		
-		fprintf(stderr, "Cannot find path \"%s\" in xml file %s\n", pathName.c_str(), hwconfig->xml_paths_file.c_str());
-        return -1;
-	}
-
-	// then go through all its children nodes
-	for(xml_node inner_node = path.first_child(); inner_node; inner_node = inner_node.next_sibling())
-	{
-		string nodeName = inner_node.name();
-		// if it's a ctl, set it!
-		if(nodeName.compare("ctl") == 0)
-			ret += setCtlFromXmlNode(mx, inner_node, true);
-		
-		// if it's a path, search for its definiteion and set all ctls in it!
-		else if(nodeName.compare("path") == 0)
-			ret += setPath(mx, xml, inner_node.attribute("name").value(), hwconfig, volumesPath); 
-		else
-		{
-			string file = hwconfig->xml_paths_file;
-			if(volumesPath)
-				file = hwconfig->xml_volumes_file;
-			fprintf(stderr, "XML file \"%s\" not well formatted! Unknown node %s\n", file.c_str(), nodeName.c_str());
-        	return -2;
-		}
-	}
-		
-	return ret;
-}
-
-
 int secondaryDeviceActivation(mixer *mx, string pathName, string secondPath, string device, string devActCtl, string devActCtl2, LDSPhwConfig *hwconfig)
 {
 	// if there is a secondary device activation control, we should activate the device that matches the mixer path
@@ -516,7 +542,8 @@ int secondaryDeviceActivation(mixer *mx, string pathName, string secondPath, str
 	return 0;
 }
 
-int loadPath(mixer *mx, xml_document *xml, LDSPhwConfig *hwconfig, LDSPinitSettings *settings, string &pathAlias, bool isCapture)
+// resolves path name from alias and takes care of secondary device activation, path controls are set by the caller
+int loadPath(mixer *mx, LDSPhwConfig *hwconfig, LDSPinitSettings *settings, string &pathAlias, string &pathName, string &activationCtl, bool isCapture)
 {
 	unordered_map<string, string> paths;
 	unordered_map<string, int> paths_order;
@@ -536,7 +563,6 @@ int loadPath(mixer *mx, xml_document *xml, LDSPhwConfig *hwconfig, LDSPinitSetti
 	}
 
 	int pathIndex;
-	string pathName;
 	if(!pathAlias.empty())
 	{
 		// search name to which this alias is associated
@@ -584,20 +610,459 @@ int loadPath(mixer *mx, xml_document *xml, LDSPhwConfig *hwconfig, LDSPinitSetti
 	{
 		if(activateDevice(mx, hwconfig, devActCtl2, deviceId) < 0)
 			return -5;
+		activationCtl = devActCtl2;
 	}
 
-	// set the chosen mixer path
-	xml_document *xml_paths = &xml[0];
-	if(setPath(mx, xml_paths, pathName, hwconfig)!=0)
-		printf("Trying to move forward despite mixer issues...\n");// 	return -2;
-		//VIC some mixer errors are not catastrophic, we can try going forward...
+	return 0;
+}
+
+//----------------------------------------------------------------------------------
+
+unordered_map<string, unsigned int> mixerCtlIndices; // name -> index, built only when XML needs to be compiled
+unsigned int mixerSignature = 0;
 
-	if(!xml[1].empty())
+// FNV-1a, stable across runs and builds
+unsigned int hashMixerString(const string &str, unsigned int hash=2166136261u)
+{
+	for(unsigned char c : str)
+	{
+		hash ^= c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// changes if XML files or mixer controls change, e.g., when the hw config file points to a different XML file
+unsigned int getMixerSignature(mixer *mx, LDSPhwConfig *hwconfig)
+{
+	if(mixerSignature != 0)
+		return mixerSignature;
+
+	string signature = "ctls:"+to_string(mixer_get_num_ctls(mx));
+	for(string file : {hwconfig->xml_paths_file, hwconfig->xml_volumes_file})
+	{
+		struct stat fileStat;
+		if(!file.empty() && stat(file.c_str(), &fileStat) == 0)
+			signature += "|"+file+":"+to_string(fileStat.st_size)+":"+to_string(fileStat.st_mtime);
+	}
+	mixerSignature = hashMixerString(signature);
+	return mixerSignature;
+}
+
+unsigned int hashMixerProgramCtls(mixer *mx, mixerProgram &program)
+{
+	unsigned int hash = 2166136261u;
+	for(auto &setting : program)
+		hash = hashMixerString(mixer_ctl_get_name(mixer_get_ctl(mx, setting.ctl)), hash);
+	return hash;
+}
+
+// cached form is: signature, hash of control names, then one "ctl:valueId:value:reportErrors" entry per setting
+string serializeMixerProgram(mixer *mx, LDSPhwConfig *hwconfig, mixerProgram &program)
+{
+	string serialized = to_string(getMixerSignature(mx, hwconfig))+" "+to_string(hashMixerProgramCtls(mx, program));
+	for(auto &setting : program)
+		serialized += " "+to_string(setting.ctl)+":"+to_string(setting.valueId)+":"+to_string(setting.value)+":"+to_string(setting.reportErrors);
+	return serialized;
+}
+
+bool parseMixerProgram(mixer *mx, LDSPhwConfig *hwconfig, string serialized, mixerProgram &program)
+{
+	std::stringstream stream(serialized);
+	unsigned int signature, ctlsHash;
+	if(!(stream >> signature >> ctlsHash) || signature != getMixerSignature(mx, hwconfig))
+		return false;
+
+	unsigned int numCtls = mixer_get_num_ctls(mx);
+	program.clear();
+	string entry;
+	while(stream >> entry)
 	{
-		// set the associated volume path
-		xml_document *xml_volumes = &xml[1];
-		setPath(mx, xml_volumes, pathName, hwconfig, true); // no check here, because the chosen mixer path may not be associated with any volume settings
+		mixerCtlSetting setting;
+		int reportErrors;
+		if(sscanf(entry.c_str(), "%u:%u:%d:%d", &setting.ctl, &setting.valueId, &setting.value, &reportErrors) != 4 || setting.ctl >= numCtls)
+			return false;
+		setting.reportErrors = reportErrors;
+		program.push_back(setting);
 	}
 
+	// indices must still point to the same controls
+	return (hashMixerProgramCtls(mx, program) == ctlsHash);
+}
+
+int loadMixerXml(xml_document *xml, LDSPhwConfig *hwconfig)
+{
+	// load the mixer paths XML file
+	if(xml[0].empty() && !xml[0].load_file(hwconfig->xml_paths_file.c_str()))
+		return -1;
+	// load the mixer volumes XML file, if present
+	if(!hwconfig->xml_volumes_file.empty() && xml[1].empty())
+	{
+		if(!xml[1].load_file(hwconfig->xml_volumes_file.c_str()))
+			return -1;
+	}
 	return 0;
-}
\ No newline at end of file
+}
+
+int compileCtlFromXmlNode(mixer *mx, xml_node ctl_node, mixerProgram &program, bool reportErrors)
+{
+	string name = ctl_node.attribute("name").value();
+	string value = ctl_node.attribute("value").value();
+
+	//VIC not sure why, but these are not recognized as mixer enums
+	if(value.compare("On") == 0)
+		value = "1";
+	else if(value.compare("Off") == 0)
+		value = "0";
+
+	auto it = mixerCtlIndices.find(name);
+	if(it == mixerCtlIndices.end())
+	{
+		if(reportErrors)
+			fprintf(stderr, "Mixer: Failed to set %s to %s\n", name.c_str(), value.c_str());
+		return -1;
+	}
+	struct mixer_ctl *ctl = mixer_get_ctl(mx, it->second);
+
+	mixerCtlSetting setting = {it->second, 0, 0, reportErrors};
+	if(isdigit(value.c_str()[0]))
+	{
+		// set everything else as int
+		// not all nodes have a declared id
+		if(!ctl_node.attribute("id").empty()) 
+			setting.valueId = ctl_node.attribute("id").as_int();
+		setting.value = atoi(value.c_str());
+		if(mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_BOOL)
+			setting.value = (setting.value != 0); // same as what we read back
+	}
+	else
+	{
+		// enum, passed as string, stored as index
+		setting.value = -1;
+		if(mixer_ctl_get_type(ctl) == MIXER_CTL_TYPE_ENUM)
+		{
+			for(unsigned int i=0; i<mixer_ctl_get_num_enums(ctl); i++)
+			{
+				if(value.compare(mixer_ctl_get_enum_string(ctl, i)) == 0)
+				{
+					setting.value = i;
+					break;
+				}
+			}
+		}
+		if(setting.value == -1)
+		{
+			if(reportErrors)
+				fprintf(stderr, "Mixer: Failed to set %s to %s\n", name.c_str(), value.c_str());
+			return -1;
+		}
+	}
+
+	program.push_back(setting);
+	return 0;
+}
+
+int compileDefaultMixerPath(mixer *mx, xml_document *xml, mixerProgram &program)
+{
+	// default path is defined as a series of controls laid out at the beginning of the mixer file
+	// as 'ctl' nodes inside the 'mixer' node
+	for(xml_node ctl_node: xml->child("mixer").children("ctl"))
+	{
+		//VIC some of these controls will not work and the mixer will output some errors
+		// but we don't care, this is vendor's problem and is harmless to us!
+		// and this is why error messages are disabled here [false argument]!
+		compileCtlFromXmlNode(mx, ctl_node, program, false);
+	}
+
+	return 0;	
+}
+
+int compilePath(mixer *mx, xml_document *xml, string pathName, LDSPhwConfig *hwconfig, mixerProgram &program, bool volumesPath=false) 
+{
+	int ret = 0;
+
+	bool path_found =false;
+	xml_node path;
+	// first search for the requested path 
+	for(xml_node path_node: xml->child("mixer").children("path"))
+	{
+		string pathNode_name = path_node.attribute("name").as_string();
+		if(pathName.compare(pathNode_name) == 0)
+		{
+			path_found = true;
+			path = path_node;
+			break;
+		}		
+	}
+
+	if(!path_found)
+	{
+		// if we are trying to set a volume path, it is possible that the current mixer path is not associated to any volume settings
+		if(volumesPath)
+			return 0;
+		
+		fprintf(stderr, "Cannot find path \"%s\" in xml file %s\n", pathName.c_str(), hwconfig->xml_paths_file.c_str());
+        return -1;
+	}
+
+	// then go through all its children nodes
+	for(xml_node inner_node = path.first_child(); inner_node; inner_node = inner_node.next_sibling())
+	{
+		string nodeName = inner_node.name();
+		// if it's a ctl, add it!
+		if(nodeName.compare("ctl") == 0)
+			ret += compileCtlFromXmlNode(mx, inner_node, program, true);
+		
+		// if it's a path, search for its definiteion and add all ctls in it!
+		else if(nodeName.compare("path") == 0)
+			ret += compilePath(mx, xml, inner_node.attribute("name").value(), hwconfig, program, volumesPath); 
+		else
+		{
+			string file = hwconfig->xml_paths_file;
+			if(volumesPath)
+				file = hwconfig->xml_volumes_file;
+			fprintf(stderr, "XML file \"%s\" not well formatted! Unknown node %s\n", file.c_str(), nodeName.c_str());
+        	return -2;
+		}
+	}
+		
+	return ret;
+}
+
+// empty path name means default path
+// returns -1 if XML files cannot be loaded, -2 if the path has errors
+int getMixerProgram(mixer *mx, xml_document *xml, LDSPhwConfig *hwconfig, string pathName, mixerProgram &program)
+{
+	string cacheKey = pathName.empty() ? "mixer.default" : "mixer.path."+pathName;
+	string cached;
+	if(probeCacheGet(cacheKey, cached) && parseMixerProgram(mx, hwconfig, cached, program))
+		return 0;
+
+	if(loadMixerXml(xml, hwconfig) < 0)
+		return -1;
+
+	if(mixerCtlIndices.empty())
+	{
+		// same as mixer_get_ctl_by_name(), first control with a given name wins
+		unsigned int numCtls = mixer_get_num_ctls(mx);
+		for(unsigned int i=0; i<numCtls; i++)
+			mixerCtlIndices.emplace(mixer_ctl_get_name(mixer_get_ctl(mx, i)), i);
+	}
+
+	program.clear();
+	int ret;
+	if(pathName.empty())
+		ret = compileDefaultMixerPath(mx, &xml[0], program);
+	else
+	{
+		ret = compilePath(mx, &xml[0], pathName, hwconfig, program);
+		// add the associated volume path
+		if(!xml[1].empty())
+			compilePath(mx, &xml[1], pathName, hwconfig, program, true); // no check here, because the chosen mixer path may not be associated with any volume settings
+	}
+	if(ret != 0)
+		return -2; // not cached, so that errors are reported again next time
+
+	probeCacheSet(cacheKey, serializeMixerProgram(mx, hwconfig, program));
+	return 0;
+}
+
+// merges programs [later ones win] and writes only the controls that are not set already
+// controls are written in index order, like Android's audio route does
+void applyMixerPrograms(mixer *mx, vector<mixerProgram *> programs, vector<string> &skipCtls)
+{
+	std::map<unsigned long long, mixerCtlSetting> state;
+	for(auto program : programs)
+	{
+		for(auto &setting : *program)
+			state[((unsigned long long)setting.ctl << 32) | setting.valueId] = setting;
+	}
+
+	vector<struct mixer_ctl *> skip;
+	for(auto &name : skipCtls)
+		skip.push_back(mixer_get_ctl_by_name(mx, name.c_str()));
+
+	int written = 0;
+	int unchanged = 0;
+	for(auto &entry : state)
+	{
+		mixerCtlSetting &setting = entry.second;
+		struct mixer_ctl *ctl = mixer_get_ctl(mx, setting.ctl);
+		if(std::find(skip.begin(), skip.end(), ctl) != skip.end())
+			continue;
+
+		if(mixer_ctl_get_value(ctl, setting.valueId) == setting.value)
+		{
+			unchanged++;
+			continue;
+		}
+		if(mixer_ctl_set_value(ctl, setting.valueId, setting.value) != 0 && setting.reportErrors)
+			fprintf(stderr, "Mixer: Failed to set %s to %d\n", mixer_ctl_get_name(ctl), setting.value);
+		written++;
+	}
+
+	if(mixerVerbose)
+		printf("Mixer: %d controls written, %d already set\n", written, unchanged);
+}
+
+//----------------------------------------------------------------------------------
+
+// resolves path and compiles its controls, but does not apply them
+// returns -6 if path alias cannot be loaded, -4 if XML files cannot be loaded
+int loadRoute(mixer *mx, string &pathAlias, bool isCapture)
+{
+	int dir = isCapture ? 1 : 0;
+	string pathName;
+	string activationCtl;
+
+	// the secondary activation of the previous path is turned off before the new path activates its own
+	// unless it is also a primary activation control, that must stay on
+	string oldActivationCtl = secondaryActivationCtls[dir];
+	bool deactivated = false;
+	if(!oldActivationCtl.empty() && std::find(primaryActivationCtls.begin(), primaryActivationCtls.end(), oldActivationCtl) == primaryActivationCtls.end())
+	{
+		deactivateDevice(mx, oldActivationCtl);
+		deactivated = true;
+	}
+
+	if(loadPath(mx, routeHwconfig, &routeSettings, pathAlias, pathName, activationCtl, isCapture)!=0)
+	{
+		// previous path stays in place
+		if(deactivated)
+			mixerCtl_setInt(mx, oldActivationCtl.c_str(), 1);
+		return -6;
+	}
+	secondaryActivationCtls[dir] = activationCtl;
+
+	mixerProgram program;
+	if(!pathName.empty())
+	{
+		int res = getMixerProgram(mx, mixerDocs, routeHwconfig, pathName, program);
+		if(res == -1)
+			return -4;
+		if(res < 0)
+			printf("Trying to move forward despite mixer issues...\n");
+			//VIC some mixer errors are not catastrophic, we can try going forward...
+	}
+	routePrograms[dir] = program;
+
+	return 0;
+}
+
+// defaults first, then paths on top of them
+// when switching, controls of the previous path that the new one does not set go back to their default
+// with preserved paths there is no default program, so they go back to the value they had before we first set them
+void applyRoute(mixer *mx)
+{
+	vector<mixerProgram *> programs;
+	mixerProgram preservedProgram;
+	if(!preserveMixerPaths)
+		programs.push_back(&defaultProgram);
+	else
+	{
+		for(auto &program : routePrograms)
+		{
+			for(auto &setting : program)
+			{
+				unsigned long long key = ((unsigned long long)setting.ctl << 32) | setting.valueId;
+				if(preservedValues.find(key) != preservedValues.end())
+					continue;
+				mixerCtlSetting preserved = setting;
+				preserved.value = mixer_ctl_get_value(mixer_get_ctl(mx, setting.ctl), setting.valueId);
+				preservedValues[key] = preserved;
+			}
+		}
+		for(auto &entry : preservedValues)
+			preservedProgram.push_back(entry.second);
+		programs.push_back(&preservedProgram);
+	}
+	programs.push_back(&routePrograms[0]);
+	programs.push_back(&routePrograms[1]);
+
+	vector<string> activationCtls = primaryActivationCtls;
+	for(auto &ctl : secondaryActivationCtls)
+	{
+		if(!ctl.empty())
+			activationCtls.push_back(ctl);
+	}
+
+	applyMixerPrograms(mx, programs, activationCtls);
+}
+
+void *mixerRoute_loop(void *)
+{
+	while(true)
+	{
+		string paths[2];
+		bool requested[2];
+		{
+			std::unique_lock<std::mutex> lock(routeRequestMutex);
+			routeRequestCond.wait(lock, []{ return routeThreadShouldStop || routeRequested[0] || routeRequested[1]; });
+			if(routeThreadShouldStop)
+				break;
+			// only the latest request per direction matters
+			for(int dir=0; dir<2; dir++)
+			{
+				paths[dir] = requestedPaths[dir];
+				requested[dir] = routeRequested[dir];
+				routeRequested[dir] = false;
+			}
+		}
+
+		for(int dir=0; dir<2; dir++)
+		{
+			if(!requested[dir])
+				continue;
+			string type = (dir==0) ? "Playback" : "Capture";
+			if(loadRoute(mix, paths[dir], dir==1) != 0)
+				fprintf(stderr, "%s path error, could not switch to \"%s\"\n", type.c_str(), paths[dir].c_str());
+			else if(mixerVerbose)
+				printf("%s path switched to: \"%s\"\n", type.c_str(), paths[dir].c_str());
+		}
+		applyRoute(mix);
+		saveProbeCache(); // in case new paths were compiled
+	}
+
+	return (void *)0;
+}
+
+int requestRoute(string pathAlias, bool isCapture)
+{
+	if(mixerRoute_thread == 0)
+	{
+		fprintf(stderr, "Mixer paths cannot be switched, mixer was not set\n");
+		return -1;
+	}
+	if(isCapture && routeSettings.captureOff)
+	{
+		fprintf(stderr, "Capture path cannot be switched, capture is off\n");
+		return -1;
+	}
+
+	// check alias right away, so that caller knows
+	unordered_map<string, string> &paths = isCapture ? routeHwconfig->paths_c : routeHwconfig->paths_p;
+	if(paths.find(pathAlias) == paths.end())
+	{
+		fprintf(stderr, "Cannot find path alias \"%s\" in config file %s\n", pathAlias.c_str(), routeHwconfig->hw_confg_file.c_str());
+		return -1;
+	}
+
+	int dir = isCapture ? 1 : 0;
+	{
+		std::lock_guard<std::mutex> lock(routeRequestMutex);
+		requestedPaths[dir] = pathAlias;
+		routeRequested[dir] = true;
+	}
+	routeRequestCond.notify_one();
+	return 0;
+}
+
+int mixerSetOutputPath(string pathAlias)
+{
+	return requestRoute(pathAlias, false);
+}
+
+int mixerSetInputPath(string pathAlias)
+{
+	return requestRoute(pathAlias, true);
+}
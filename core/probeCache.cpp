@@ -0,0 +1,173 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fstream> // files
+#include <map> // map
+#include <mutex> // mutex, lock_guard
+#include <sys/utsname.h> // uname
+#include <sys/system_properties.h> // __system_property_get
+
+#include "probeCache.h"
+
+using std::ifstream;
+using std::ofstream;
+
+#define PROBE_CACHE_FINGERPRINT_KEY "fingerprint"
+
+bool probeCacheVerbose = false;
+bool probeCacheOff = false;
+bool probeCacheLoaded = false;
+bool probeCacheDirty = false;
+
+string probeCacheFingerprint;
+std::map<string, string> probeCacheEntries; // ordered, so that file is easy to read
+std::mutex probeCacheMutex; // devices are probed in parallel at startup
+
+string getPhoneFingerprint();
+
+
+void initProbeCache(LDSPinitSettings *settings)
+{
+    std::lock_guard<std::mutex> lock(probeCacheMutex);
+
+    if(probeCacheLoaded)
+        return;
+    probeCacheLoaded = true;
+
+    probeCacheVerbose = settings->verbose;
+    probeCacheOff = settings->probeCacheOff;
+    if(probeCacheOff)
+        return;
+
+    probeCacheFingerprint = getPhoneFingerprint();
+
+    ifstream cacheFile(PROBE_CACHE_FILE);
+    if(!cacheFile.is_open())
+        return; // first run, nothing to load
+
+    // one key=value pair per line, first one is the fingerprint
+    string line;
+    bool valid = false;
+    while(getline(cacheFile, line))
+    {
+        size_t pos = line.find('=');
+        if(pos == string::npos)
+            continue;
+        string key = line.substr(0, pos);
+        string value = line.substr(pos+1);
+        if(!valid)
+        {
+            // cache was created on a different system or kernel, ignore it all
+            if(key != PROBE_CACHE_FINGERPRINT_KEY || value != probeCacheFingerprint)
+                break;
+            valid = true;
+            continue;
+        }
+        probeCacheEntries[key] = value;
+    }
+    cacheFile.close();
+
+    if(!valid)
+    {
+        probeCacheEntries.clear();
+        probeCacheDirty = true; // will overwrite stale file
+        if(probeCacheVerbose)
+            printf("Probe cache outdated, probing devices again\n");
+    }
+    else if(probeCacheVerbose)
+        printf("Probe cache loaded from %s\n", PROBE_CACHE_FILE);
+}
+
+bool probeCacheGet(string key, string &value)
+{
+    std::lock_guard<std::mutex> lock(probeCacheMutex);
+
+    if(probeCacheOff)
+        return false;
+
+    auto it = probeCacheEntries.find(key);
+    if(it == probeCacheEntries.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+void probeCacheSet(string key, string value)
+{
+    std::lock_guard<std::mutex> lock(probeCacheMutex);
+
+    if(probeCacheOff)
+        return;
+
+    auto it = probeCacheEntries.find(key);
+    if(it != probeCacheEntries.end() && it->second == value)
+        return;
+    probeCacheEntries[key] = value;
+    probeCacheDirty = true;
+}
+
+void probeCacheRemove(string key)
+{
+    std::lock_guard<std::mutex> lock(probeCacheMutex);
+
+    if(probeCacheEntries.erase(key) > 0)
+        probeCacheDirty = true;
+}
+
+void saveProbeCache()
+{
+    std::lock_guard<std::mutex> lock(probeCacheMutex);
+
+    if(probeCacheOff || !probeCacheDirty)
+        return;
+
+    ofstream cacheFile(PROBE_CACHE_FILE);
+    if(!cacheFile.is_open())
+    {
+        // not a problem, we will simply probe again next time
+        if(probeCacheVerbose)
+            printf("Warning! Cannot write probe cache %s\n", PROBE_CACHE_FILE);
+        return;
+    }
+
+    cacheFile << PROBE_CACHE_FINGERPRINT_KEY << "=" << probeCacheFingerprint << "\n";
+    for(auto const& [key, value] : probeCacheEntries)
+        cacheFile << key << "=" << value << "\n";
+    cacheFile.close();
+
+    probeCacheDirty = false;
+}
+
+
+
+//--------------------------------------------------------------------------------------------------
+
+// build fingerprint changes with every system update, kernel release and version with every kernel build
+string getPhoneFingerprint()
+{
+    char buildFingerprint[PROP_VALUE_MAX] = "";
+    __system_property_get("ro.build.fingerprint", buildFingerprint);
+
+    struct utsname kernel;
+    string kernelBuild = "";
+    if(uname(&kernel) == 0)
+        kernelBuild = string(kernel.release) + " " + kernel.version;
+
+    return string(buildFingerprint) + "|" + kernelBuild;
+}
@@ -0,0 +1,392 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio> // printf, fprintf
+
+#include "renderModule.h"
+
+bool renderModuleVerbose = false;
+
+#ifdef LDSP_HOT_RELOAD
+
+#include <atomic>
+#include <cstring> // memset, memcpy, strerror
+#include <fstream> // ifstream, ofstream
+#include <dlfcn.h> // dlopen, dlsym, dlclose
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <unistd.h> // unlink, read, close
+
+#include "thread_utils.h"
+
+using std::string;
+
+extern bool gShouldStop; // extern from tinyalsaAudio.cpp
+
+struct LDSPrenderModuleContext {
+    string file; // the one we watch
+    string dir;
+    string name;
+    unsigned int loadCount = 0;
+
+    // the old module is cleaned up before the new one is set up, so that they never hold the same resources [ports, devices, files]
+    // audio fades out, goes silent while the watcher swaps them, then fades in again
+    renderModule *current = nullptr; // audio thread only, once audio is running, nullptr while silent
+    std::atomic<bool> fadeOutRequested{false}; // new module loaded, waiting for the current one to fade out
+    std::atomic<renderModule *> pending{nullptr}; // set up, waiting to be faded in
+    std::atomic<renderModule *> retired{nullptr}; // faded out, waiting to be cleaned up
+
+    int fadeDir = 0; // audio thread only, -1 fading out, 1 fading in
+    unsigned int fadeFrames = 0;
+    unsigned int fadePos = 0;
+
+    LDSPcontext *context = nullptr;
+    void *userData = nullptr;
+    pthread_t watcherThread = 0;
+};
+
+LDSPrenderModuleContext renderModuleContext;
+
+renderModule *loadRenderModule();
+void unloadRenderModule(renderModule *module, bool cleanup);
+bool swapRenderModules(renderModule *old, renderModule *module);
+void *renderModuleWatcher_loop(void *);
+
+
+int initRenderModule(LDSPinitSettings *settings)
+{
+    renderModuleVerbose = settings->verbose;
+
+    string file = settings->renderModule.empty() ? RENDER_MODULE_DEFAULT_FILE : settings->renderModule;
+    size_t pos = file.rfind('/');
+    renderModuleContext.file = file;
+    renderModuleContext.dir = (pos == string::npos) ? "." : file.substr(0, pos);
+    renderModuleContext.name = (pos == string::npos) ? file : file.substr(pos+1);
+
+    renderModuleContext.current = loadRenderModule();
+    if(renderModuleContext.current == nullptr)
+        return -1;
+
+    if(renderModuleVerbose)
+        printf("Render module loaded from %s\n", file.c_str());
+
+    return 0;
+}
+
+bool renderModuleSetup(LDSPcontext *context, void *userData)
+{
+    renderModuleContext.context = context;
+    renderModuleContext.userData = userData;
+
+    if(!renderModuleContext.current->setup(context, userData))
+        return false;
+
+    renderModuleContext.fadeFrames = (unsigned int)(context->audioSampleRate*RENDER_MODULE_FADE_MS/1000);
+
+    if(pthread_create(&renderModuleContext.watcherThread, NULL, renderModuleWatcher_loop, NULL) != 0)
+    {
+        fprintf(stderr, "Warning! Cannot start render module watcher, hot reload disabled\n");
+        renderModuleContext.watcherThread = 0;
+    }
+
+    return true;
+}
+
+// runs on the audio thread
+void renderModuleRender(LDSPcontext *context, void *userData)
+{
+    LDSPrenderModuleContext &rmc = renderModuleContext;
+
+    // changes happen at period boundaries, never in the middle of a fade
+    if(rmc.fadeDir == 0)
+    {
+        if(rmc.current != nullptr && rmc.fadeOutRequested.exchange(false, std::memory_order_acquire))
+        {
+            rmc.fadeDir = -1;
+            rmc.fadePos = 0;
+        }
+        else if(rmc.current == nullptr)
+        {
+            rmc.current = rmc.pending.exchange(nullptr, std::memory_order_acquire);
+            if(rmc.current != nullptr)
+            {
+                rmc.fadeDir = 1;
+                rmc.fadePos = 0;
+            }
+        }
+    }
+
+    // silence while the watcher swaps modules
+    if(rmc.current == nullptr)
+    {
+        memset(context->audioOut, 0, context->audioFrames*context->audioOutChannels*sizeof(float));
+        return;
+    }
+
+    rmc.current->render(context, userData);
+    if(rmc.fadeDir == 0)
+        return;
+
+    for(unsigned int n=0; n<context->audioFrames; n++)
+    {
+        float gain = (rmc.fadePos+n < rmc.fadeFrames) ? (float)(rmc.fadePos+n)/rmc.fadeFrames : 1;
+        if(rmc.fadeDir < 0)
+            gain = 1-gain;
+        for(unsigned int chn=0; chn<context->audioOutChannels; chn++)
+            context->audioOut[n*context->audioOutChannels + chn] *= gain;
+    }
+
+    rmc.fadePos += context->audioFrames;
+    if(rmc.fadePos >= rmc.fadeFrames)
+    {
+        // cleanup() and dlclose() are not for the audio thread
+        if(rmc.fadeDir < 0)
+        {
+            rmc.retired.store(rmc.current, std::memory_order_release);
+            rmc.current = nullptr;
+        }
+        rmc.fadeDir = 0;
+    }
+}
+
+// audio thread is stopped at this point
+void renderModuleCleanup(LDSPcontext *context, void *userData)
+{
+    LDSPrenderModuleContext &rmc = renderModuleContext;
+
+    if(rmc.watcherThread != 0)
+        pthread_join(rmc.watcherThread, NULL); // stops on gShouldStop
+
+    unloadRenderModule(rmc.pending.exchange(nullptr), true);
+    unloadRenderModule(rmc.retired.exchange(nullptr), true);
+
+    if(rmc.current != nullptr)
+    {
+        rmc.current->cleanup(context, userData);
+        unloadRenderModule(rmc.current, false);
+        rmc.current = nullptr;
+    }
+}
+
+
+
+//--------------------------------------------------------------------------------------------------
+
+// the module is never opened in place, but from a private copy
+// otherwise pushing a new build over the file would change the code that is running
+renderModule *loadRenderModule()
+{
+    LDSPrenderModuleContext &rmc = renderModuleContext;
+
+    string copy = rmc.file+"."+std::to_string(rmc.loadCount++);
+    {
+        std::ifstream src(rmc.file, std::ios::binary);
+        std::ofstream dst(copy, std::ios::binary | std::ios::trunc);
+        if(!src.is_open() || !dst.is_open())
+        {
+            fprintf(stderr, "Cannot copy render module %s to %s\n", rmc.file.c_str(), copy.c_str());
+            return nullptr;
+        }
+        dst << src.rdbuf();
+    }
+
+    void *handle = dlopen(copy.c_str(), RTLD_NOW | RTLD_LOCAL);
+    unlink(copy.c_str()); // stays mapped until dlclose()
+    if(handle == nullptr)
+    {
+        fprintf(stderr, "Cannot load render module %s: %s\n", rmc.file.c_str(), dlerror());
+        return nullptr;
+    }
+
+    renderModule *module = new renderModule;
+    module->handle = handle;
+    module->setup = (renderModule_setup)dlsym(handle, "ldsp_setup");
+    module->render = (renderModule_render)dlsym(handle, "ldsp_render");
+    module->cleanup = (renderModule_cleanup)dlsym(handle, "ldsp_cleanup");
+    module->saveState = (renderModule_saveState)dlsym(handle, "ldsp_saveState");
+    module->restoreState = (renderModule_restoreState)dlsym(handle, "ldsp_restoreState");
+    if(!module->setup || !module->render || !module->cleanup || !module->saveState || !module->restoreState)
+    {
+        fprintf(stderr, "Render module %s does not export LDSP entry points\n", rmc.file.c_str());
+        dlclose(handle);
+        delete module;
+        return nullptr;
+    }
+
+    return module;
+}
+
+void unloadRenderModule(renderModule *module, bool cleanup)
+{
+    if(module == nullptr)
+        return;
+    if(cleanup)
+        module->cleanup(renderModuleContext.context, renderModuleContext.userData);
+    dlclose(module->handle);
+    delete module;
+}
+
+// watches the project dir for new builds of the module and takes care of the modules that are swapped out
+void *renderModuleWatcher_loop(void *)
+{
+    LDSPrenderModuleContext &rmc = renderModuleContext;
+
+    set_niceness(0, "renderModuleWatcher", false);
+
+    int fd = inotify_init(); // inotify_init1() needs API 21
+    if(fd >= 0)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    if(fd < 0 || inotify_add_watch(fd, rmc.dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        fprintf(stderr, "Warning! Cannot watch %s, hot reload disabled: %s\n", rmc.dir.c_str(), strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return (void *)0;
+    }
+
+    bool reloadRequested = false;
+    renderModule *loaded = nullptr; // waiting for the current module to fade out
+    bool active = true; // false if both the new and the old module failed setup
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while(!gShouldStop)
+    {
+        int res = poll(&pfd, 1, 100);
+
+        if(res > 0)
+        {
+            ssize_t len;
+            while((len = read(fd, events, sizeof(events))) > 0)
+            {
+                for(char *ptr = events; ptr < events+len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len)
+                {
+                    struct inotify_event *event = (struct inotify_event *)ptr;
+                    if(event->len > 0 && rmc.name == event->name)
+                        reloadRequested = true;
+                }
+            }
+        }
+        // load only once file has been quiet for a full poll timeout, and previous swap is done
+        else if(reloadRequested && loaded == nullptr && rmc.pending.load(std::memory_order_acquire) == nullptr)
+        {
+            reloadRequested = false;
+            loaded = loadRenderModule();
+            if(loaded != nullptr)
+            {
+                if(active)
+                    rmc.fadeOutRequested.store(true, std::memory_order_release);
+                else
+                {
+                    // nothing to fade out
+                    active = swapRenderModules(nullptr, loaded);
+                    loaded = nullptr;
+                }
+            }
+        }
+
+        // old module has faded out and is not rendering anymore, swap
+        renderModule *old = rmc.retired.exchange(nullptr, std::memory_order_acquire);
+        if(old != nullptr)
+        {
+            active = swapRenderModules(old, loaded);
+            loaded = nullptr;
+        }
+    }
+
+    // loaded, but never set up
+    unloadRenderModule(loaded, false);
+
+    close(fd);
+    return (void *)0;
+}
+
+// state is saved before the old module cleans up and restored once the new one is set up
+// if the new module cannot be set up, the old one is set up again
+// returns false if no module could be set up
+bool swapRenderModules(renderModule *old, renderModule *module)
+{
+    LDSPrenderModuleContext &rmc = renderModuleContext;
+
+    void *state = nullptr;
+    if(old != nullptr)
+    {
+        state = old->saveState(rmc.context, rmc.userData);
+        old->cleanup(rmc.context, rmc.userData);
+    }
+
+    renderModule *next = module;
+    if(!next->setup(rmc.context, rmc.userData))
+    {
+        unloadRenderModule(next, false);
+        next = old;
+        old = nullptr;
+        if(next == nullptr || !next->setup(rmc.context, rmc.userData))
+        {
+            fprintf(stderr, "Setup of reloaded render module failed, audio stays silent until a new build is installed\n");
+            unloadRenderModule(next, false);
+            free(state);
+            return false;
+        }
+        fprintf(stderr, "Setup of reloaded render module failed, going back to the previous one\n");
+    }
+    else if(renderModuleVerbose)
+        printf("Render module reloaded\n");
+
+    if(!next->restoreState(rmc.context, rmc.userData, state))
+        free(state);
+    unloadRenderModule(old, false);
+
+    rmc.pending.store(next, std::memory_order_release);
+    return true;
+}
+
+#else
+
+// regular build, user's code is linked into the executable
+
+int initRenderModule(LDSPinitSettings *settings)
+{
+    renderModuleVerbose = settings->verbose;
+    if(!settings->renderModule.empty())
+        printf("Warning! Render module ignored, this project was not built for hot reload\n");
+    return 0;
+}
+
+bool renderModuleSetup(LDSPcontext *context, void *userData)
+{
+    return setup(context, userData);
+}
+
+void renderModuleRender(LDSPcontext *context, void *userData)
+{
+    render(context, userData);
+}
+
+void renderModuleCleanup(LDSPcontext *context, void *userData)
+{
+    cleanup(context, userData);
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// built into the hot reload render module only [see core/CMakeLists.txt]
+// gives the engine unmangled entry points to the user's code
+
+#include "LDSP.h"
+
+// optional, user code may or may not define them
+void *saveRenderState(LDSPcontext *context, void *userData) __attribute__((weak));
+void restoreRenderState(LDSPcontext *context, void *userData, void *state) __attribute__((weak));
+
+extern "C" {
+
+bool ldsp_setup(LDSPcontext *context, void *userData)
+{
+    return setup(context, userData);
+}
+
+void ldsp_render(LDSPcontext *context, void *userData)
+{
+    render(context, userData);
+}
+
+void ldsp_cleanup(LDSPcontext *context, void *userData)
+{
+    cleanup(context, userData);
+}
+
+void *ldsp_saveState(LDSPcontext *context, void *userData)
+{
+    if(saveRenderState == nullptr)
+        return nullptr;
+    return saveRenderState(context, userData);
+}
+
+// returns false if the state was not taken over
+bool ldsp_restoreState(LDSPcontext *context, void *userData, void *state)
+{
+    if(restoreRenderState == nullptr)
+        return false;
+    restoreRenderState(context, userData, state);
+    return true;
+}
+
+}
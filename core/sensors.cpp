@@ -18,7 +18,8 @@
  */
 
 #include <iostream>
-#include <unistd.h> // for usleep()
+#include <sstream> // for stringstream
+#include <chrono> // for steady_clock
 
 #include "sensors.h"
 #include "LDSP.h"
@@ -32,10 +33,16 @@ extern LDSPinternalContext intContext;
 ASensorManager *sensor_manager;
 ASensorEventQueue *event_queue;
 
-void initSensors();
+#define SENSORS_EVENTS_PER_READ 16
+#define SENSORS_WARMUP_TIMEOUT_MS 500 // on change sensors may never report, so we don't wait for them forever
+
+void initSensorsConfig(LDSPinitSettings *settings, LDSPhwConfig *hwconfig, LDSPsensorConfig *sensorsConfig);
+void initSensors(LDSPsensorConfig *sensorsConfig);
 void initSensorBuffers();
+void warmUpSensors();
+int storeSensorEvent(ASensorEvent &event);
 
-void LDSP_initSensors(LDSPinitSettings *settings)
+void LDSP_initSensors(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
 {
     sensorsVerbose = settings->verbose;
     sensorsOff = settings->sensorsOff;
@@ -45,31 +52,24 @@ void LDSP_initSensors(LDSPinitSettings *settings)
     
     // if sensors are off, we don't init them!
     if(!sensorsOff)
-        initSensors();
+    {
+        LDSPsensorConfig sensorsConfig[LDSP_sensor::count];
+        initSensorsConfig(settings, hwconfig, sensorsConfig);
+        initSensors(sensorsConfig);
+    }
     initSensorBuffers();
     
     // update context
     intContext.sensors = sensorsContext.sensorBuffer;
-    intContext.controlSampleRate = (int)(settings->samplerate / settings->periodSize);
     intContext.sensorChannels = chn_sens_count;
     intContext.sensorsSupported = sensorsContext.sensorSupported;
     intContext.sensorsDetails = sensorsContext.sensorsDetails;
     //VIC user context is reference of this internal one, so no need to update it
 
     // if sensors are off, nothing else to do
+    // otherwise, make sure we have some sensor data once our audio application starts
     if(!sensorsOff)
-    {
-        // read a couple of times, to make sure we have some sensor data once our audio application starts
-        readSensors();
-        usleep(200000); // 200 ms
-        readSensors();
-        // if non full duplex engine, we need to read an extra time, becuase initAudio() will take less time
-        if(settings->captureOff)
-        {
-            usleep(200000); // 200 ms
-            readSensors();
-        }
-    }
+        warmUpSensors();
 }
 
 void LDSP_cleanupSensors()
@@ -82,7 +82,8 @@ void LDSP_cleanupSensors()
     {
         if(sensorsContext.sensors[i].present)
         {
-            ASensorEventQueue_disableSensor(event_queue, sensorsContext.sensors[i].asensor); //VIC on some phones this causes a crash, but its absence does not have any effect
+            if(sensorsContext.sensors[i].enabled)
+                ASensorEventQueue_disableSensor(event_queue, sensorsContext.sensors[i].asensor); //VIC on some phones this causes a crash, but its absence does not have any effect
             // the problem is that if we don't call it, on the same phones sometimes in the next run we cannot activate sensors... and we need to reboot
             // can be done more quickly via: 
             // adb shell am broadcast -a android.intent.action.BOOT_COMPLETED
@@ -117,7 +118,64 @@ void LDSP_cleanupSensors()
 
 //--------------------------------------------------------------------------------------------------
 
-void initSensors()
+// all sensors are enabled at max rate with no batching, unless otherwise specified in hw config file
+// command line settings have precedence over hw config file
+void initSensorsConfig(LDSPinitSettings *settings, LDSPhwConfig *hwconfig, LDSPsensorConfig *sensorsConfig)
+{
+    // temporary map for quick retrieval of sensor index from name
+    unordered_map<string, int> sensor_indices;
+    for(int i=0; i<(int)LDSP_sensor::count; i++)
+    {
+        LDSP_sensor sensor_type = (LDSP_sensor::_enum)LDSP_sensor::_from_index(i);
+        sensor_indices[sensor_type._to_string()] = i;
+    }
+
+    // hw config file
+    for(auto const& [name, sensConfig] : hwconfig->sensors)
+    {
+        if(sensor_indices.find(name) == sensor_indices.end())
+        {
+            fprintf(stderr, "Warning! Unknown sensor \"%s\" in hw config file, ignored\n", name.c_str());
+            continue;
+        }
+        sensorsConfig[sensor_indices[name]] = sensConfig;
+    }
+
+    // command line, list of sensor[:rate[:max report latency]] or sensor:off
+    std::stringstream list(settings->sensorsConfig);
+    string entry;
+    while(getline(list, entry, ','))
+    {
+        if(entry.empty())
+            continue;
+
+        std::stringstream fields(entry);
+        string name;
+        getline(fields, name, ':');
+        if(sensor_indices.find(name) == sensor_indices.end())
+        {
+            fprintf(stderr, "Warning! Unknown sensor \"%s\" passed via command line, ignored\n", name.c_str());
+            continue;
+        }
+        LDSPsensorConfig &sensConfig = sensorsConfig[sensor_indices[name]];
+        sensConfig.enabled = true; // listing a sensor enables it
+
+        string field;
+        if(getline(fields, field, ':'))
+        {
+            if(field == "off")
+            {
+                sensConfig.enabled = false;
+                continue;
+            }
+            sensConfig.rate = atof(field.c_str());
+        }
+        if(getline(fields, field, ':'))
+            sensConfig.maxReportLatency = atof(field.c_str());
+    }
+}
+
+void initSensors(LDSPsensorConfig *sensorsConfig)
 {
 #if __ANDROID_API__ > 25
     // on Android 8 and above [api 26 and above] ASensorManager_getInstance() is deprecated and throws warning
@@ -144,6 +202,10 @@ void initSensors()
         
         sens_struct.numOfChannels = atoi(sensors_channelsInfo[i][0].c_str());
 
+        sens_struct.enabled = false;
+        sens_struct.samplingPeriod = 0;
+        sens_struct.maxReportLatency = 0;
+
         if(sensor == NULL) 
         {
             // skip sensor
@@ -177,13 +239,52 @@ void initSensors()
                 else
                     printf("\t\trate based on data availability\n");
             }
+
+            // unused sensors are not enabled at all, so that they don't wake up the system
+            LDSPsensorConfig &sensConfig = sensorsConfig[i];
+            if(!sensConfig.enabled)
+            {
+                if(sensorsVerbose)
+                    printf("\t\tdisabled\n");
+                continue;
+            }
+            sens_struct.enabled = true;
         
-            ASensorEventQueue_enableSensor(event_queue, sensor);
             // we don't set a rate for sensors that report on new event only, otherwise on some phones we may get crashes
             if(minDelay != 0) 
-                ASensorEventQueue_setEventRate(event_queue, sensor, 100); // symbolic 100 us sampling period... to make sure we request max rate
-            //VIC there is an android API function that is supposed to return the min period supported, ASensor_getMinDelay()
-            // but the doc says its value is often an underestimation: https://developer.android.com/ndk/reference/group/sensor#asensoreventqueue_seteventrate
+            {
+                // symbolic 100 us sampling period by default... to make sure we request max rate
+                sens_struct.samplingPeriod = 100;
+                if(sensConfig.rate > 0)
+                    sens_struct.samplingPeriod = (int)(1000000.0/sensConfig.rate);
+                //VIC there is an android API function that is supposed to return the min period supported, ASensor_getMinDelay()
+                // but the doc says its value is often an underestimation: https://developer.android.com/ndk/reference/group/sensor#asensoreventqueue_seteventrate
+
+                // batching makes sense only if the sensor has a hardware fifo, otherwise events are reported as soon as available
+                if(sensConfig.maxReportLatency > 0 && ASensor_getFifoMaxEventCount(sensor) > 0)
+                    sens_struct.maxReportLatency = (int)(sensConfig.maxReportLatency*1000);
+            }
+
+#if __ANDROID_API__ > 25
+            // on Android 8 and above [api 26 and above] rate and batching can be set in one go
+            if(sens_struct.samplingPeriod != 0)
+                ASensorEventQueue_registerSensor(event_queue, sensor, sens_struct.samplingPeriod, sens_struct.maxReportLatency);
+            else
+                ASensorEventQueue_enableSensor(event_queue, sensor);
+#else
+            ASensorEventQueue_enableSensor(event_queue, sensor);
+            if(sens_struct.samplingPeriod != 0)
+                ASensorEventQueue_setEventRate(event_queue, sensor, sens_struct.samplingPeriod);
+            sens_struct.maxReportLatency = 0; // no batching on older versions
+#endif
+
+            if(sensorsVerbose)
+            {
+                if(sens_struct.samplingPeriod != 0)
+                    printf("\t\trequested sampling period: %d us\n", sens_struct.samplingPeriod);
+                if(sens_struct.maxReportLatency != 0)
+                    printf("\t\tmax report latency: %d us\n", sens_struct.maxReportLatency);
+            }
         }        
     }
 }
@@ -215,7 +316,7 @@ void initSensorBuffers()
             sensorsContext.sensorBuffer[chnCnt] = 0; // this value will never be updated for sensors that are not present
 
             // init state
-            if(sens_struct->present)
+            if(sens_struct->present && sens_struct->enabled)
                 sensorsContext.sensorSupported[chnCnt] = true;
             else
                 sensorsContext.sensorSupported[chnCnt] = false;
@@ -241,54 +342,116 @@ void initSensorBuffers()
     }
 }
 
+// waits for the first event of each sensor that reports at a constant rate, rather than sleeping for a fixed time
+// must be called from the thread that created the event queue, because the looper belongs to it
+void warmUpSensors()
+{
+    bool waitingFor[LDSP_sensor::count];
+    int waiting = 0;
+    for(unsigned int i=0; i<sensorsContext.sensorsCount; i++)
+    {
+        sensor_struct &sens_struct = sensorsContext.sensors[i];
+        waitingFor[i] = (sens_struct.present && sens_struct.enabled && sens_struct.samplingPeriod != 0);
+        if(waitingFor[i])
+            waiting++;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ASensorEvent events[SENSORS_EVENTS_PER_READ];
+    ssize_t numEvents;
+    while(waiting > 0)
+    {
+        int elapsed_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-start).count();
+        if(elapsed_ms >= SENSORS_WARMUP_TIMEOUT_MS)
+            break;
+        // wakes up as soon as the queue has events
+        ALooper_pollOnce(SENSORS_WARMUP_TIMEOUT_MS-elapsed_ms, NULL, NULL, NULL);
+
+        while((numEvents = ASensorEventQueue_getEvents(event_queue, events, SENSORS_EVENTS_PER_READ)) > 0) 
+        {
+            for(int e=0; e<numEvents; e++)
+            {
+                int idx = storeSensorEvent(events[e]);
+                if(waitingFor[idx])
+                {
+                    waitingFor[idx] = false;
+                    waiting--;
+                }
+            }
+        }
+    }
+    // on change sensors that reported already are stored too
+    readSensors();
+
+    if(sensorsVerbose)
+    {
+        int elapsed_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-start).count();
+        if(waiting == 0)
+            printf("Sensors warmed up in %d ms\n", elapsed_ms);
+        else
+            printf("Warning! %d sensors did not report any data within %d ms\n", waiting, SENSORS_WARMUP_TIMEOUT_MS);
+    }
+}
+
 void readSensors()
 {
-    ASensorEvent event;
+    ASensorEvent events[SENSORS_EVENTS_PER_READ];
+    ssize_t numEvents;
     
     // get most current events, if any
-    while(ASensorEventQueue_getEvents(event_queue, &event, 1) > 0) 
+    // batched sensors deliver several events at once, the latest ones overwrite the older ones
+    while((numEvents = ASensorEventQueue_getEvents(event_queue, events, SENSORS_EVENTS_PER_READ)) > 0) 
     {
-        int idx = sensorsContext.sensorsType_index[event.type]; // get index of sensors of this type
-        sensor_struct& sensor = sensorsContext.sensors[idx]; // get sensor of this type
-        // fill sensorBuffer with sensor data, in the channels reserved to this type of sensor
-        // normalized sensor
-        // if(sensors_max[idx] > 0)
-        // {
-        //     for(int chn=0; chn<sensor.numOfChannels; chn++)
-        //     {
-        //         float val = constrain(event.data[chn], -sensors_max[idx], sensors_max[idx]);
-        //         val /= sensors_max[idx];
-        //         sensorsContext.sensorBuffer[sensor.channels[chn]] = val;
-        //     }
-        // }
-        // else // non-normalized sensor
-        // {
-            for(int chn=0; chn<sensor.numOfChannels; chn++)
-                sensorsContext.sensorBuffer[sensor.channels[chn]] = event.data[chn];
-        // }
-
-        // if(event.type == ASENSOR_TYPE_ACCELEROMETER)
-        // {
-        //     float ar = event.data[0];
-        //     float br = event.data[1];
-        //     float cr = event.data[2];
-        //     printf("sensor raw: %f, %f, %f\n", ar, br, cr);
-
-        //     float a = sensorsContext.sensorBuffer[sensor.channels[0]];
-        //     float b = sensorsContext.sensorBuffer[sensor.channels[1]];
-        //     float c = sensorsContext.sensorBuffer[sensor.channels[2]];
-        //     printf("sensor: %f, %f, %f\n", a, b, c);
-        // }  
-
-        // if(event.type == ASENSOR_TYPE_LIGHT)
-        // {
-        //     float ar = event.data[0];
-        //     printf("sensor light: %f\n", ar);
-        // }
-        // if(event.type == ASENSOR_TYPE_PROXIMITY)
-        // {
-        //     float ar = event.data[0];
-        //     printf("sensor prox: %f\n", ar);
-        // }
+        for(int e=0; e<numEvents; e++)
+            storeSensorEvent(events[e]);
     }
-}
\ No newline at end of file
+}
+
+// returns the index of the sensor that raised the event
+int storeSensorEvent(ASensorEvent &event)
+{
+    int idx = sensorsContext.sensorsType_index[event.type]; // get index of sensors of this type
+    sensor_struct& sensor = sensorsContext.sensors[idx]; // get sensor of this type
+    // fill sensorBuffer with sensor data, in the channels reserved to this type of sensor
+    // normalized sensor
+    // if(sensors_max[idx] > 0)
+    // {
+    //     for(int chn=0; chn<sensor.numOfChannels; chn++)
+    //     {
+    //         float val = constrain(event.data[chn], -sensors_max[idx], sensors_max[idx]);
+    //         val /= sensors_max[idx];
+    //         sensorsContext.sensorBuffer[sensor.channels[chn]] = val;
+    //     }
+    // }
+    // else // non-normalized sensor
+    // {
+        for(int chn=0; chn<sensor.numOfChannels; chn++)
+            sensorsContext.sensorBuffer[sensor.channels[chn]] = event.data[chn];
+    // }
+
+    // if(event.type == ASENSOR_TYPE_ACCELEROMETER)
+    // {
+    //     float ar = event.data[0];
+    //     float br = event.data[1];
+    //     float cr = event.data[2];
+    //     printf("sensor raw: %f, %f, %f\n", ar, br, cr);
+
+    //     float a = sensorsContext.sensorBuffer[sensor.channels[0]];
+    //     float b = sensorsContext.sensorBuffer[sensor.channels[1]];
+    //     float c = sensorsContext.sensorBuffer[sensor.channels[2]];
+    //     printf("sensor: %f, %f, %f\n", a, b, c);
+    // }  
+
+    // if(event.type == ASENSOR_TYPE_LIGHT)
+    // {
+    //     float ar = event.data[0];
+    //     printf("sensor light: %f\n", ar);
+    // }
+    // if(event.type == ASENSOR_TYPE_PROXIMITY)
+    // {
+    //     float ar = event.data[0];
+    //     printf("sensor prox: %f\n", ar);
+    // }
+
+    return idx;
+}
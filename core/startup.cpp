@@ -0,0 +1,189 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono> // steady_clock
+#include <cstdio> // printf, fprintf
+#include <pthread.h>
+
+#include "startup.h"
+#include "mixer.h"
+#include "inputsRecording.h"
+
+struct startupPhase {
+    const char *name;
+    int result;
+    double duration_ms;
+};
+
+enum startupPhaseIndex {
+    phase_mixer,
+    phase_audio,
+    phase_sensors,
+    phase_ctrlInputs,
+    phase_ctrlOutputs,
+    phase_count
+};
+
+struct LDSPstartupContext {
+    LDSPinitSettings *settings; // can be updated by mixer and audio init, only their thread can access it
+    LDSPinitSettings sideSettings; // copy for all other phases
+    LDSPhwConfig *hwconfig;
+    startupPhase phases[phase_count] = {
+        {"mixer paths", 0, 0},
+        {"audio", 0, 0},
+        {"sensors", 0, 0},
+        {"control inputs", 0, 0},
+        {"control outputs", 0, 0}
+    };
+};
+
+LDSPstartupContext startupContext;
+
+void *audioStartup(void *);
+void *sensorsStartup(void *);
+void *ctrlInputsStartup(void *);
+void *ctrlOutputsStartup(void *);
+double elapsed_ms(std::chrono::steady_clock::time_point start);
+
+
+int LDSP_initEngine(LDSPinitSettings *settings, LDSPhwConfig *hwconfig)
+{
+    if(!settings)
+        return -1;
+
+    auto start = std::chrono::steady_clock::now();
+
+    startupContext.settings = settings;
+    startupContext.sideSettings = *settings;
+    startupContext.hwconfig = hwconfig;
+
+    //VIC verbose prints of the parallel phases may interleave
+    pthread_t audioThread, sensorsThread, ctrlInputsThread, ctrlOutputsThread;
+    pthread_create(&audioThread, NULL, audioStartup, NULL);
+    pthread_create(&sensorsThread, NULL, sensorsStartup, NULL);
+    pthread_create(&ctrlInputsThread, NULL, ctrlInputsStartup, NULL);
+    pthread_create(&ctrlOutputsThread, NULL, ctrlOutputsStartup, NULL);
+
+    pthread_join(audioThread, NULL);
+    pthread_join(sensorsThread, NULL);
+    pthread_join(ctrlInputsThread, NULL);
+    pthread_join(ctrlOutputsThread, NULL);
+
+    startupPhase *phases = startupContext.phases;
+    bool mixerFailed = (phases[phase_mixer].result < 0);
+    bool audioFailed = (phases[phase_audio].result != 0);
+    bool ctrlOutputsFailed = (phases[phase_ctrlOutputs].result < 0);
+
+    if(mixerFailed || audioFailed || ctrlOutputsFailed)
+    {
+        if(mixerFailed)
+            fprintf(stderr, "Error: unable to set mixer paths\n");
+        else if(audioFailed)
+            fprintf(stderr, "Error: unable to initialize audio\n");
+        if(ctrlOutputsFailed)
+            fprintf(stderr, "Error: unable to intialize control outputs\n");
+
+        // clean up only what was successfully initialized
+        if(!audioFailed)
+            LDSP_cleanupAudio();
+        if(!ctrlOutputsFailed)
+            LDSP_cleanupCtrlOutputs();
+        LDSP_cleanupCtrlInputs();
+        LDSP_cleanupSensors();
+        if(!mixerFailed)
+            LDSP_resetMixerPaths(hwconfig);
+
+        if(mixerFailed)
+            return -2;
+        if(audioFailed)
+            return -3;
+        return -4;
+    }
+
+    // must come after all the other phases, replay may replace sensors and ctrl inputs buffers
+    // not fatal, we simply run without recording/replaying
+    initInputsRecording(settings);
+
+    if(settings->verbose)
+    {
+        printf("\nStartup timings:\n");
+        for(int i=0; i<phase_count; i++)
+            printf("\t%s: %.1f ms\n", phases[i].name, phases[i].duration_ms);
+        printf("\ttotal: %.1f ms\n", elapsed_ms(start));
+    }
+
+    return 0;
+}
+
+
+
+//--------------------------------------------------------------------------------------------------
+
+// mixer paths first, then audio, on the same thread
+void *audioStartup(void *)
+{
+    startupPhase *phases = startupContext.phases;
+
+    auto start = std::chrono::steady_clock::now();
+    phases[phase_mixer].result = LDSP_setMixerPaths(startupContext.settings, startupContext.hwconfig);
+    phases[phase_mixer].duration_ms = elapsed_ms(start);
+
+    // no point in opening the pcm if routing failed
+    if(phases[phase_mixer].result < 0)
+    {
+        phases[phase_audio].result = -1;
+        return (void *)0;
+    }
+
+    start = std::chrono::steady_clock::now();
+    phases[phase_audio].result = LDSP_initAudio(startupContext.settings, 0);
+    phases[phase_audio].duration_ms = elapsed_ms(start);
+
+    return (void *)0;
+}
+
+// the sensor event queue keeps a reference to the looper created by this thread, so it stays valid after the thread is done
+void *sensorsStartup(void *)
+{
+    auto start = std::chrono::steady_clock::now();
+    LDSP_initSensors(&startupContext.sideSettings, startupContext.hwconfig); // includes waiting for first sensor data
+    startupContext.phases[phase_sensors].duration_ms = elapsed_ms(start);
+    return (void *)0;
+}
+
+void *ctrlInputsStartup(void *)
+{
+    auto start = std::chrono::steady_clock::now();
+    LDSP_initCtrlInputs(&startupContext.sideSettings);
+    startupContext.phases[phase_ctrlInputs].duration_ms = elapsed_ms(start);
+    return (void *)0;
+}
+
+void *ctrlOutputsStartup(void *)
+{
+    auto start = std::chrono::steady_clock::now();
+    startupContext.phases[phase_ctrlOutputs].result = LDSP_initCtrlOutputs(&startupContext.sideSettings, startupContext.hwconfig);
+    startupContext.phases[phase_ctrlOutputs].duration_ms = elapsed_ms(start);
+    return (void *)0;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+}
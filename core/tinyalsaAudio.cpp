@@ -36,6 +36,7 @@
 #include <dirent.h> // browse dirs
 #include <unistd.h> // getpid()
 #include <cstdlib> // 
+#include <time.h> // clock_gettime
 #include <iostream> //system()
 
 #include "LDSP.h"
@@ -47,6 +48,8 @@
 #include "sensors.h"
 #include "ctrlInputs.h"
 #include "ctrlOutputs.h"
+#include "inputsRecording.h"
+#include "renderModule.h"
 
 using std::string;
 using std::ifstream;
@@ -77,6 +80,8 @@ bool ctrlOutputsOff_ = false;
 
 int cpuIndex = -1;
 
+uint64_t periodTime = 0; // written and read on audio thread only
+
 bool audioServerStopped = false;
 #if __ANDROID_API__ > 24
 // on Android 7 and above [api 24 and above], Android controls audio via the dedicated audioserver
@@ -148,6 +153,10 @@ int LDSP_initAudio(LDSPinitSettings *settings, void *userData)
 		printf("\nLDSP_initAudio()\n");
 
 
+	// in hot reload builds, user's code has to be loaded before anything else
+	if(initRenderModule(settings) < 0)
+		return -5;
+
 	if(settings->audioserverOff)
 		controlAudioserver(0);
 
@@ -213,6 +222,7 @@ int LDSP_initAudio(LDSPinitSettings *settings, void *userData)
 	intContext.audioInChannels = pcmContext.capture->config.channels;
 	intContext.audioOutChannels = pcmContext.playback->config.channels;
 	intContext.audioSampleRate = (float)pcmContext.playback->config.rate;
+	intContext.controlSampleRate = (int)(intContext.audioSampleRate / intContext.audioFrames); // from actual params
 	userContext = (LDSPcontext*)&intContext;
 
 	return 0;
@@ -227,7 +237,7 @@ int LDSP_startAudio(void *userData)
 	}
 
 
-	if(!setup(userContext, userData))
+	if(!renderModuleSetup(userContext, userData))
 	{
 		LDSP_requestStop();
 		return -1;
@@ -243,7 +253,7 @@ int LDSP_startAudio(void *userData)
 	// wait for end of thread
 	pthread_join(audioThread, nullptr);
 
-	cleanup(userContext, 0);
+	renderModuleCleanup(userContext, 0);
 
 	return 0;
 }
@@ -253,6 +263,8 @@ void LDSP_cleanupAudio()
 	if(audioVerbose)
 		printf("LDSP_cleanupAudio()\n");
 
+	cleanupInputsRecording();
+
 	cleanupLowLevelAudioStruct(&pcmContext);
 	cleanupPcm(&pcmContext);	
 	cleanupAudioParams(&pcmContext); 
@@ -264,6 +276,11 @@ void LDSP_cleanupAudio()
 		controlAudioserver(1);
 }
 
+uint64_t LDSP_getPeriodTime()
+{
+	return periodTime;
+}
+
 void LDSP_requestStop()
 {
 	gShouldStop = true;
@@ -661,22 +678,44 @@ void *audioLoop(void*)
  	set_niceness(-20, "audio",audioVerbose); // only necessary if not real-time, but just in case...
 
 
+	bool replaying = isReplayingInputs();
+	bool recording = isRecordingInputs();
+
 	while(!gShouldStop)
 	{
+		// capture is read even when replaying, otherwise it would overrun and stop the linked playback too
 		if(fullDuplex)
 		{
 			if(pcm_read(pcmContext.capture->pcm, pcmContext.capture->rawBuffer, pcmContext.capture->frameBytes)!=0)
 				fprintf(stderr, "\nCapture error, aborting...\n");
 
-			fromRawToFloat(&pcmContext);
+			if(!replaying)
+				fromRawToFloat(&pcmContext); // when replaying, what was captured is discarded
 		}
 
-		if(!sensorsOff_)
-			readSensors();
-		if(!ctrlInputsOff_)
-			readCtrlInputs();
+		if(!replaying)
+		{
+			if(!sensorsOff_)
+				readSensors();
+			if(!ctrlInputsOff_)
+				readCtrlInputs();
+		}
+		else if(replayInputs() < 0)
+		{
+			printf("\nEnd of inputs recording, stopping...\n");
+			LDSP_requestStop();
+			break;
+		}
+
+		// shortly after the blocking call [pcm_read(), or previous pcm_write() if no capture], new period starts
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		periodTime = (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+
+		if(recording)
+			recordInputs();
 
-		render(userContext, 0);
+		renderModuleRender(userContext, 0);
 		
 		fromFloatToRaw(&pcmContext);
 
@@ -33,14 +33,9 @@ bool setup(LDSPcontext *context, void *userData)
 
 void render(LDSPcontext *context, void *userData)
 {
-	// iterate over the audio frames and create three oscillators, seperated in phase by PI/2
-	for(unsigned int n = 0; n < context->audioFrames; ++n)
-	{
-		// audio capture
-		float in = audioRead(context, n, 0);
-		// log audio capture
-		scope.log(in);
-	}
+	// log the first channel of the audio capture, all the frames of the period at once
+	// audio in is interleaved, so the distance between consecutive samples of the channel is the number of channels
+	scope.logBlock(context->audioIn, context->audioFrames, context->audioInChannels);
 }
 
 void cleanup(LDSPcontext *context, void *userData)
@@ -50,6 +50,11 @@ struct LDSPinitSettings {
     string projectName;
     int cpuIndex;
     int preserveMixer;
+    string sensorsConfig; // comma separated list of sensor[:rate[:max report latency]] or sensor:off
+    string recordInputsFile;
+    string replayInputsFile;
+    int probeCacheOff;
+    string renderModule; // hot reload builds only
 };
 
 /* enum digitalOuput {
@@ -76,6 +81,13 @@ struct multiTouchInfo {
     bool anyTouchSupported;
 };
 
+// ctrl inputs that changed since previous period
+// handy to skip unchanged buttons and touch slots in render()
+struct ctrlInputsChangeMask {
+    uint32_t singleInputs; // one bit per button channel, plus bit chn_btn_count for anyTouch
+    uint64_t touchSlots; // one bit per touch slot, set if any of the slot's multitouch channels changed
+};
+
 struct LDSPcontext {
 	const float * const audioIn;
 	float * const audioOut;
@@ -96,6 +108,7 @@ struct LDSPcontext {
     const string * const sensorsDetails;
     const float controlSampleRate;
     const multiTouchInfo * const mtInfo;
+    const ctrlInputsChangeMask * const ctrlInChanges;
 	//uint64_t audioFramesElapsed;
     const string projectName;
 };
@@ -166,7 +179,7 @@ int LDSP_parseHwConfigFile(LDSPinitSettings *settings, LDSPhwConfig *hwconfig);
 
 int LDSP_initAudio(LDSPinitSettings *settings, void *userData);
 
-void LDSP_initSensors(LDSPinitSettings *settings);
+void LDSP_initSensors(LDSPinitSettings *settings, LDSPhwConfig *hwconfig);
 
 void LDSP_initCtrlInputs(LDSPinitSettings *settings);
 
@@ -189,6 +202,12 @@ bool setup(LDSPcontext *context, void *userData);
 void render(LDSPcontext *context, void *userData);
 void cleanup(LDSPcontext *context, void *userData);
 
+// optional, in hot reload builds only
+// called when a new build replaces the running one: the old build saves its state [plain data, allocated with malloc()] right before its cleanup()
+// and the new one restores it right after its setup(), taking ownership of the memory. Neither runs on the audio thread
+void *saveRenderState(LDSPcontext *context, void *userData);
+void restoreRenderState(LDSPcontext *context, void *userData, void *state);
+
 
 static inline void audioWrite(LDSPcontext *context, int frame, int channel, float value);
 static inline float audioRead(LDSPcontext *context, int frame, int channel);
@@ -196,6 +215,9 @@ static inline float audioRead(LDSPcontext *context, int frame, int channel);
 static inline float sensorRead(LDSPcontext *context, sensorChannel channel);
 static inline int buttonRead(LDSPcontext *context, btnInputChannel channel);
 static inline int multiTouchRead(LDSPcontext *context, multiTouchInputChannel channel, int touchSlot=0);
+static inline bool buttonChanged(LDSPcontext *context, btnInputChannel channel);
+static inline bool multiTouchChanged(LDSPcontext *context, int touchSlot);
+static inline bool anyTouchChanged(LDSPcontext *context);
 static inline void ctrlOutputWrite(LDSPcontext *context, ctrlOutputChannel channel, float value);
 
 //TODO ctrlOutputs/InputsState(...)
@@ -204,7 +226,17 @@ static inline void ctrlOutputWrite(LDSPcontext *context, ctrlOutputChannel chann
 void controlAudioserver(int serverState);
 
 void screenSetState(bool stateOn, float brightness=1, bool stayOn=false);
-bool screenGetState(); // this is a heavy function, use with caution
+bool screenGetState(); // cached state, cheap to call
+
+// switch playback/capture paths while audio is running, using the path aliases of the hw config file [e.g., "speaker", "line-out"]
+// the switch happens asynchronously, only the controls that change are written; returns -1 if the alias is unknown
+// safe to call from any thread, but better not from render()
+int mixerSetOutputPath(string pathAlias);
+int mixerSetInputPath(string pathAlias);
+
+// CLOCK_MONOTONIC time [ns] at which the inputs of the current period became available
+// events timestamped with the same clock can be placed within the period, e.g., sample-accurate MIDI
+uint64_t LDSP_getPeriodTime();
 
 //-----------------------------------------------------------------------------------------------
 // inline
@@ -264,5 +296,31 @@ static inline int multiTouchRead(LDSPcontext *context, multiTouchInputChannel ch
         return context->ctrlInputs[chn_btn_count+1+(channel-1)*context->mtInfo->touchSlots + touchSlot];
 }
 
+// buttonChanged()
+//
+// Returns true if the given button changed since previous period
+static inline bool buttonChanged(LDSPcontext *context, btnInputChannel channel)
+{
+    return (context->ctrlInChanges->singleInputs >> channel) & 1;
+}
+
+// multiTouchChanged()
+//
+// Returns true if any of the multitouch channels of the given touch slot changed since previous period
+static inline bool multiTouchChanged(LDSPcontext *context, int touchSlot)
+{
+    if(touchSlot > 63)
+        touchSlot = 63; // slots beyond the mask share the last bit
+    return (context->ctrlInChanges->touchSlots >> touchSlot) & 1;
+}
+
+// anyTouchChanged()
+//
+// Returns true if the anyTouch channel changed since previous period
+static inline bool anyTouchChanged(LDSPcontext *context)
+{
+    return (context->ctrlInChanges->singleInputs >> chn_btn_count) & 1;
+}
+
 
 #endif /* LDSP_H_ */
@@ -54,16 +54,23 @@ The Bela software is distributed under the GNU Lesser General Public License (LG
 
 //#include <Bela.h>
 #include <vector>
+#include <string>
 //AV: Added for resolving NULL. Also added stdio for printf (Includes of Bela.h)
 //#include <stdint.h>
 #include <unistd.h>
 #include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
 // thread and priority
 #include "thread_utils.h"
 
 
 typedef unsigned char midi_byte_t;
 
+#define MIDI_PARSER_MESSAGES 1024 // channel messages that can be buffered, enough for dense streams [e.g., MPE] at large block sizes
+#define MIDI_PARSER_SYSEX_BYTES 1024 // longest SysEx message that can be received
+
 
 typedef enum midiMessageType {
 	kmmNoteOff = 0,
@@ -101,6 +108,13 @@ public:
 	void setChannel(midi_byte_t channel){
 		_channel = channel;
 	}
+	// CLOCK_MONOTONIC time [ns] at which the message was received, 0 if unknown
+	void setTimestamp(uint64_t timestamp){
+		_timestamp = timestamp;
+	}
+	uint64_t getTimestamp(){
+		return _timestamp;
+	}
 	midi_byte_t getDataByte(unsigned int index){
 		return _dataBytes[index];
 	}
@@ -110,6 +124,7 @@ public:
 		}
 		_type = kmmNone;
 		_statusByte = 0;
+		_timestamp = 0;
 	}
 
 	//AV:Changed rt_printf to printf
@@ -129,6 +144,13 @@ protected:
 	midi_byte_t _dataBytes[maxDataBytes]; // where 2 is the maximum number of data bytes for a channel message
 	MidiMessageType _type;
 	midi_byte_t _channel;
+	uint64_t _timestamp;
+};
+
+//VIC a message and the frame of the current block it falls on
+struct MidiBlockMessage {
+	unsigned int frame;
+	MidiChannelMessage message;
 };
 /*
 class MidiControlChangeMessage : public MidiChannelMessage{
@@ -161,37 +183,124 @@ public:
 };
 */
 
+//VIC tracks tempo and position of an incoming MIDI clock [24 ticks per quarter note]
+// fed by the parser on the input thread, can be read from any thread, e.g., render()
+class MidiClock{
+public:
+	MidiClock();
+
+	// input thread only
+	void tick(uint64_t timestamp);
+	void start();
+	void resume();
+	void stop();
+	void setSongPosition(unsigned int sixteenths);
+
+	/**
+	 * Gets the tempo of the incoming clock, smoothed over the last ticks.
+	 *
+	 * @return the tempo in beats per minute, 0 if no clock has been received yet
+	 */
+	float getBpm();
+
+	/**
+	 * Checks whether the sender is playing [between start/continue and stop messages].
+	 */
+	bool isRunning();
+
+	/**
+	 * Gets the position of the clock at the given frame of the current block, in quarter notes since start.
+	 *
+	 * Uses the same timing as MidiParser::getBlockMessages(), so that it is in sync with messages in the block,
+	 * and extrapolates between ticks using the current tempo.
+	 *
+	 * @param frame the frame within the current block
+	 * @param audioFrames the number of frames in the block [context->audioFrames]
+	 * @param sampleRate the audio sample rate [context->audioSampleRate]
+	 *
+	 * @return the position in quarter notes
+	 */
+	double getBeats(unsigned int frame, unsigned int audioFrames, float sampleRate);
+
+private:
+	// published by the input thread as a whole, via sequence lock
+	std::atomic<unsigned int> seq;
+	std::atomic<uint64_t> lastTickTime;
+	std::atomic<uint64_t> ticks;
+	std::atomic<double> tickInterval; // ns
+	std::atomic<bool> running;
+	std::atomic<bool> holdNextTick; // after start/song position, next tick is the position itself
+	void beginUpdate();
+	void endUpdate();
+};
+
 class MidiParser{
 private:
 	std::vector<MidiChannelMessage> messages;
-	unsigned int writePointer;
-	unsigned int readPointer;
+	std::atomic<unsigned int> writePointer; // written by the input thread
+	std::atomic<unsigned int> readPointer; // written by whoever consumes messages, e.g., the audio thread
+	std::vector<MidiBlockMessage> blockMessages; // preallocated, filled by getBlockMessages()
+	std::atomic<unsigned int> droppedMessages;
+	// parser state, input thread only
+	MidiChannelMessage currentMessage;
+	midi_byte_t currentStatus; // 0 if not within a message
+	midi_byte_t runningStatus; // 0 if not valid
+	midi_byte_t systemData[2];
+	unsigned int expectedDataBytes;
 	unsigned int elapsedDataBytes;
-	bool waitingForStatus;
+	bool inSysex;
+	bool sysexOverflow;
+	std::vector<midi_byte_t> sysexBuffer;
+	unsigned int sysexLength;
+	MidiClock clock;
 	void (*messageReadyCallback)(MidiChannelMessage,void*);
 	bool callbackEnabled;
 	void* callbackArg;
+	void (*sysexCallback)(midi_byte_t*,unsigned int,void*);
+	void* sysexCallbackArg;
+	void (*systemCallback)(midi_byte_t,void*);
+	void* systemCallbackArg;
+	void startChannelMessage(midi_byte_t statusByte);
+	void completeChannelMessage(uint64_t timestamp);
+	void completeSystemMessage();
+	void parseRealTime(midi_byte_t statusByte, uint64_t timestamp);
 public:
 	MidiParser(){
-		waitingForStatus = true;
-		elapsedDataBytes= 0;
-		messages.resize(100); // 100 is the number of messages that can be buffered
+		messages.resize(MIDI_PARSER_MESSAGES);
+		blockMessages.reserve(messages.size()); // so that no allocation happens in getBlockMessages()
+		sysexBuffer.resize(MIDI_PARSER_SYSEX_BYTES);
 		writePointer = 0;
 		readPointer = 0;
+		droppedMessages = 0;
+		currentStatus = 0;
+		runningStatus = 0;
+		expectedDataBytes = 0;
+		elapsedDataBytes = 0;
+		inSysex = false;
+		sysexOverflow = false;
+		sysexLength = 0;
 		callbackEnabled = false;
 		messageReadyCallback = NULL;
 		callbackArg = NULL;
+		sysexCallback = NULL;
+		sysexCallbackArg = NULL;
+		systemCallback = NULL;
+		systemCallbackArg = NULL;
 	}
 
 	/**
 	 * Parses some midi messages.
 	 *
+	 * Handles running status, SysEx and real-time bytes interleaved within other messages.
+	 * Does not allocate memory.
+	 *
 	 * @param input the array to read from
 	 * @param length the maximum number of values available at the array
+	 * @param timestamp CLOCK_MONOTONIC time [ns] at which the bytes were received, 0 if unknown
 	 *
 	 * @return the number of bytes parsed
 	 */
-	int parse(midi_byte_t* input, unsigned int length);
+	int parse(midi_byte_t* input, unsigned int length, uint64_t timestamp=0);
 
 	/**
 	 * Sets the callback to call when a new MidiChannelMessage is available
@@ -206,6 +315,10 @@ public:
 	 * getNextChannelMessage() is still possible, but it will probably always
 	 * return 0 as the callback is called as soon as a new message is available.
 	 *
+	 * The callback runs on the MIDI thread while the port lists are locked, so it
+	 * must not call enableParser(), readFrom(), writeTo(), autoConnect() or delete
+	 * a Midi object: these take the same lock and would deadlock. Writing output is safe.
+	 *
 	 * @param newCallback the callback function.
 	 * @param arg the second argument to be passed to the callback function.
 	 *
@@ -220,6 +333,53 @@ public:
 		}
 	};
 
+	/**
+	 * Sets the callback to call when a complete SysEx message is received.
+	 *
+	 * The callback is called on the MIDI input thread with the bytes between 0xF0 and 0xF7 [both excluded]:
+	 *   callback(midi_byte_t* data, unsigned int length, void* arg)
+	 * Data are valid only during the call. Messages longer than MIDI_PARSER_SYSEX_BYTES are discarded.
+	 * Port lists are locked during the call, the same restrictions as setCallback() apply [no enableParser(), readFrom(), writeTo(), autoConnect()].
+	 *
+	 * @param newCallback the callback function, NULL to deactivate it.
+	 * @param arg the last argument to be passed to the callback function.
+	 */
+	void setSysexCallback(void (*newCallback)(midi_byte_t*, unsigned int, void*), void* arg=NULL){
+		sysexCallbackArg = arg;
+		sysexCallback = newCallback;
+	}
+
+	/**
+	 * Sets the callback to call when a system common or real-time message is received [e.g., clock, start, stop].
+	 *
+	 * The callback is called on the MIDI input thread with the status byte:
+	 *   callback(midi_byte_t statusByte, void* arg)
+	 * Clock messages are also tracked by the parser, see getClock().
+	 * Port lists are locked during the call, the same restrictions as setCallback() apply [no enableParser(), readFrom(), writeTo(), autoConnect()].
+	 *
+	 * @param newCallback the callback function, NULL to deactivate it.
+	 * @param arg the second argument to be passed to the callback function.
+	 */
+	void setSystemCallback(void (*newCallback)(midi_byte_t, void*), void* arg=NULL){
+		systemCallbackArg = arg;
+		systemCallback = newCallback;
+	}
+
+	/**
+	 * Gives access to the tempo tracker of the incoming MIDI clock.
+	 */
+	MidiClock* getClock(){
+		return &clock;
+	}
+
+	/**
+	 * Returns the number of channel messages that were discarded because the buffer was full,
+	 * i.e., they were not retrieved fast enough.
+	 */
+	unsigned int getDroppedMessages(){
+		return droppedMessages.load(std::memory_order_relaxed);
+	}
+
 	/**
 	 * Checks whether there is a callback currently set to be called
 	 * every time a new input MidiChannelMessage is available from the
@@ -257,13 +417,30 @@ public:
 			message.clear();
 		}
 		messages[readPointer].setType(kmmNone); // do not use it again
-		readPointer++;
-		if(readPointer == messages.size()){
-			readPointer = 0;
+		unsigned int nextReadPointer = readPointer + 1;
+		if(nextReadPointer == messages.size()){
+			nextReadPointer = 0;
 		}
+		readPointer.store(nextReadPointer, std::memory_order_release);
 		return message;
 	};
 
+	/**
+	 * Retrieves all the messages that fall within the current block, each with the frame it should be applied at.
+	 *
+	 * Messages are placed within the block according to the time they were received,
+	 * which adds a constant latency of one block but removes the jitter of treating them all as happening at frame 0.
+	 * Messages received after the current block started are left in the buffer, for the next block.
+	 * To be called once per block from render(), it does not allocate memory;
+	 * the returned vector is valid until the next call.
+	 *
+	 * @param audioFrames the number of frames in the block [context->audioFrames]
+	 * @param sampleRate the audio sample rate [context->audioSampleRate]
+	 *
+	 * @return the messages of the current block, sorted by frame
+	 */
+	const std::vector<MidiBlockMessage>& getBlockMessages(unsigned int audioFrames, float sampleRate);
+
 //	MidiChannelMessage getNextChannelMessage(){
 //		getNextChannelMessage(kmmAny);
 //	}
@@ -279,10 +456,51 @@ public:
 };
 
 
+#define MIDI_DEV_DIR "/dev/snd" // where rawmidi ports show up, as midiC<card>D<device>
+#define MIDI_PROC_DIR "/proc/asound" // where port names can be found
+
+//VIC a rawmidi port available on the system
+struct MidiPortInfo {
+	std::string path; // e.g., /dev/snd/midiC1D0
+	int card;
+	int device;
+	std::string name; // e.g., name of the usb controller, empty if unknown
+};
+
 class Midi {
 public:
 	Midi();
 
+	/**
+	 * Lists the Midi ports currently available.
+	 *
+	 * @return the ports found, sorted by card and device
+	 */
+	static std::vector<MidiPortInfo> getPorts();
+
+	/**
+	 * Changes where ports are looked for [by getPorts() and autoConnect()], e.g., to test with a folder of pipes.
+	 * To be called before any port is opened.
+	 *
+	 * @param devDir folder containing the ports, named midiC<card>D<device>
+	 * @param procDir folder containing card<card>/midi<device> files, whose first line is the port name
+	 */
+	static void setPortsDirs(const char* devDir, const char* procDir=MIDI_PROC_DIR);
+
+	/**
+	 * Connects to the first port that matches, as soon as it is available, and reconnects every time it is plugged back.
+	 *
+	 * Ports are watched by the Midi thread, so plugging and unplugging devices does not affect the audio thread.
+	 * While no port is connected, writeOutput() fails and no input is received.
+	 *
+	 * @param match text to look for in the port name or path [case insensitive], empty to match any port
+	 * @param input true to read from the port
+	 * @param output true to write to the port
+	 * @param prioOrder priority of the Midi thread, used only when the thread is started [first port opened]
+	 * @return 1 if a matching port was connected right away, 0 if waiting for one, -1 on error
+	 */
+	int autoConnect(const char* match, bool input=true, bool output=false, int prioOrder=LDSPprioOrder_midiRead);
+
 	/**
 	 * Enable the input MidiParser.
 	 *
@@ -317,7 +535,12 @@ public:
 
 	/**
 	 * Open the specified input Midi port and start reading from it.
+	 *
+	 * Any number of input and output ports can be opened, by the same or different objects,
+	 * they are all served by a single thread.
+	 *
 	 * @param port Midi port to open
+	 * @param prioOrder priority of the Midi thread, used only when the thread is started [first port opened]
 	 * @return 1 on success, -1 on failure
 	 */
 	int readFrom(const char* port,/*VIC added*/ int prioOrder=LDSPprioOrder_midiRead);
@@ -325,6 +548,7 @@ public:
 	/**
 	 * Open the specified output Midi port and prepares to write to it.
 	 * @param port Midi port to open
+	 * @param prioOrder priority of the Midi thread, used only when the thread is started [first port opened]
 	 * @return 1 on success, -1 on failure
 	 */
 	int writeTo(const char* port,/*VIC added*/ int prioOrder=LDSPprioOrder_midiWrite);
@@ -338,16 +562,25 @@ public:
 
 	/**
 	 * Writes a Midi byte to the output port
+	 *
+	 * The byte is queued and sent by the output thread, so this can be safely called from render().
+	 * Only one thread at a time should write to the same Midi object.
+	 *
 	 * @param byte the Midi byte to write
-	 * @return 1 on success, -1 on error
+	 * @return 1 on success, -1 on error or if the output queue is full
 	 */
 	int writeOutput(midi_byte_t byte);
 
 	/**
 	 * Writes Midi bytes to the output port
+	 *
+	 * The bytes are queued and sent by the output thread, so this can be safely called from render().
+	 * Either all the bytes are queued or none, so that messages are never truncated.
+	 * Only one thread at a time should write to the same Midi object.
+	 *
 	 * @param bytes an array of bytes to be written
 	 * @param length number of bytes to write
-	 * @return 1 on success, -1 on error
+	 * @return 1 on success, -1 on error or if the output queue is full
 	 */
 	int writeOutput(midi_byte_t* bytes, unsigned int length);
 	/**
@@ -357,8 +590,6 @@ public:
 	 */
 	MidiParser* getMidiParser();
 	virtual ~Midi();
-	static void *midiInputLoop(void *);
-	static void *midiOutputLoop(void *);
 
 
 	const char* getDefaultMidiPort() { return defaultMidiPort; }
@@ -369,32 +600,44 @@ public:
 	//VIC
 	static int verbose;
 private:
+	//VIC all ports of all objects are served by a single thread, see midiLoop()
+	// each port is registered in its epoll set with a reference to the object and direction
+	struct portRef {
+		Midi *obj;
+		bool isOutput;
+	};
+	static void *midiLoop(void *);
+	static void handlePortsChange();
+	int openPort(const char* port, bool isOutput);
+	void closePort(bool isOutput);
 	int _getInput();
-	void readInputLoop();
-	void writeOutputLoop();
+	int readInput();
+	int writeQueuedOutput();
+	bool outputPending();
+	void handlePortEvent(bool isOutput, unsigned int events);
 	int outputPort;
 	int inputPort;
-	std::vector<midi_byte_t> inputBytes;
-	unsigned int inputBytesWritePointer;
-	unsigned int inputBytesReadPointer;
-	std::vector<midi_byte_t> outputBytes;
-	unsigned int outputBytesWritePointer;
-	unsigned int outputBytesReadPointer;
+	portRef inputRef;
+	portRef outputRef;
+	std::vector<midi_byte_t> inputBytes; // single producer [midi thread], single consumer [getInput()] queue, unused if parser is enabled
+	std::atomic<unsigned int> inputBytesWritePointer;
+	std::atomic<unsigned int> inputBytesReadPointer;
+	std::vector<midi_byte_t> outputBytes; // single producer [writeOutput()], single consumer [midi thread] queue
+	std::atomic<unsigned int> outputBytesWritePointer;
+	std::atomic<unsigned int> outputBytesReadPointer;
+	bool outputBlocked; // port cannot take more bytes, waiting for it to be writable again [midi thread only]
+	std::atomic<bool> outputReady; // port open and working
+	// auto connection
+	std::string autoMatch;
+	bool autoInput;
+	bool autoOutput;
+	std::string inputPath;
+	std::string outputPath;
 	MidiParser* inputParser;
 	bool parserEnabled;
-	static std::vector<Midi*> objAddrs[2];
 	//AV:Commented out Auxiliary Tasks
 	//static AuxiliaryTask midiInputTask; //static pthread_t in;
 	//static AuxiliaryTask midiOutputTask; //static pthread_t out;
-	static pthread_t inputThread;
-	static pthread_t outputThread;
-    static bool inputThreadRunning;
-    static bool outputThreadRunning;
-    static bool shouldStop;
-    //VIC
-    static int prioOrderReadThrd;
-    static int prioOrderWriteThrd;
-    static int midiObjectNumber;
 
 	const char* defaultMidiPort = "/dev/snd/midiC1D0"; // if the phone supports MIDI devices, this should show up in file system, regardless of default USB settings in Developer Options
 
@@ -25,14 +25,13 @@
 #include <vector>
 #include <unordered_map> // unordered_map
 #include <atomic>
-#include <memory>
+#include <cstdint>
 
 #define QUEUE_MAX_SIZE 3
 
 using std::vector;
 using std::unordered_map;
 using std::atomic;
-using std::shared_ptr;
 
 
 const int chn_cin_count = chn_btn_count+chn_mt_count;
@@ -66,10 +65,37 @@ static const string LDSP_ctrlInput[chn_cin_count] = {
 struct ctrlInput_struct {
     bool supported;
     bool isMultiInput;
-    vector< shared_ptr< atomic<signed int> > > value; // vector of atomic containers, for thread-safety
-    // we have to use pointers though, because vector cannot deal with atomics directly
 }; 
 
+// number of frames used to pass ctrl input values from the ctrl inputs thread to the audio thread
+// triple buffering: one frame is written by the ctrl inputs thread, one is read by the audio thread
+// and the one in the middle is swapped atomically, so that neither thread ever waits for the other
+#define CTRL_INPUTS_FRAME_NUM 3
+#define CTRL_INPUTS_FRAME_FRESH 0x4 // flag added to the index of the middle frame when it holds an unread frame
+
+// all ctrl input values are stored in a single cache-line aligned block, containing CTRL_INPUTS_FRAME_NUM frames plus a staging frame
+// each frame uses the same struct-of-arrays layout of the user exposed buffer [see readCtrlInputs()]:
+// single inputs first [buttons + anyTouch], then touchSlots contiguous values for each multitouch axis
+// a frame is published only on SYN_REPORT, so that the audio thread always reads coherent touch frames
+struct ctrlInputsFrames {
+    int *block;
+    int *frames[CTRL_INPUTS_FRAME_NUM];
+    int *staging; // latest values, written by the ctrl inputs thread as events come in
+    unsigned int frameLen;
+    size_t frameBytes;
+    unsigned int writeFrame; // owned by ctrl inputs thread
+    unsigned int readFrame; // owned by audio thread
+    alignas(64) atomic<unsigned int> middleFrame;
+    // inputs that changed since the last time the audio thread read them
+    // the ctrl inputs thread sets the bits after a frame is published, the audio thread clears them before reading a frame
+    // in the worst case the audio thread sees a change twice, but never misses one
+    alignas(64) atomic<uint32_t> changedSingleInputs;
+    atomic<uint64_t> changedTouchSlots;
+    // changes accumulated by the ctrl inputs thread since last published frame
+    uint32_t pendingSingleInputs;
+    uint64_t pendingTouchSlots;
+};
+
 // number of elements in vectors depends on how many slots phone supports [touchSlots]
 struct LDSPctrlInputsContext {
     unsigned int inputsCount;
@@ -100,6 +126,8 @@ struct LDSPctrlInputsContext {
     }) {}
     int *ctrlInBuffer;
     bool *buttonSupported;
+    ctrlInputsFrames inFrames;
+    ctrlInputsChangeMask changes; // user exposed, updated once per period
 };
 // Linux multi-touch protocol explained here: https://www.kernel.org/doc/html/latest/input/multi-touch-protocol.html
 
@@ -30,6 +30,14 @@ using std::unordered_map;
 #define DEVICE_CTRL_FILE 0
 #define DEVICE_SCALE 1
 
+// per-sensor settings, from [sensors] entry in hw config json file and/or command line
+// rate and max report latency are ignored when negative, i.e., max rate and no batching
+struct LDSPsensorConfig {
+    bool enabled = true;
+    float rate = -1; // Hz
+    float maxReportLatency = -1; // ms
+};
+
 struct LDSPhwConfig {
     string hw_confg_file;
     string device_id_placeholder;
@@ -58,6 +66,8 @@ struct LDSPhwConfig {
     vector<string> dev_activation_ctl2_c;
     
     string *ctrl_outputs[2]; // control file and max value (or max file)
+
+    unordered_map<string, LDSPsensorConfig> sensors; // only sensors listed in config file
 };
 
 
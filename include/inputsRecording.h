@@ -0,0 +1,90 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INPUTS_RECORDING_H_
+#define INPUTS_RECORDING_H_
+
+// records all the inputs the audio thread sees [audio in, sensors, ctrl inputs] to a binary file, one record per period
+// and replays them in place of pcm capture, readSensors() and readCtrlInputs()
+// so that the very same session can be rendered again, e.g., to profile render() deterministically
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <pthread.h>
+#include "LDSP.h"
+
+#define INPUTS_RECORDING_MAGIC "LDSPINPT"
+#define INPUTS_RECORDING_VERSION 1
+#define INPUTS_RECORDING_RING_PERIODS 512 // periods buffered between audio thread and file writer
+
+// file layout: header, then one record per period
+// each record contains, in order: audio in [interleaved, audioInChannels*audioFrames floats], sensors [sensorChannels floats],
+// ctrl inputs [ctrlInputsLen ints, same layout as context->ctrlInputs], ctrl inputs change mask
+struct inputsRecordingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t audioFrames;
+    uint32_t audioInChannels; // 0 if capture was off
+    uint32_t sensorChannels;
+    uint32_t ctrlInputsLen;
+    uint32_t recordBytes;
+    float audioSampleRate;
+    bool sensorsSupported[chn_sens_count];
+    bool buttonsSupported[chn_btn_count];
+    multiTouchInfo mtInfo;
+};
+
+struct LDSPinputsRecordingContext {
+    inputsRecordingHeader header;
+    size_t audioInBytes;
+    size_t sensorsBytes;
+    size_t ctrlInputsBytes;
+
+    // recording
+    FILE *recFile;
+    char *ring; // INPUTS_RECORDING_RING_PERIODS records
+    alignas(64) std::atomic<unsigned int> ringWrite;
+    alignas(64) std::atomic<unsigned int> ringRead;
+    unsigned int droppedRecords;
+    std::atomic<bool> writeFailed; // set by the writer, recording stops
+    std::atomic<bool> writerShouldStop;
+    pthread_t writerThread;
+
+    // replay
+    char *replayData; // whole file, mapped
+    size_t replayDataSize;
+    size_t replayRecords;
+    size_t replayIdx;
+    bool replayCtrlInputs; // false if ctrl inputs are off now or were off when recorded
+    float *sensors;
+    int *ctrlInputs;
+    bool sensorsSupported[chn_sens_count];
+    bool buttonsSupported[chn_btn_count];
+    multiTouchInfo mtInfo;
+};
+
+int initInputsRecording(LDSPinitSettings *settings);
+void cleanupInputsRecording();
+void recordInputs();
+int replayInputs();
+bool isRecordingInputs();
+bool isReplayingInputs();
+
+#endif /* INPUTS_RECORDING_H_ */
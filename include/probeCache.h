@@ -0,0 +1,40 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PROBE_CACHE_H_
+#define PROBE_CACHE_H_
+
+// results of the probing done at startup [device numbers/ids, control input devices, control output files]
+// are stored in a small key-value file and reused in the next runs
+// the file is discarded as soon as the phone's build fingerprint or kernel change
+// every cached entry is still validated by its user before being trusted, e.g., by checking that a path exists
+
+#include <string>
+#include "LDSP.h"
+
+using std::string;
+
+#define PROBE_CACHE_FILE "/data/ldsp/ldsp_probe_cache"
+
+void initProbeCache(LDSPinitSettings *settings); // can be called multiple times, loads the file once
+bool probeCacheGet(string key, string &value);
+void probeCacheSet(string key, string value);
+void probeCacheRemove(string key);
+void saveProbeCache(); // writes file only if something changed
+
+#endif /* PROBE_CACHE_H_ */
@@ -0,0 +1,53 @@
+/*
+ * [2-Clause BSD License]
+ *
+ * Copyright 2022 Victor Zappi
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RENDER_MODULE_H_
+#define RENDER_MODULE_H_
+
+// hot reload of the user's code, available when building with LDSP_HOT_RELOAD
+// setup(), render() and cleanup() live in a shared object that is loaded at startup
+// whenever a new version of the file is pushed, it is loaded on a separate thread, the audio of the old one fades out
+// then the old one is cleaned up and the new one is set up [they never run together, so they can use the same ports, devices and files]
+// and its audio fades in. Output is silent while the two are swapped
+
+#include "LDSP.h"
+
+#define RENDER_MODULE_DEFAULT_FILE "libldsp_render.so" // in the project dir, where ldsp runs
+#define RENDER_MODULE_FADE_MS 30
+
+typedef bool (*renderModule_setup)(LDSPcontext *, void *);
+typedef void (*renderModule_render)(LDSPcontext *, void *);
+typedef void (*renderModule_cleanup)(LDSPcontext *, void *);
+typedef void *(*renderModule_saveState)(LDSPcontext *, void *);
+typedef bool (*renderModule_restoreState)(LDSPcontext *, void *, void *);
+
+struct renderModule {
+    void *handle;
+    renderModule_setup setup;
+    renderModule_render render;
+    renderModule_cleanup cleanup;
+    renderModule_saveState saveState;
+    renderModule_restoreState restoreState;
+};
+
+int initRenderModule(LDSPinitSettings *settings);
+bool renderModuleSetup(LDSPcontext *context, void *userData);
+void renderModuleRender(LDSPcontext *context, void *userData);
+void renderModuleCleanup(LDSPcontext *context, void *userData);
+
+#endif /* RENDER_MODULE_H_ */
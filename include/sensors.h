@@ -34,6 +34,7 @@
 #include "LDSP.h"
 #include "tinyalsaAudio.h" // for LDSPinternalContext
 #include "enums.h"
+#include "hwConfig.h" // for LDSPsensorConfig
 
 using std::unordered_map;
 
@@ -78,6 +79,9 @@ static const string sensors_channelsInfo[LDSP_sensor::count][2] = {
 struct sensor_struct {
     const ASensor *asensor;
     bool present;
+    bool enabled; // present sensors can be disabled via settings
+    int samplingPeriod; // us, 0 means sensor is not registered with a rate
+    int maxReportLatency; // us, 0 means no batching
     unsigned int type;
     unsigned int numOfChannels;
     sensorChannel *channels;
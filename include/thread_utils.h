@@ -54,6 +54,9 @@ constexpr unsigned int LDSPprioOrder_wserverClient = 20;
 
 constexpr unsigned int LDSPprioOrder_scopeTriggerClient = 2;
 
+// pd messages and midi sent by the patch to LDSP, that may trigger slow ctrl outputs
+constexpr unsigned int LDSPprioOrder_pdMessages = 30;
+
 
 //-----------------------------------------------------------------------------------------------------------
 // set maximum priority to this thread
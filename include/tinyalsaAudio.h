@@ -116,6 +116,7 @@ struct LDSPinternalContext {
     string *sensorsDetails;
     float controlSampleRate; // sensors and output devices
     multiTouchInfo *mtInfo;
+    ctrlInputsChangeMask *ctrlInChanges;
 	//uint64_t audioFramesElapsed;
     //operator LDSPcontext () {return *(LDSPcontext*)this;}
     string projectName;
@@ -5,6 +5,13 @@
 // #include <libraries/ne10/NE10.h>
 //#include <NE10.h>
 #include <math.h>
+#include <cmath> // isfinite
+#include <cstring> // memcpy
+#include <cstdarg> // va_list
+#include <algorithm> // min
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 // #include <libraries/WSServer/WSServer.h>
 #include "libraries/WSServer/WSServer.h"
 // #include <JSON.h>
@@ -23,6 +30,7 @@ namespace fs = std::filesystem;
 
 
 constexpr unsigned int triggerSleepUs = 10;
+constexpr unsigned int ringMask = SCOPE_RING_FRAMES-1;
 
 
 class ScopePageHandler : public seasocks::PageHandler 
@@ -157,20 +165,29 @@ private:
 
 
 
-Scope::Scope(): isUsingOutBuffer(false), 
-                isUsingBuffer(false), 
-                isResizing(true), 
+Scope::Scope(): resizeRequested(false), 
+                configured(false), 
+                pixelWidth(0), 
                 upSampling(1), 
                 downSampling(1), 
+                ringWrite(0), 
+                ringRead(0), 
                 triggerPrimed(false), 
                 started(false), 
-		windowFFT(NULL)//,
-		// inFFT(NULL),
-		// outFFT(NULL),
-		// cfg(NULL)
+                customTriggered(false), 
+                newFFTLength(0), 
+		windowFFT(NULL),
+		inFFT(NULL),
+		outFFT(NULL),
+#ifdef NE10_FFT
+		cfg(NULL),
+#else
+		planFFT(NULL),
+#endif
+		binsFrameWidth(0)
 		{}
 
-Scope::Scope(unsigned int numChannels, float sampleRate){
+Scope::Scope(unsigned int numChannels, float sampleRate): Scope(){
 	setup(numChannels, sampleRate);
 }
 
@@ -186,9 +203,20 @@ Scope::~Scope(){
 
 void Scope::dealloc(){
 	delete[] windowFFT;
-	// NE10_FREE(inFFT);
-	// NE10_FREE(outFFT);
-	// NE10_FREE(cfg);
+	windowFFT = NULL;
+#ifdef NE10_FFT
+	NE10_FREE(inFFT);
+	NE10_FREE(outFFT);
+	ne10_fft_destroy_r2c_float32(cfg);
+	cfg = NULL;
+#else
+	if (planFFT) fftwf_destroy_plan(planFFT);
+	planFFT = NULL;
+	fftwf_free(inFFT);
+	fftwf_free(outFFT);
+#endif
+	inFFT = NULL;
+	outFFT = NULL;
 }
 
 void* Scope::trigger_func_static(void* arg) {
@@ -205,20 +233,80 @@ void* Scope::trigger_func_static(void* arg) {
 void* Scope::trigger_func() {
     while(!shouldStop) {
 
-        if(triggerSignal.load()) {
-            triggerSignal.store(false);
-
-            if(plotMode == TIME_DOMAIN)
-                triggerTimeDomain();
-            else if(plotMode == FREQ_DOMAIN)
-                triggerFFT();
+        // buffers are resized here, so that no other thread is using them
+        if(resizeRequested.exchange(false)) {
+            // browser may have sent only part of the settings so far
+            if(pixelWidth/upSampling > 0 && (TIME_DOMAIN == plotMode || newFFTLength > 0)) {
+                setPlotMode();
+                setXParams();
+                configured = true;
+            }
         }
+
+        if(ringRead.load(std::memory_order_relaxed) != ringWrite.load(std::memory_order_acquire))
+            collect();
         else
             usleep(triggerSleepUs);
     }
     return (void *)0;
 }
 
+// moves logged frames from the ring to the trigger buffer and looks for triggers
+// one chunk at a time, so that frames are never overwritten before trigger and fft are done with them
+void Scope::collect() {
+    unsigned int write = ringWrite.load(std::memory_order_acquire);
+    unsigned int read = ringRead.load(std::memory_order_relaxed);
+
+    // nobody is watching yet
+    if(!configured) {
+        ringRead.store(write, std::memory_order_release);
+        return;
+    }
+
+    // ring has all the logged frames, downsampling happens here
+    int decimation = (TIME_DOMAIN == activePlotMode) ? std::max(downSampling, 1) : 1;
+    if(decimation != activeDownSampling) {
+        activeDownSampling = decimation;
+        downSampleCount = 0;
+    }
+
+    unsigned int maxChunk = (TIME_DOMAIN == activePlotMode) ? frameWidth : FFTLength;
+    maxChunk *= decimation;
+    while(read != write) {
+        unsigned int frames = std::min(write-read, maxChunk);
+        for(unsigned int n=0; n<frames; n++) {
+            const float* frame = &ring[((read+n) & ringMask)*numChannels];
+            if(decimation > 1) {
+                for(int i=0; i<numChannels; i++) {
+                    if(downSampleCount == 0 || frame[i] < groupMin[i])
+                        groupMin[i] = frame[i];
+                    if(downSampleCount == 0 || frame[i] > groupMax[i])
+                        groupMax[i] = frame[i];
+                }
+                if(++downSampleCount < decimation)
+                    continue;
+                downSampleCount = 0;
+                for(int i=0; i<numChannels; i++) {
+                    bufferMin[i*channelWidth + writePointer] = groupMin[i];
+                    bufferMax[i*channelWidth + writePointer] = groupMax[i];
+                }
+            }
+            // last frame of the group is the one that triggers
+            for(int i=0; i<numChannels; i++)
+                buffer[i*channelWidth + writePointer] = frame[i];
+            bufferFrame[writePointer] = read+n;
+            writePointer = (writePointer+1)%channelWidth;
+        }
+        read += frames;
+        ringRead.store(read, std::memory_order_release);
+
+        if(TIME_DOMAIN == activePlotMode)
+            triggerTimeDomain();
+        else
+            triggerFFT();
+    }
+}
+
 // void Scope::triggerTask(){
 //     if (TIME_DOMAIN == plotMode){
 //         triggerTimeDomain();
@@ -233,6 +321,10 @@ void Scope::setup(unsigned int _numChannels, float _sampleRate){
    
     setSetting(/*L*/"numChannels", _numChannels);
     setSetting(/*L*/"sampleRate", _sampleRate);
+
+    ring.assign(SCOPE_RING_FRAMES*numChannels, 0);
+    ringWrite = 0;
+    ringRead = 0;
 	
 	// set up the websocket server
 	// ws_server = std::unique_ptr<WSServer>(new WSServer());
@@ -297,45 +389,40 @@ void Scope::setup(unsigned int _numChannels, float _sampleRate){
 	// setup the auxiliary tasks
 	//scopeTriggerTask = std::unique_ptr<AuxTaskRT>(new AuxTaskRT());
 	//scopeTriggerTask->create("scope-trigger-task", [this](){ triggerTask(); });
-    triggerSignal.store(false);
     shouldStop = false;
     pthread_create(&scopeTrigger_thread, NULL, trigger_func_static, this);
 }
 
 void Scope::start(){
-
-	// reset the pointers
-writePointer = 0;
-    readPointer = 0;
-
-    logCount = 0;
+    // pointers are reset when settings are applied
     started = true;
-
 }
 
 void Scope::stop(){
     started = false;
 }
 
+// called on the trigger thread only
 void Scope::setPlotMode(){
 // printf("setPlotMode\n");
-	isResizing = true;
-	while(!/*Bela_stopRequested()*/shouldStop && (isUsingBuffer || isUsingOutBuffer)){
-		// printf("waiting for threads\n");
-		usleep(100000);
-	}
+	activePlotMode = plotMode;
 	FFTLength = newFFTLength;
 	FFTScale = 2.0f / (float)FFTLength;
 	FFTLogOffset = 20.0f * log10f(FFTScale);
     
     // setup the input buffer
     frameWidth = pixelWidth/upSampling;
-	if(TIME_DOMAIN == plotMode) {
+	if(TIME_DOMAIN == activePlotMode) {
 		channelWidth = frameWidth * FRAMES_STORED;
 	} else {
-		channelWidth = FFTLength;
+		channelWidth = FFTLength * 2; // one fft worth of past frames, while the next chunk is collected
 	}
     buffer.resize(numChannels*channelWidth);
+    bufferMin.resize(numChannels*channelWidth);
+    bufferFrame.resize(channelWidth);
+    bufferMax.resize(numChannels*channelWidth);
+    groupMin.resize(numChannels);
+    groupMax.resize(numChannels);
     
     // setup the output buffer
     outBuffer.resize(numChannels*frameWidth);
@@ -346,19 +433,38 @@ void Scope::setPlotMode(){
     triggerCollecting = false;
     triggerWaiting = false;
     triggerCount = 0;
-    downSampleCount = 1;
+    downSampleCount = 0;
+    activeDownSampling = 1;
     autoTriggerCount = 0;
     customTriggered = false;
+
+    // reset the pointers and skip what was logged with the old settings
+    writePointer = 0;
+    readPointer = 0;
+    ringRead.store(ringWrite.load(std::memory_order_acquire), std::memory_order_release);
         
-    if (FREQ_DOMAIN == plotMode){
+    if (FREQ_DOMAIN == activePlotMode){
 		dealloc();
 		
-        // inFFT  = (ne10_fft_cpx_float32_t*) NE10_MALLOC (FFTLength * sizeof (ne10_fft_cpx_float32_t));
-		// outFFT = (ne10_fft_cpx_float32_t*) NE10_MALLOC (FFTLength * sizeof (ne10_fft_cpx_float32_t));
-		// cfg = ne10_fft_alloc_c2c_float32_neon (FFTLength);
-
-        fft.cleanup();
-        fft.setup(FFTLength);
+        // channels are stored one after the other, both in time and frequency domain
+        int bins = FFTLength/2 + 1;
+#ifdef NE10_FFT
+        inFFT  = (float*) NE10_MALLOC (numChannels * FFTLength * sizeof (float));
+		outFFT = (ne10_fft_cpx_float32_t*) NE10_MALLOC (numChannels * bins * sizeof (ne10_fft_cpx_float32_t));
+		cfg = ne10_fft_alloc_r2c_float32 (FFTLength);
+		if (!inFFT || !outFFT || !cfg){
+#else
+        inFFT  = (float*) fftwf_malloc (numChannels * FFTLength * sizeof (float));
+		outFFT = (fftwf_complex*) fftwf_malloc (numChannels * bins * sizeof (fftwf_complex));
+		if (inFFT && outFFT)
+			planFFT = fftwf_plan_many_dft_r2c(1, &FFTLength, numChannels, inFFT, NULL, 1, FFTLength, outFFT, NULL, 1, bins, FFTW_MEASURE);
+		if (!planFFT){
+#endif
+			fprintf(stderr, "Scope: cannot allocate FFT of length %d\n", FFTLength);
+			dealloc();
+		}
+		powerFFT.resize(numChannels * bins);
+		binsFrameWidth = 0; // bins maps are recomputed at first FFT
 
     	windowFFT = new float[FFTLength];
     	
@@ -374,18 +480,16 @@ void Scope::setPlotMode(){
     	}
         
     }
-	isResizing = false; 
 // printf("end setPlotMode\n");
 }
 
 void Scope::log(const float* values){
 	
-	if (!prelog()) return;
+	float* frame = prelog();
+	if (!frame) return;
 
-    // save the logged samples into the buffer
-	for (int i=0; i<numChannels; i++) {
-		buffer[i*channelWidth + writePointer] = values[i];
-	}
+    // save the logged samples into the ring
+	memcpy(frame, values, numChannels*sizeof(float));
 
 	postlog();
 
@@ -393,56 +497,125 @@ void Scope::log(const float* values){
 
 void Scope::log(double chn1, ...){
 	
-	if (!prelog()) return;
+	float* frame = prelog();
+	if (!frame) return;
     
     va_list args;
     va_start (args, chn1);
     
-    // save the logged samples into the buffer
-    buffer[writePointer] = chn1;
+    // save the logged samples into the ring
+    frame[0] = chn1;
 
     for (int i=1; i<numChannels; i++) {
-        // iterate over the function arguments, store them in the relevant part of the buffer
-        // channels are stored sequentially in the buffer i.e [[channel1], [channel2], etc...]
-        buffer[i*channelWidth + writePointer] = (float)va_arg(args, double);
+        // iterate over the function arguments, store them in the relevant part of the frame
+        frame[i] = (float)va_arg(args, double);
     }
     
     postlog();
     va_end (args);
 }
 
-bool Scope::prelog(){
-	
-    if (!started || isResizing || isUsingBuffer) return false;
-    
-    if (TIME_DOMAIN == plotMode && downSampling > 1){
-        if (downSampleCount < downSampling){
-            downSampleCount++;
-            return false;
+void Scope::logBlock(const float* interleaved, unsigned int frames, unsigned int stride){
+
+    if (!started) return;
+
+    if (stride == 0)
+        stride = numChannels;
+
+    frames = ringSpace(frames);
+    unsigned int write = ringWrite.load(std::memory_order_relaxed);
+    unsigned int start = write & ringMask;
+
+    if (stride == (unsigned int)numChannels){
+        unsigned int first = std::min(frames, SCOPE_RING_FRAMES-start);
+        memcpy(&ring[start*numChannels], interleaved, first*numChannels*sizeof(float));
+        memcpy(&ring[0], &interleaved[first*numChannels], (frames-first)*numChannels*sizeof(float));
+    } else {
+        // strided frames [e.g., some channels of wider frames] are packed as they are copied
+        for (unsigned int n=0; n<frames; n++){
+            float* dst = &ring[((start+n) & ringMask)*numChannels];
+            memcpy(dst, &interleaved[n*stride], numChannels*sizeof(float));
+        }
+    }
+    ringWrite.store(write+frames, std::memory_order_release);
+}
+
+// interleaves frames [offset, offset+frames) of the channels into dst
+static void interleave(float* dst, const float* const* channels, int numChannels, unsigned int offset, unsigned int frames){
+    unsigned int n = 0;
+#if defined(__ARM_NEON)
+    if (numChannels == 4){
+        for (; n+4 <= frames; n+=4){
+            float32x4x4_t v;
+            v.val[0] = vld1q_f32(&channels[0][offset+n]);
+            v.val[1] = vld1q_f32(&channels[1][offset+n]);
+            v.val[2] = vld1q_f32(&channels[2][offset+n]);
+            v.val[3] = vld1q_f32(&channels[3][offset+n]);
+            vst4q_f32(&dst[n*4], v);
         }
-        downSampleCount = 1;
     }
+    else if (numChannels == 2){
+        for (; n+4 <= frames; n+=4){
+            float32x4x2_t v;
+            v.val[0] = vld1q_f32(&channels[0][offset+n]);
+            v.val[1] = vld1q_f32(&channels[1][offset+n]);
+            vst2q_f32(&dst[n*2], v);
+        }
+    }
+    else if (numChannels == 1){
+        memcpy(dst, &channels[0][offset], frames*sizeof(float));
+        return;
+    }
+#endif
+    for (; n < frames; n++){
+        for (int i=0; i<numChannels; i++)
+            dst[n*numChannels + i] = channels[i][offset+n];
+    }
+}
+
+void Scope::logBlockPlanar(const float* const* channels, unsigned int frames){
+
+    if (!started) return;
+
+    frames = ringSpace(frames);
+    unsigned int write = ringWrite.load(std::memory_order_relaxed);
+    unsigned int n = 0;
+    while (n < frames){
+        unsigned int start = (write+n) & ringMask;
+        unsigned int len = std::min(frames-n, SCOPE_RING_FRAMES-start);
+        interleave(&ring[start*numChannels], channels, numChannels, n, len);
+        n += len;
+    }
+    ringWrite.store(write+frames, std::memory_order_release);
+}
+
+// returns where to write the next frame in the ring, or NULL if the frame is not logged
+float* Scope::prelog(){
+	
+    if (!started) return NULL;
     
-	isUsingBuffer = true;
-    return true;
+    // ring is full, trigger thread is late
+    if (ringSpace(1) == 0) return NULL;
+
+    return &ring[(ringWrite.load(std::memory_order_relaxed) & ringMask)*numChannels];
 }
 
 void Scope::postlog(){
 	
-	isUsingBuffer = false;
-    writePointer = (writePointer+1)%channelWidth;
-	
-    if (logCount++ > TRIGGER_LOG_COUNT){
-        logCount = 0;
-        //scopeTriggerTask->schedule();
-        triggerSignal.store(true);
-    }
+    // makes the frame visible to the trigger thread
+    ringWrite.store(ringWrite.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+// how many of the requested frames fit in the ring, called on the audio thread only
+unsigned int Scope::ringSpace(unsigned int frames){
+    unsigned int space = SCOPE_RING_FRAMES - (ringWrite.load(std::memory_order_relaxed) - ringRead.load(std::memory_order_acquire));
+    return std::min(frames, space);
 }
 
 bool Scope::trigger(){
     if (CUSTOM == triggerMode && !customTriggered && triggerPrimed && started){
-        customTriggerPointer = (writePointer-xOffset+channelWidth)%channelWidth;
-        customTriggered = true;
+        customTriggerFrame.store(ringWrite.load(std::memory_order_relaxed)-xOffset, std::memory_order_relaxed);
+        customTriggered.store(true, std::memory_order_release);
         return true;
     }
     return false;
@@ -464,7 +637,8 @@ bool Scope::triggered(){
 			return positiveEdge || negativeEdge;
 		}
 	} else if (CUSTOM == triggerMode){
-		return (customTriggered && readPointer == customTriggerPointer);
+		// with downsampling the frame passed to trigger() may be in the middle of a group, the first slot that reaches it triggers
+		return (customTriggered.load(std::memory_order_acquire) && (int)(bufferFrame[readPointer] - customTriggerFrame.load(std::memory_order_relaxed)) >= 0);
 	}
 	return false;
 }
@@ -515,32 +689,15 @@ void Scope::triggerTimeDomain(){
                 triggerWaiting = true;
                 triggerCount = frameWidth/2.0f + holdOffSamples;
                 
-                if (!isResizing){
-					isUsingBuffer = true;
-					isUsingOutBuffer = true;
-					
+                {
 					// copy the previous to next frameWidth/2.0f samples into the outBuffer
 					int startptr = (triggerPointer-(int)(frameWidth/2.0f) + channelWidth)%channelWidth;
-					int endptr = (startptr + frameWidth)%channelWidth;
-					
-					if (endptr > startptr){
-						for (int i=0; i<numChannels; i++){
-							std::copy(&buffer[channelWidth*i+startptr], &buffer[channelWidth*i+endptr], outBuffer.begin()+(i*frameWidth));
-						}
-					} else {
-						for (int i=0; i<numChannels; i++){
-							std::copy(&buffer[channelWidth*i+startptr], &buffer[channelWidth*(i+1)], outBuffer.begin()+(i*frameWidth));
-							std::copy(&buffer[channelWidth*i], &buffer[channelWidth*i+endptr], outBuffer.begin()+((i+1)*frameWidth-endptr));
-						}
-					}
-					isUsingBuffer = false;
-					
+					copyOutBuffer(startptr);
+
 					// the whole frame has been saved in outBuffer, so send it
 					// sendBufferTask.schedule((void*)&outBuffer[0], outBuffer.size()*sizeof(float));
 					// rt_printf("scheduling sendBufferTask size: %i\n", outBuffer.size());
-					web_server->send/*Rt*/(_addressData.c_str(), outBuffer.data(), outBuffer.size() * sizeof(float));
-					
-					isUsingOutBuffer = false;
+					sendOutBuffer();
                 }
 				
             }
@@ -566,6 +723,99 @@ void Scope::triggerTimeDomain(){
 
 }
 
+void Scope::copyOutBuffer(int startptr){
+	int endptr = (startptr + frameWidth)%channelWidth;
+
+	if (activeDownSampling <= 1 || !minMaxDecimation){
+		if (endptr > startptr){
+			for (int i=0; i<numChannels; i++){
+				std::copy(&buffer[channelWidth*i+startptr], &buffer[channelWidth*i+endptr], outBuffer.begin()+(i*frameWidth));
+			}
+		} else {
+			for (int i=0; i<numChannels; i++){
+				std::copy(&buffer[channelWidth*i+startptr], &buffer[channelWidth*(i+1)], outBuffer.begin()+(i*frameWidth));
+				std::copy(&buffer[channelWidth*i], &buffer[channelWidth*i+endptr], outBuffer.begin()+((i+1)*frameWidth-endptr));
+			}
+		}
+		return;
+	}
+
+	// each pair of pixels draws a vertical line from the max to the min of the samples of both
+	for (int i=0; i<numChannels; i++){
+		const float* chnMin = &bufferMin[channelWidth*i];
+		const float* chnMax = &bufferMax[channelWidth*i];
+		float* out = &outBuffer[i*frameWidth];
+		for (int n=0; n<frameWidth; n+=2){
+			int ptr = (startptr+n)%channelWidth;
+			if (n+1 == frameWidth){
+				out[n] = chnMax[ptr];
+				break;
+			}
+			int next = (ptr+1)%channelWidth;
+			out[n] = std::max(chnMax[ptr], chnMax[next]);
+			out[n+1] = std::min(chnMin[ptr], chnMin[next]);
+		}
+	}
+}
+
+// half precision, round to nearest even, denormals flushed to zero
+static uint16_t floatToHalf(float value){
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (bits >> 16) & 0x8000;
+	uint32_t absBits = bits & 0x7fffffff;
+	if (absBits >= 0x7f800000) // inf or nan
+		return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0);
+	if (absBits >= 0x477ff000) // too big, inf
+		return sign | 0x7c00;
+	if (absBits < 0x38800000) // too small, zero
+		return sign;
+	uint32_t rounded = absBits + 0xfff + ((absBits >> 13) & 1);
+	return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+// packet is a 4 byte encoding id, followed by the samples
+// INT16 has one float scale per channel before the samples, sample = int16/32767*scale
+void Scope::sendOutBuffer(){
+	size_t samples = outBuffer.size();
+	size_t sampleBytes = (FLOAT32 == encoding) ? sizeof(float) : sizeof(int16_t);
+	size_t headerBytes = sizeof(uint32_t) + ((INT16 == encoding) ? numChannels*sizeof(float) : 0);
+	packet.resize(headerBytes + samples*sampleBytes);
+
+	uint32_t id = encoding;
+	memcpy(packet.data(), &id, sizeof(id));
+	char* data = packet.data() + headerBytes;
+
+	if (FLOAT32 == encoding){
+		memcpy(data, outBuffer.data(), samples*sizeof(float));
+	} else if (FLOAT16 == encoding){
+		for (size_t n=0; n<samples; n++){
+			uint16_t half = floatToHalf(outBuffer[n]);
+			memcpy(data + n*sizeof(half), &half, sizeof(half));
+		}
+	} else {
+		int width = samples/numChannels;
+		for (int i=0; i<numChannels; i++){
+			const float* chn = &outBuffer[i*width];
+			float scale = 0;
+			for (int n=0; n<width; n++){
+				if (std::isfinite(chn[n]))
+					scale = std::max(scale, fabsf(chn[n]));
+			}
+			if (scale == 0)
+				scale = 1;
+			memcpy(packet.data() + sizeof(uint32_t) + i*sizeof(float), &scale, sizeof(scale));
+			for (int n=0; n<width; n++){
+				float v = std::isfinite(chn[n]) ? chn[n] : 0; // e.g., -inf dB
+				int16_t sample = (int16_t)lrintf(v/scale*32767.0f);
+				memcpy(data + (i*width + n)*sizeof(sample), &sample, sizeof(sample));
+			}
+		}
+	}
+
+	web_server->send/*Rt*/(_addressData.c_str(), packet.data(), packet.size());
+}
+
 void Scope::triggerFFT(){
     while (readPointer != writePointer){
         
@@ -593,113 +843,187 @@ void Scope::triggerFFT(){
     }
 }
 
+// log2 of positive normal numbers, exponent plus atanh series of the mantissa, error < 1e-5
+// zero is mapped to -127
+static inline float fastLog2(float x){
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	float e = (float)((int)(bits >> 23) - 127);
+	bits = (bits & 0x007fffff) | 0x3f800000; // mantissa in [1, 2)
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+	float t = (m - 1.0f) / (m + 1.0f);
+	float t2 = t*t;
+	float series = t * (2.0f + t2 * (2.0f/3.0f + t2 * (2.0f/5.0f + t2 * (2.0f/7.0f + t2 * (2.0f/9.0f)))));
+	return e + series * (float)M_LOG2E;
+}
+
+#if defined(__ARM_NEON)
+static inline float32x4_t fastLog2(float32x4_t x){
+	uint32x4_t bits = vreinterpretq_u32_f32(x);
+	float32x4_t e = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127)));
+	float32x4_t m = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)), vdupq_n_u32(0x3f800000)));
+	float32x4_t one = vdupq_n_f32(1.0f);
+	// (m-1)/(m+1), with reciprocal estimate refined twice
+	float32x4_t den = vaddq_f32(m, one);
+	float32x4_t rec = vrecpeq_f32(den);
+	rec = vmulq_f32(rec, vrecpsq_f32(den, rec));
+	rec = vmulq_f32(rec, vrecpsq_f32(den, rec));
+	float32x4_t t = vmulq_f32(vsubq_f32(m, one), rec);
+	float32x4_t t2 = vmulq_f32(t, t);
+	float32x4_t series = vmlaq_f32(vdupq_n_f32(2.0f/7.0f), t2, vdupq_n_f32(2.0f/9.0f));
+	series = vmlaq_f32(vdupq_n_f32(2.0f/5.0f), t2, series);
+	series = vmlaq_f32(vdupq_n_f32(2.0f/3.0f), t2, series);
+	series = vmlaq_f32(vdupq_n_f32(2.0f), t2, series);
+	series = vmulq_f32(t, series);
+	return vmlaq_f32(e, series, vdupq_n_f32((float)M_LOG2E));
+}
+#endif
+
+// squared magnitudes of n interleaved complex values
+static void powerSpectrum(const float* cpx, float* power, int n){
+	int i = 0;
+#if defined(__ARM_NEON)
+	for (; i+4<=n; i+=4){
+		float32x4x2_t c = vld2q_f32(&cpx[2*i]); // deinterleaves real and imaginary parts
+		vst1q_f32(&power[i], vmlaq_f32(vmulq_f32(c.val[0], c.val[0]), c.val[1], c.val[1]));
+	}
+#endif
+	for (; i<n; i++)
+		power[i] = cpx[2*i]*cpx[2*i] + cpx[2*i+1]*cpx[2*i+1];
+}
+
+// turns squared magnitudes into what is plotted, in place
+void Scope::scalePowerFFT(float* data, int n){
+	int i = 0;
+	if (FFTYAxis == 0){ // normalised linear magnitude
+#if defined(__aarch64__)
+		float32x4_t scale = vdupq_n_f32(FFTScale);
+		for (; i+4<=n; i+=4)
+			vst1q_f32(&data[i], vmulq_f32(vsqrtq_f32(vld1q_f32(&data[i])), scale));
+#endif
+		for (; i<n; i++)
+			data[i] = FFTScale * sqrtf(data[i]);
+	} else { // decibels, 10*log10(x) = 10*log10(2)*log2(x)
+		const float dBPerOctave = 10.0f * log10f(2.0f);
+#if defined(__ARM_NEON)
+		float32x4_t offset = vdupq_n_f32(FFTLogOffset);
+		for (; i+4<=n; i+=4)
+			vst1q_f32(&data[i], vmlaq_f32(offset, fastLog2(vld1q_f32(&data[i])), vdupq_n_f32(dBPerOctave)));
+#endif
+		for (; i<n; i++)
+			data[i] = dBPerOctave * fastLog2(data[i]) + FFTLogOffset;
+	}
+}
+
+// pixel to bin maps, so that no expf() is needed for each FFT
+void Scope::setFFTBins(){
+	binsFrameWidth = frameWidth;
+	binsDownSampling = downSampling;
+	binsXAxis = FFTXAxis;
+
+	binLowFFT.resize(frameWidth);
+	binHighFFT.resize(frameWidth);
+	binFracFFT.resize(frameWidth);
+
+	int lastBin = FFTLength/2;
+	float ratio = (float)(FFTLength/2)/(frameWidth*downSampling);
+	float logConst = -logf(1.0f/(float)frameWidth)/(float)frameWidth;
+	interpolateFFT = (ratio < 1.0f);
+
+	for (int i=0; i<frameWidth; i++){
+		if (interpolateFFT){
+			// more pixels than bins, interpolate between the 2 closest bins
+			float findex = 0.0f;
+			if (FFTXAxis == 0){  // linear
+				findex = (float)i*ratio;
+			} else if (FFTXAxis == 1){  // logarithmic
+				findex = expf((float)i*logConst)*ratio;
+			}
+			int index = (int)(findex);
+			binLowFFT[i] = std::min(index, lastBin);
+			binHighFFT[i] = std::min(index+1, lastBin);
+			binFracFFT[i] = findex - index;
+		} else {
+			// more bins than pixels, each pixel shows the max of the bins it covers
+			float findex = (float)i*ratio;
+			int mindex = 0;
+			int maxdex = 0;
+			if (FFTXAxis == 0){  // linear
+				mindex = (int)(findex - ratio/2.0f) + 1;
+				maxdex = (int)(findex + ratio/2.0f);
+			} else if (FFTXAxis == 1){ // logarithmic
+				mindex = expf(((float)i - 0.5f)*logConst)*ratio;
+				maxdex = expf(((float)i + 0.5f)*logConst)*ratio;
+			}
+			if (mindex < 0) mindex = 0;
+			if (maxdex > lastBin) maxdex = lastBin;
+			binLowFFT[i] = mindex;
+			binHighFFT[i] = maxdex; // may be lower than mindex, empty pixel
+			binFracFFT[i] = 0.0f;
+		}
+	}
+}
+
 void Scope::doFFT(){
 
-	if(isResizing)
-		return;
-	
-	isUsingOutBuffer = true;
-	
-    // constants
-    int ptr = readPointer-FFTLength+channelWidth;
-    float ratio = (float)(FFTLength/2)/(frameWidth*downSampling);
-    float logConst = -logf(1.0f/(float)frameWidth)/(float)frameWidth;
-    
-    isUsingBuffer = true;
+	if (!outFFT) return; // could not allocate
+
+	if (frameWidth != binsFrameWidth || downSampling != binsDownSampling || FFTXAxis != binsXAxis)
+		setFFTBins();
+
+    int bins = FFTLength/2 + 1;
+    int ptr = (readPointer-FFTLength+channelWidth)%channelWidth;
+    int firstPart = std::min(FFTLength, channelWidth-ptr);
+
+    // prepare the FFT inputs of all channels & do windowing
     for (int c=0; c<numChannels; c++){
-    	
-        // prepare the FFT input & do windowing
-        for (int i=0; i<FFTLength; i++){
-            // inFFT[i].r = (ne10_float32_t)(buffer[(ptr+i)%channelWidth+c*channelWidth] * windowFFT[i]);
-            // inFFT[i].i = 0;
-            fft.td(i) = buffer[(ptr + i) % channelWidth + c*channelWidth] * windowFFT[i];
-        }
-        
-        // do the FFT
-        // ne10_fft_c2c_1d_float32_neon (outFFT, inFFT, cfg, 0);
-        fft.fft();
-        
-        if (ratio < 1.0f){
-        
-            // take the magnitude of the complex FFT output, scale it and interpolate
+        const float* chn = &buffer[c*channelWidth];
+        float* in = &inFFT[c*FFTLength];
+        for (int i=0; i<firstPart; i++)
+            in[i] = chn[ptr+i] * windowFFT[i];
+        for (int i=firstPart; i<FFTLength; i++)
+            in[i] = chn[i-firstPart] * windowFFT[i];
+    }
+
+    // do the FFTs
+#ifdef NE10_FFT
+    for (int c=0; c<numChannels; c++)
+        ne10_fft_r2c_1d_float32_neon(&outFFT[c*bins], &inFFT[c*FFTLength], cfg);
+#else
+    fftwf_execute(planFFT);
+#endif
+
+    powerSpectrum((const float*)outFFT, powerFFT.data(), numChannels*bins);
+
+    for (int c=0; c<numChannels; c++){
+        float* power = &powerFFT[c*bins];
+        float* out = &outBuffer[c*frameWidth];
+
+        if (interpolateFFT){
+            // scale the bins then interpolate, bins are fewer than pixels
+            scalePowerFFT(power, bins);
             for (int i=0; i<frameWidth; i++){
-                
-                float findex = 0.0f;
-                if (FFTXAxis == 0){  // linear
-                    findex = (float)i*ratio;
-                } else if (FFTXAxis == 1){  // logarithmic
-                    findex = expf((float)i*logConst)*ratio;
-                }
-                
-                int index = (int)(findex);
-                float rem = findex - index;
-                
-				float yAxis[2];
-				for(unsigned int n = 0; n < 2; ++n){
-                    // float magSquared = outFFT[index + n].r * outFFT[index + n].r + outFFT[index + n].i * outFFT[index + n].i;
-					if (FFTYAxis == 0){ // normalised linear magnitude
-						// yAxis[n] = FFTScale * sqrtf(magSquared);
-                        yAxis[n] = FFTScale * fft.fda(index + n);
-					} else { // Otherwise it is going to be (FFTYAxis == 1): decibels
-                        float magSquared = fft.fdr(index + n) * fft.fdr(index + n) + fft.fdi(index + n) * fft.fdi(index + n);
-						yAxis[n] = 10.0f * log10f(magSquared) + FFTLogOffset;
-					}
-				}
-                
-				// linear interpolation
-				outBuffer[c*frameWidth+i] = yAxis[0] + rem * (yAxis[1] - yAxis[0]);
+                float low = power[binLowFFT[i]];
+                out[i] = low + binFracFFT[i] * (power[binHighFFT[i]] - low);
             }
-            
         } else {
-            
-            /*float mags[FFTLength/2];
-            for (int i=0; i<FFTLength/2; i++){
-                mags[i] = (float)(outFFT[i].r * outFFT[i].r + outFFT[i].i * outFFT[i].i);
-            }*/
-            
+            // search the max then scale, pixels are fewer than bins
             for (int i=0; i<frameWidth; i++){
-                
-                float findex = (float)i*ratio;
-                int mindex = 0;
-                int maxdex = 0;
-                if (FFTXAxis == 0){  // linear
-                    mindex = (int)(findex - ratio/2.0f) + 1;
-                    maxdex = (int)(findex + ratio/2.0f);
-                } else if (FFTXAxis == 1){ // logarithmic
-                    mindex = expf(((float)i - 0.5f)*logConst)*ratio;
-                    maxdex = expf(((float)i + 0.5f)*logConst)*ratio;
-                }
-                
-                if (mindex < 0) mindex = 0;
-                if (maxdex >= FFTLength/2) maxdex = FFTLength/2;
-                
-                // do all magnitudes first, then search? - turns out this doesnt help
                 float maxVal = 0.0f;
-                for (int j=mindex; j<=maxdex; j++){
-                    // float mag = (float)(outFFT[j].r * outFFT[j].r + outFFT[j].i * outFFT[j].i);
-                    float mag = (float)(fft.fdr(j) * fft.fdr(j) + fft.fdi(j) * fft.fdi(j));
-                    if (mag > maxVal){
-                        maxVal = mag;
-                    }
-                }
-                
-                if (FFTYAxis == 0){ // normalised linear magnitude
-                    outBuffer[c*frameWidth+i] = FFTScale * sqrtf(maxVal);
-                } else if (FFTYAxis == 1){ // decibels
-                    outBuffer[c*frameWidth+i] = 10.0f * log10f(maxVal) + FFTLogOffset;
+                for (int j=binLowFFT[i]; j<=binHighFFT[i]; j++){
+                    if (power[j] > maxVal)
+                        maxVal = power[j];
                 }
+                out[i] = maxVal;
             }
+            scalePowerFFT(out, frameWidth);
         }
-        
     }
-    
-	isUsingBuffer = false;
-	
+
 	// sendBufferTask.schedule((void*)&outBuffer[0], outBuffer.size()*sizeof(float));
     // rt_printf("scheduling sendBufferTask size: %i\n", outBuffer.size());
-    web_server->send/*Rt*/(_addressData.c_str(), outBuffer.data(), outBuffer.size() * sizeof(float));
-
-    isUsingOutBuffer = false;
+    sendOutBuffer();
 }
 
 void Scope::setXParams(){
@@ -718,6 +1042,14 @@ void Scope::setTrigger(TriggerMode mode, unsigned int channel, TriggerSlope dir,
 	setSetting(/*L*/"triggerLevel", level);
 }
 
+void Scope::setEncoding(Encoding encoding){
+	setSetting("encoding", encoding);
+}
+
+void Scope::setMinMaxDecimation(bool minMax){
+	setSetting("minMaxDecimation", minMax);
+}
+
 // void Scope::setSetting(std::wstring setting, float value){
 	
 // 	// std::string str = std::string(setting.begin(), setting.end());
@@ -776,18 +1108,14 @@ void Scope::setTrigger(TriggerMode mode, unsigned int channel, TriggerSlope dir,
 // }
 
 void Scope::setSetting(const std::string& key, float value) {
+    // settings that change the buffers are applied by the trigger thread
     if (key == "frameWidth") {
-        stop();
         pixelWidth = static_cast<int>(value);
-        setPlotMode();
-        start();
+        resizeRequested = true;
     }
     else if (key == "plotMode") {
-        stop();
         plotMode = static_cast<PlotMode>(value);
-        setPlotMode();
-        setXParams();
-        start();
+        resizeRequested = true;
     }
     else if (key == "triggerMode") {
         triggerMode = static_cast<TriggerMode>(value);
@@ -806,11 +1134,8 @@ void Scope::setSetting(const std::string& key, float value) {
         setXParams();
     }
     else if (key == "upSampling") {
-        stop();
         upSampling = static_cast<int>(value);
-        setPlotMode();
-        setXParams();
-        start();
+        resizeRequested = true;
     }
     else if (key == "downSampling") {
         downSampling = static_cast<int>(value);
@@ -820,11 +1145,8 @@ void Scope::setSetting(const std::string& key, float value) {
         setXParams();
     }
     else if (key == "FFTLength") {
-        stop();
         newFFTLength = static_cast<int>(value);
-        setPlotMode();
-        setXParams();
-        start();
+        resizeRequested = true;
     }
     else if (key == "FFTXAxis") {
         FFTXAxis = static_cast<int>(value);
@@ -838,6 +1160,13 @@ void Scope::setSetting(const std::string& key, float value) {
     else if (key == "sampleRate") {
         sampleRate = value;
     }
+    else if (key == "encoding") {
+        if (value >= FLOAT32 && value <= FLOAT16)
+            encoding = static_cast<Encoding>(value);
+    }
+    else if (key == "minMaxDecimation") {
+        minMaxDecimation = (value != 0);
+    }
 
     // Store/update in your settings map
     settings[key] = value;
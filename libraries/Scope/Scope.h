@@ -8,12 +8,14 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <atomic>
 #include "thread_utils.h"
 #include "libraries/JSON/json.hpp"
 
 #define FRAMES_STORED 4
 
-#define TRIGGER_LOG_COUNT 16
+// frames logged by the audio thread and not yet collected by the trigger thread, must be a power of 2
+#define SCOPE_RING_FRAMES 8192
 
 // forward declaration
 class WebServer;
@@ -43,6 +45,11 @@ class Scope{
 		NEGATIVE, ///< Trigger when crossing the threshold and the signal is decreasing
 		BOTH, ///< Trigger on any crossing of the threshold.
 	} TriggerSlope;
+	typedef enum {
+		FLOAT32, ///< Full precision, 4 bytes per sample
+		INT16, ///< 16 bit integers, scaled to the peak of each channel in the frame
+		FLOAT16, ///< Half precision floats
+	} Encoding;
 
         Scope();
 	Scope(unsigned int numChannels, float sampleRate);
@@ -80,6 +87,28 @@ class Scope{
          * @param values a pointer to an array containing numChannels values.
          */
         void log(const float* values);
+
+        /**
+         * \brief Logs a block of frames to the scope.
+         *
+         * Copies all the frames in one go, e.g., once per period, which is much cheaper
+         * than calling log() for each frame.
+         *
+         * @param interleaved a pointer to the first channel of the first frame.
+         * @param frames number of frames to log.
+         * @param stride distance between the beginnings of two consecutive frames, in floats;
+         * 0 means numChannels, i.e., frames are packed. Useful to log a subset of the channels of
+         * a wider buffer, e.g., logBlock(&buffer[2], frames, 8) logs channels 2 onwards of 8 channel frames.
+         */
+        void logBlock(const float* interleaved, unsigned int frames, unsigned int stride = 0);
+
+        /**
+         * \brief Logs a block of frames to the scope, from separate channel buffers.
+         *
+         * @param channels an array of numChannels pointers, each to the first sample of a channel.
+         * @param frames number of frames to log.
+         */
+        void logBlockPlanar(const float* const* channels, unsigned int frames);
         
         /** 
          * \brief Cause the scope to trigger when set to custom trigger mode.
@@ -93,6 +122,22 @@ class Scope{
 	 * Set the triggering mode for the scope
 	 */
 	void setTrigger(TriggerMode mode, unsigned int channel = 0, TriggerSlope dir = BOTH, float level = 0);
+
+	/**
+	 * \brief Set how samples are encoded when frames are sent to the browser.
+	 *
+	 * INT16 and FLOAT16 halve the bandwidth, which helps on busy networks or at high refresh rates.
+	 */
+	void setEncoding(Encoding encoding);
+
+	/**
+	 * \brief Set how frames are decimated when downsampling in time domain.
+	 *
+	 * When on [default], each pair of pixels shows the max and min of all the samples it covers,
+	 * so that peaks are visible at any time base. When off, one sample out of downSampling is shown.
+	 * Triggering always works on the latter.
+	 */
+	void setMinMaxDecimation(bool minMax);
 		
     private:
 	typedef enum {
@@ -105,8 +150,12 @@ class Scope{
         void triggerTimeDomain();
         void triggerFFT();
         bool triggered();
-        bool prelog();
+        float* prelog();
         void postlog();
+        unsigned int ringSpace(unsigned int frames);
+        void collect();
+        void copyOutBuffer(int startptr);
+        void sendOutBuffer();
         void setPlotMode();
         void doFFT();
         void setXParams();
@@ -115,9 +164,9 @@ class Scope{
         //void parse_settings(JSONValue* value);
         void parse_settings(const nlohmann::json& value);
         
-	bool volatile isUsingOutBuffer;
-	bool volatile isUsingBuffer;
-	bool volatile isResizing;
+	// plot settings that change the buffers are applied by the trigger thread, the only one that uses them
+	std::atomic<bool> resizeRequested;
+	bool configured;
 		
         // settings
         int numChannels;
@@ -125,6 +174,7 @@ class Scope{
         int pixelWidth;
         int frameWidth;
         PlotMode plotMode = TIME_DOMAIN;
+        PlotMode activePlotMode = TIME_DOMAIN; // the one buffers are currently set for, trigger thread only
         TriggerMode triggerMode;
         unsigned int triggerChannel;
         TriggerSlope triggerDir;
@@ -135,30 +185,42 @@ class Scope{
         int downSampling;
         float holdOff;
         
-        int logCount;
-        
         int channelWidth;
-        int downSampleCount;
+        int downSampleCount; // trigger thread only
+        int activeDownSampling;
+        Encoding encoding = FLOAT32;
+        bool minMaxDecimation = true;
         int holdOffSamples;
         
-        // buffers
+        // capture ring, written by the audio thread [log() and logBlock()] and read by the trigger thread
+        std::vector<float> ring; // SCOPE_RING_FRAMES interleaved frames
+        alignas(64) std::atomic<unsigned int> ringWrite;
+        alignas(64) std::atomic<unsigned int> ringRead;
+
+        // buffers, trigger thread only
         std::vector<float> buffer;
+        std::vector<float> bufferMin; // min and max of the samples each downsampled one stands for
+        std::vector<float> bufferMax;
+        std::vector<unsigned int> bufferFrame; // ring index of the frame in each slot, the last of its group when downsampling
+        std::vector<float> groupMin; // numChannels, for the downsampled frame being collected
+        std::vector<float> groupMax;
         std::vector<float> outBuffer;
+        std::vector<char> packet; // outBuffer, encoded
         
         // pointers
         int writePointer;
         int readPointer;
         int triggerPointer;
-        int customTriggerPointer;
+        std::atomic<unsigned int> customTriggerFrame; // ring index set by trigger()
         
         // trigger status
-        bool triggerPrimed;
+        std::atomic<bool> triggerPrimed;
         bool triggerCollecting;
         bool triggerWaiting;
         int triggerCount;
         int autoTriggerCount;
-        bool started;
-        bool customTriggered;
+        std::atomic<bool> started;
+        std::atomic<bool> customTriggered;
         
         // FFT
         int FFTLength;
@@ -171,10 +233,27 @@ class Scope{
         int FFTXAxis;
         int FFTYAxis;
         
-        // ne10_fft_cpx_float32_t* inFFT;
-        // ne10_fft_cpx_float32_t* outFFT;
-        // ne10_fft_cfg_float32_t cfg;
-        Fft fft;
+        // real-to-complex transforms of all channels, FFTLength/2+1 bins each
+        float* inFFT; // windowed, numChannels*FFTLength
+#ifdef NE10_FFT
+        ne10_fft_cpx_float32_t* outFFT;
+        ne10_fft_r2c_cfg_float32_t cfg;
+#else
+        fftwf_complex* outFFT;
+        fftwf_plan planFFT; // one plan for all channels
+#endif
+        std::vector<float> powerFFT; // squared magnitudes of all channels
+        
+        // pixel to bin maps, recomputed only when the settings they depend on change
+        void setFFTBins();
+        void scalePowerFFT(float* data, int n);
+        std::vector<int> binLowFFT; // first bin of each pixel
+        std::vector<int> binHighFFT; // last bin of each pixel, or next bin when interpolating
+        std::vector<float> binFracFFT; // interpolation weight of the high bin
+        bool interpolateFFT;
+        int binsFrameWidth;
+        int binsDownSampling;
+        int binsXAxis;
         
         //std::unique_ptr<AuxTaskRT> scopeTriggerTask;
         pthread_t scopeTrigger_thread;
@@ -192,7 +271,6 @@ class Scope{
 
         //VIC
         bool shouldStop;
-        std::atomic<bool> triggerSignal;
         std::unique_ptr<WebServer> web_server;
         int _port;
         std::string _addressControl;
@@ -23,9 +23,26 @@ The Bela software is distributed under the GNU Lesser General Public License (LG
 #include <seasocks/Server.h>
 #include <seasocks/WebSocket.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <cstring> // memcpy, strlen
+#include <cerrno>
+#include <sched.h>
 
 
-constexpr unsigned int WSServerClientSleepUs = 100;
+// ring bytes taken by a message, header and null char included
+static inline size_t outputRecordBytes(unsigned int size) {
+	return (WSOutRecordAlign + size + 1 + WSOutRecordAlign-1) & ~(size_t)(WSOutRecordAlign-1);
+}
+
+// threads set their priority when they start, before sending anything, so the policy is checked only once per thread
+static bool isRealTimeThread() {
+	static thread_local int realTime = -1;
+	if(realTime < 0) {
+		int policy = sched_getscheduler(0);
+		realTime = (policy == SCHED_FIFO || policy == SCHED_RR) ? 1 : 0;
+	}
+	return realTime;
+}
 
 WSServer::WSServer(){}
 WSServer::WSServer(unsigned int port, std::string resourceRoot){
@@ -72,8 +89,7 @@ void WSServer::setup(unsigned int port, std::string resourceRoot) {
 	server = std::make_shared<seasocks::Server>(logger);
 
     // prepare client loop vars
-    outputs_writePtr.store(-1);
-	outputs_readPtr = -1;
+    initOutputs();
 
 	shouldStop = false;
 	pthread_create(&client_thread, NULL, client_func_static, this);
@@ -94,6 +110,17 @@ void WSServer::addAddress(std::string address, std::function<void(std::string, v
 	address_book[address] = handler;
 }
 
+void WSServer::initOutputs() {
+	// not initialized, pages are committed only when used
+	outputs = std::unique_ptr<char[]>(new char[WSOutRingSize]);
+	outputs_writePos.store(0);
+	outputs_readPos.store(0);
+	outputs_dispatchPos = 0;
+	outputs_eventFd = eventfd(0, EFD_CLOEXEC);
+	if(outputs_eventFd == -1)
+		fprintf(stderr, "Web socket server error! Cannot create event fd, no data will be sent\n");
+}
+
 int WSServer::send(const char* address, const char* str) {
 	return send(address, (const void*)str, strlen(str));
 }
@@ -107,20 +134,44 @@ int WSServer::send(const char* address, const void* buf, unsigned int size)
     }
 
 
-	// pack up arguments	
-	WSOutputData out;
-	out.address = (char *)address;
-	memcpy(out.buff, buf, size);    // Copy the data into the buffer; no need to erase it, because we store size too!
-	out.size = size;
+	size_t recordBytes = outputRecordBytes(size);
+	const size_t mask = WSOutRingSize-1;
+
+	// real-time threads (audio, scope trigger) must not wait for lower priority senders, they drop the message instead
+	std::unique_lock<std::mutex> lock(outputs_writeMutex, std::defer_lock);
+	if(isRealTimeThread()) {
+		if(!lock.try_lock())
+			return -1;
+	}
+	else
+		lock.lock();
+
+	size_t writePos = outputs_writePos.load(std::memory_order_relaxed);
+	size_t freeBytes = WSOutRingSize - (writePos - outputs_readPos.load(std::memory_order_acquire));
+	// messages are never split, if they do not fit at the end of the ring they start back from the beginning
+	size_t tailBytes = WSOutRingSize - (writePos & mask);
+	size_t skipBytes = (tailBytes < recordBytes) ? tailBytes : 0;
+	if(skipBytes + recordBytes > freeBytes)
+		return -1; // messages are not being sent as fast as they are written
+
+	if(skipBytes > 0) {
+		WSOutputRecord* skip = (WSOutputRecord*)&outputs[writePos & mask];
+		skip->address = NULL;
+		skip->size = 0;
+		writePos += skipBytes;
+	}
 
-	// read the index of the last value we wrote
-	int writePtr = outputs_writePtr.load();
-	writePtr = (writePtr + 1) % output_queue_size;
+	char* record = &outputs[writePos & mask];
+	((WSOutputRecord*)record)->address = address;
+	((WSOutputRecord*)record)->size = size;
+	memcpy(record + WSOutRecordAlign, buf, size);
+	record[WSOutRecordAlign + size] = '\0';
 
-	//printf("---------------> buffer %d[%d]: %s\n", writePtr, size, (char *)out.buff);
+	outputs_writePos.store(writePos + recordBytes, std::memory_order_release);
+	lock.unlock();
 
-	outputs[writePtr].store(out); // push output into queue
-	outputs_writePtr.store(writePtr);  // update index of the last value in queue
+	uint64_t one = 1;
+	write(outputs_eventFd, &one, sizeof(one));
 
 	return 0;
 }
@@ -129,9 +180,13 @@ void WSServer::cleanup()
 {
 	shouldStop = true;
 	server->terminate();
+	// wake up client thread
+	uint64_t one = 1;
+	write(outputs_eventFd, &one, sizeof(one));
 	// wait for completion
 	pthread_join(client_thread, NULL);
     pthread_join(serve_thread, NULL);
+	close(outputs_eventFd);
 }
 
 
@@ -158,56 +213,58 @@ void* WSServer::serve_func_static(void* arg)
 
 void* WSServer::client_func()
 {
+	const size_t mask = WSOutRingSize-1;
+
 	while(!shouldStop)
 	{
-		// here we use a non-blocking circular buffer to make sure that all output values are sent
-        // this is guaranteed by the large size of the buffer, i.e., the store index [write pointer] will never overtake by a lap the load index [read pointer]
-
-        // read the index of the latest value that was written
-        int writePtr = outputs_writePtr.load();
-
-        // until the index of the last written value is equal to the index of the last value we read/sent...
-        while(outputs_readPtr != writePtr) 
-        { 
-			outputs_readPtr = (outputs_readPtr + 1) % output_queue_size;  // move the read pointer forward, it will be the latest value we send
+		// sleep until send() or cleanup() wake us up
+		uint64_t count;
+		if(read(outputs_eventFd, &count, sizeof(count)) < 0 && errno != EINTR)
+			break;
+
+		size_t writePos = outputs_writePos.load(std::memory_order_acquire);
+
+		// all messages written so far are passed to the server, with no copy
+		while(outputs_dispatchPos != writePos)
+		{
+			const WSOutputRecord* record = (const WSOutputRecord*)&outputs[outputs_dispatchPos & mask];
+			if(!record->address)
+			{
+				// end of the ring was skipped, it is released with the next message
+				outputs_dispatchPos += WSOutRingSize - (outputs_dispatchPos & mask);
+				continue;
+			}
 
-			WSOutputData output = outputs[outputs_readPtr].load(); // get current output
-			// unpack 
-			std::shared_ptr<GuiWSHandler> handler = address_book.at(output.address);
-			const void* buf = output.buff;
-			unsigned int size = output.size;
+			const char* data = (const char*)record + WSOutRecordAlign;
+			unsigned int size = record->size;
+			std::shared_ptr<GuiWSHandler> handler;
+			auto it = address_book.find(record->address);
+			if(it != address_book.end())
+				handler = it->second;
+			outputs_dispatchPos += outputRecordBytes(size);
+			size_t releasePos = outputs_dispatchPos;
 
-			//printf("---------------> %s --- buffer %d[%d]: %s\n", output.address, outputs_readPtr, size, (char *)output.buff);
-			 
 			try  
 			{
 				// send, via execute
-				if(handler->binary)
-				{
-					// make a copy of the data before we send it out
-					auto data = std::make_shared<std::vector<void*> >(size);
-					memcpy(data->data(), buf, size);
-					handler->server->execute([handler, data, size] {
+				// executables run in order on the server thread, so messages are released in the same order they were written
+				server->execute([this, handler, data, size, releasePos] {
+					if(handler)
+					{
 						for (auto c : handler->connections){
-							c->send((uint8_t*) data->data(), size);
+							if(handler->binary)
+								c->send((const uint8_t*) data, size);
+							else
+								c->send(data); // null terminated in the ring
 						}
-					});
-				} else {
-					// make a copy of the data before we send it out
-					std::string str((const char*)buf, size);  // Use size-aware constructor
-					handler->server->execute([handler, str] {
-						for (auto c : handler->connections) {
-							c->send(str.c_str());
-						}
-					});
-				}
+					}
+					outputs_readPos.store(releasePos, std::memory_order_release);
+				});
 			} catch(std::exception& e) 
 			{
 				std::cerr << "Could not send data via web server, exception caught: " << e.what() << std::endl;
 			}
 		}
-
-		usleep(WSServerClientSleepUs);
 	}
 	return (void *)0;
 }
@@ -25,6 +25,9 @@ The Bela software is distributed under the GNU Lesser General Public License (LG
 #include <string>
 #include <memory>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <functional>
 #include "thread_utils.h"
 
 // forward declarations for faster render.cpp compiles
@@ -34,13 +37,16 @@ namespace seasocks{
 //class AuxTaskNonRT;
 struct GuiWSHandler;
 
-constexpr unsigned int WSOutDataMax = 230400;
+constexpr unsigned int WSOutDataMax = 230400; // longer messages are truncated
+constexpr unsigned int WSOutRingSize = 1 << 21; // bytes of messages waiting to be sent, must be a power of 2
+constexpr unsigned int WSOutRecordAlign = 16; // messages start at multiples of this, header included
 
-struct WSOutputData {
-	char* address;
-	char buff[WSOutDataMax];
-    unsigned int size;
+// header of each message in the output ring, followed by the data and a null char [so that strings can be sent as they are]
+struct WSOutputRecord {
+	const char* address; // NULL if the rest of the ring is skipped
+	unsigned int size;
 };
+static_assert(sizeof(WSOutputRecord) <= WSOutRecordAlign, "WSOutputRecord does not fit in its slot");
 
 class WSServer{
 	public:
@@ -62,18 +68,22 @@ class WSServer{
 	protected:
 		void cleanup();
 
-		static constexpr int output_queue_size = 100; // this is the number of outputs that can be written in a row without the risk of skipping transmission
-
 		unsigned int _port;	
 		std::shared_ptr<seasocks::Server> server;
 		std::map< std::string, std::shared_ptr<GuiWSHandler> > address_book;
 		
-	    bool shouldStop;
+	    std::atomic<bool> shouldStop;
 
 		pthread_t client_thread;
-		std::atomic<WSOutputData> outputs[output_queue_size];
-    	int outputs_readPtr;
-    	std::atomic<int> outputs_writePtr;
+		// messages are copied once into this ring by send(), then the client thread passes them to the server, that sends them from here
+		// their space is released only after they have been sent
+		void initOutputs();
+		std::unique_ptr<char[]> outputs;
+		std::mutex outputs_writeMutex; // send() is called by audio, scope and server threads, real-time ones never wait for it
+		std::atomic<size_t> outputs_writePos; // end of the last message written
+		std::atomic<size_t> outputs_readPos; // end of the last message sent
+		size_t outputs_dispatchPos; // end of the last message passed to the server, client thread only
+		int outputs_eventFd; // wakes up the client thread
 		void* client_func();
 		static void* client_func_static(void* arg);
 
@@ -37,8 +37,7 @@ void WebServer::setup(std::string projectName, std::string serverName, unsigned
 	server = std::make_shared<seasocks::Server>(logger);
 
     // prepare client loop vars
-    outputs_writePtr.store(-1);
-	outputs_readPtr = -1;
+    initOutputs();
 }
 
 void WebServer::addPageHandler(std::__ndk1::shared_ptr<seasocks::PageHandler> handler) {
@@ -59,9 +59,53 @@ onmessage = function(e){
 	}
 }
 
+// frames start with a 4 byte encoding id, see Scope::sendOutBuffer()
+const encodingFloat32 = 0;
+const encodingInt16 = 1;
+const encodingFloat16 = 2;
+
+function halfToFloat(h){
+	var sign = (h & 0x8000) ? -1 : 1;
+	var exponent = (h >> 10) & 0x1f;
+	var mantissa = h & 0x3ff;
+	if (exponent === 0)
+		return sign * mantissa * Math.pow(2, -24);
+	if (exponent === 0x1f)
+		return mantissa ? NaN : sign * Infinity;
+	return sign * (1 + mantissa / 1024) * Math.pow(2, exponent - 15);
+}
+
+function decodeFrame(buffer){
+	var view = new DataView(buffer);
+	var encoding = view.getUint32(0, true);
+	if (encodingFloat32 === encoding)
+		return new Float32Array(buffer, 4);
+	
+	var frame;
+	if (encodingInt16 === encoding){
+		var samplesOffset = 4 + numChannels*4;
+		var length = (buffer.byteLength - samplesOffset) / 2;
+		frame = new Float32Array(length);
+		if (numChannels <= 0 || length % numChannels) return frame; // dropped by length check
+		var width = length / numChannels;
+		for (var channel=0; channel<numChannels; ++channel){
+			var scale = view.getFloat32(4 + channel*4, true) / 32767;
+			for (var n=channel*width; n<(channel+1)*width; ++n)
+				frame[n] = view.getInt16(samplesOffset + n*2, true) * scale;
+		}
+	} else if (encodingFloat16 === encoding){
+		frame = new Float32Array((buffer.byteLength - 4) / 2);
+		for (var n=0; n<frame.length; ++n)
+			frame[n] = halfToFloat(view.getUint16(4 + n*2, true));
+	} else {
+		frame = new Float32Array(0);
+	}
+	return frame;
+}
+
 var ws_onmessage = function(e){
 
-	var inArray = new Float32Array(e.data);
+	var inArray = decodeFrame(e.data);
 // 	console.log("worker: recieved buffer of length "+inArray.length, inArrayWidth);
 //	console.log(settings.frameHeight, settings.numChannels, settings.frameWidth, channelConfig);
 	
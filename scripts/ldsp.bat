@@ -171,11 +171,13 @@ rem End of :install_scripts
   set "neon_audio_format=ON"
   set "neon_fft=ON"
   set "build_type=Release"
+  set "hot_reload=OFF"
   
   rem Apply flags from global parsing
   if defined NO_NEON_AUDIO set "neon_audio_format=OFF"
   if defined NO_NEON_FFT set "neon_fft=OFF"
   if defined DEBUG set "build_type=Debug"
+  if defined HOT_RELOAD set "hot_reload=ON"
 
   if "%config%" == "" (
     echo Cannot configure: hardware configuration file path not specified
@@ -376,6 +378,7 @@ rem End of :install_scripts
   echo   NEON audio fmt: %neon_audio_format%
   echo   NEON FFT:       %neon_fft%
   echo   Build type:     %build_type%
+  echo   Hot reload:     %hot_reload%
   echo   Phone serial:   %serial_display%
 
   echo.
@@ -386,7 +389,7 @@ rem End of :install_scripts
         -DDEVICE_ARCH=%arch% -DANDROID_ABI=%abi% -DANDROID_PLATFORM=android-%api_level% -DANDROID_NDK="%NDK%" %TOOLCHAIN_VER% ^
         -DNEON_SUPPORTED=%neon% -DNEON_AUDIO_FORMAT=%neon_audio_format% -DNE10_FFT=%neon_fft%^
         -DLDSP_PROJECT="%project_dir%" -DONNX_VERSION=%onnx_version% ^
-        -G Ninja -B"%build_dir%" -S".." -DCMAKE_BUILD_TYPE=%build_type%
+        -G Ninja -B"%build_dir%" -S".." -DCMAKE_BUILD_TYPE=%build_type% -DLDSP_HOT_RELOAD=%hot_reload%
 
 
   if not %ERRORLEVEL% == 0 (
@@ -406,6 +409,7 @@ rem End of :install_scripts
   echo api_level="%api_level%">>"%settings_file%"
   echo onnx_version="%onnx_version%">>"%settings_file%"
   echo phone_serial="%PHONE_SERIAL%">>"%settings_file%"
+  echo hot_reload="%hot_reload%">>"%settings_file%"
 
   exit /b 0
 
@@ -534,6 +538,7 @@ rem End of :push_debugserver
 			if /I "!key!"=="api_level"       set "api_level=!val!"
 			if /I "!key!"=="onnx_version"    set "onnx_version=!val!"
 			if /I "!key!"=="phone_serial"    set "phone_serial=!val!"
+			if /I "!key!"=="hot_reload"      set "hot_reload=!val:"=!"
 		)
 	) ELSE (
 		echo Cannot install: config file not found.
@@ -570,6 +575,12 @@ rem End of :push_debugserver
       )
   )
   if defined RUNNING (
+      rem in hot reload builds, the running ldsp reloads the new render module by itself
+      if /I "!hot_reload!"=="ON" if exist "build\bin\libldsp_render.so" (
+          echo ldsp is currently running on the device, installing the render module only...
+          call :install_render_module
+          exit /b 0
+      )
       echo ldsp is currently running on the device, stopping it first...
       %ADB% shell "su -c 'sh /data/ldsp/scripts/ldsp_stop.sh'"
       timeout /t 1 /nobreak >nul
@@ -613,6 +624,10 @@ rem End of :push_debugserver
 
   rem now the ldsp bin
   %ADB% push build\bin\ldsp "/sdcard/ldsp/projects/%project_name%/"
+  rem and the render module, in hot reload builds
+  if /I "!hot_reload!"=="ON" if exist "build\bin\libldsp_render.so" (
+    %ADB% push build\bin\libldsp_render.so "/sdcard/ldsp/projects/%project_name%/"
+  )
 
   rem now all resources that do not need to be updated at every build
   rem first check if /data/ldsp exists
@@ -680,6 +695,23 @@ rem End of :push_debugserver
   exit /b 0
 rem End of :install
 
+:install_render_module
+  rem Push the render module only, while ldsp is running. Hot reload builds only.
+  set "project_path=/data/ldsp/projects/%project_name%"
+
+  rem create temp folder on sdcard
+  %ADB% shell "su -c 'mkdir -p /sdcard/ldsp'"
+  %ADB% push build\bin\libldsp_render.so /sdcard/ldsp/
+  rem copied next to the module and then renamed, so that ldsp never loads a partially written file
+  %ADB% shell "su -c \"cp /sdcard/ldsp/libldsp_render.so '%project_path%/.libldsp_render.so.tmp' && mv '%project_path%/.libldsp_render.so.tmp' '%project_path%/libldsp_render.so'\""
+  rem remove temp folder from sdcard
+  %ADB% shell "su -c 'rm -r /sdcard/ldsp'"
+
+  echo Install of render module of project '%project_name%' complete, ldsp will reload it!
+
+  exit /b 0
+rem End of :install_render_module
+
 :run
   rem Run the user project on the phone.
 	setlocal EnableDelayedExpansion
@@ -960,6 +992,7 @@ rem End of :mixer_paths_opened
   echo   --no-neon-audio-format                            Configure to not use NEON parallel audio streams formatting
   echo   --no-neon-fft                                     Configure to not use NEON to parallelize FFT
   echo   --debug                                           Switch build type from Release to Debug (debug symbols, no optimizations)
+  echo   --hot-reload                                      Build render code as a module that is reloaded while ldsp runs, whenever it is installed again
   echo.
   echo Description:
   echo   install_scripts        Install the LDSP scripts on the phone (use --phone-serial when more phones are connected).
@@ -996,6 +1029,7 @@ set "PROJECT="
 set "NO_NEON_AUDIO="
 set "NO_NEON_FFT="
 set "DEBUG="
+set "HOT_RELOAD="
 
 set "grab_next="
 for %%A in (%*) do (
@@ -1026,6 +1060,8 @@ for %%A in (%*) do (
     set "NO_NEON_FFT=1"
   ) else if "%%~A"=="--debug" (
     set "DEBUG=1"
+  ) else if "%%~A"=="--hot-reload" (
+    set "HOT_RELOAD=1"
   ) else (
     rem Handle --flag=value format (when PowerShell keeps them together)
     if "!arg:~0,16!"=="--configuration=" set "CONFIG=!arg:~16!"
@@ -303,6 +303,13 @@ configure() {
     build_type="Release"
   fi
 
+  # render code built as separate module, if --hot-reload flag was passed
+  if [[ $HOT_RELOAD != "" ]] then
+    hot_reload="ON"
+  else
+    hot_reload="OFF"
+  fi
+
   echo ""
   echo "LDSP configuration:"
   echo "  Project:        $project_name"
@@ -315,6 +322,7 @@ configure() {
   echo "  NEON audio fmt: $neon_audio_format"
   echo "  NEON FFT:       $neon_fft"
   echo "  Build type:     $build_type"
+  echo "  Hot reload:     $hot_reload"
   echo "  Phone serial:   ${PHONE_SERIAL:-(not set)}"
   echo ""
   echo "CMake configuration:"
@@ -325,7 +333,7 @@ configure() {
         -DDEVICE_ARCH="$arch" -DANDROID_ABI="$abi" -DANDROID_PLATFORM="android-$api_level" -DANDROID_NDK="$NDK" $TOOLCHAIN_VER \
         -DNEON_SUPPORTED="$neon" -DNEON_AUDIO_FORMAT="$neon_audio_format" -DNE10_FFT="$neon_fft"\
         -DLDSP_PROJECT="$project_dir" -DONNX_VERSION="$onnx_version" \
-        -G Ninja -B"$build_dir" -S".." -DCMAKE_BUILD_TYPE="$build_type"
+        -G Ninja -B"$build_dir" -S".." -DCMAKE_BUILD_TYPE="$build_type" -DLDSP_HOT_RELOAD="$hot_reload"
 
 
   exit_code=$?
@@ -346,6 +354,7 @@ configure() {
   echo "ndk=\"$NDK\"" >> $settings_file
   echo "onnx_version=\"$onnx_version\"" >> $settings_file
   echo "phone_serial=\"$PHONE_SERIAL\"" >> $settings_file
+  echo "hot_reload=\"$hot_reload\"" >> $settings_file
 }
 
 # Build the user project.
@@ -454,6 +463,12 @@ install() {
       RUNNING=$($ADB shell "su -c 'ps -A'" | grep ldsp)
   fi
   if [ -n "$RUNNING" ]; then
+      # in hot reload builds, the running ldsp reloads the new render module by itself
+      if [[ $hot_reload == "ON" && -f build/bin/libldsp_render.so ]]; then
+          echo "ldsp is currently running on the device, installing the render module only..."
+          install_render_module
+          return
+      fi
       echo "ldsp is currently running on the device, stopping it first..."
       $ADB shell "su -c 'sh /data/ldsp/scripts/ldsp_stop.sh'"
       sleep 1
@@ -484,6 +499,10 @@ install() {
 
   # now the ldsp bin, double slash needed by Git Bash  
   $ADB push build/bin/ldsp "//sdcard/ldsp/projects/$project_name/"
+  # and the render module, in hot reload builds
+  if [[ $hot_reload == "ON" && -f build/bin/libldsp_render.so ]]; then
+    $ADB push build/bin/libldsp_render.so "//sdcard/ldsp/projects/$project_name/"
+  fi
 
   # now all resources that do not need to be updated at every build
   # first check if /data/ldsp exists
@@ -530,6 +549,19 @@ install() {
   echo "Install of project '$project_name' and dependencies complete!"
 }
 
+# Push the render module only, while ldsp is running. Hot reload builds only.
+install_render_module() {
+  project_path="/data/ldsp/projects/$project_name"
+
+  $ADB shell "su -c 'mkdir -p /sdcard/ldsp'" # create temp folder on sdcard
+  $ADB push build/bin/libldsp_render.so //sdcard/ldsp/ # double slash needed by Git Bash
+  # copied next to the module and then renamed, so that ldsp never loads a partially written file
+  $ADB shell "su -c 'cp /sdcard/ldsp/libldsp_render.so \"$project_path/.libldsp_render.so.tmp\" && mv \"$project_path/.libldsp_render.so.tmp\" \"$project_path/libldsp_render.so\"'"
+  $ADB shell "su -c 'rm -r /sdcard/ldsp'" # remove the temp /sdcard/ldsp directory from the device
+
+  echo "Install of render module of project '$project_name' complete, ldsp will reload it!"
+}
+
 # Run the user project on the phone.
 run () {
   # Retrieve variables from settings file
@@ -760,6 +792,7 @@ help() {
   echo -e "  --no-neon-audio-format\tConfigure to not use NEON parallel audio streams formatting"
   echo -e "  --no-neon-fft\t\t\tConfigure to not use NEON to parallelize FFT"
   echo -e "  --debug\t\t\tSwitch build type from Release to Debug (debug symbols, no optimizations)"
+  echo -e "  --hot-reload			Build render code as a module that is reloaded while ldsp runs, whenever it is installed again"
   echo -e "\nDescription:"
   echo -e "  install_scripts\t\tInstall the LDSP scripts on the phone (use --phone-serial when more phones are connected)."
   echo -e "  configure\t\t\tConfigure the LDSP build system for the specified phone and project (use --phone-serial when more phones are connected)."
@@ -834,6 +867,10 @@ while [[ $# -gt 0 ]]; do
       DEBUG=1
       shift
       ;;
+    --hot-reload)
+      HOT_RELOAD=1
+      shift
+      ;;
     --help|-h)
       STEPS+=("help")
       shift